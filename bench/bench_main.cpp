@@ -0,0 +1,115 @@
+#include "benchmark.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+std::vector<Benchmark> threadPoolBenchmarks();
+
+static void usage()
+{
+  std::cerr << "usage: run_bench [--format json|csv] [--output file]\n"
+            << "                 [--baseline file.csv] [--tolerance 0.1]\n"
+            << "                 [--repeat n] [--filter name] [--list]\n";
+}
+
+int main(int argc, char ** argv)
+{
+  std::string format = "json";
+  std::string output;
+  std::string baseline;
+  std::string filter;
+  double tolerance = 0.1;
+  std::size_t repetitions = 3;
+  bool list = false;
+  try
+  {
+    for(int i = 1; i < argc; i++)
+    {
+      std::string arg = argv[i];
+      bool hasValue = (i + 1 < argc);
+      if(arg == "--format" && hasValue) format = argv[++i];
+      else if(arg == "--output" && hasValue) output = argv[++i];
+      else if(arg == "--baseline" && hasValue) baseline = argv[++i];
+      else if(arg == "--tolerance" && hasValue) tolerance = std::stod(argv[++i]);
+      else if(arg == "--repeat" && hasValue) repetitions = std::stoul(argv[++i]);
+      else if(arg == "--filter" && hasValue) filter = argv[++i];
+      else if(arg == "--list") list = true;
+      else
+      {
+        usage();
+        return 2;
+      }
+    }
+    if(format != "json" && format != "csv")
+    {
+      usage();
+      return 2;
+    }
+    std::vector<BenchmarkResult> results;
+    for(auto & benchmark : threadPoolBenchmarks())
+    {
+      if(list)
+      {
+        std::cout << benchmark.name << std::endl;
+        continue;
+      }
+      if(!filter.empty() && benchmark.name.find(filter) == std::string::npos)
+      {
+        continue;
+      }
+      std::cerr << "running " << benchmark.name << std::endl;
+      BenchmarkContext context(benchmark.name, repetitions, results);
+      benchmark.func(context);
+    }
+    if(list)
+    {
+      return 0;
+    }
+    std::ofstream file;
+    if(!output.empty())
+    {
+      file.open(output);
+      if(!file)
+      {
+        throw std::runtime_error("cannot write " + output);
+      }
+    }
+    std::ostream & os = (output.empty() ? std::cout : file);
+    if(format == "csv")
+    {
+      writeCsv(os, results);
+    }
+    else
+    {
+      writeJson(os, results);
+    }
+    if(!baseline.empty())
+    {
+      std::ifstream is(baseline);
+      if(!is)
+      {
+        throw std::runtime_error("cannot read " + baseline);
+      }
+      auto regressions = findRegressions(readCsv(is), results, tolerance);
+      for(auto & r : regressions)
+      {
+        std::cerr << "REGRESSION " << r.current.benchmark << " "
+                  << r.current.metric << ": " << r.baseline.value
+                  << " -> " << r.current.value << " " << r.current.unit
+                  << " (" << (r.change * 100.0) << "%)" << std::endl;
+      }
+      if(!regressions.empty())
+      {
+        return 1;
+      }
+      std::cerr << "no regressions beyond " << (tolerance * 100.0) << "%" << std::endl;
+    }
+  }
+  catch(const std::exception & ex)
+  {
+    std::cerr << "run_bench: " << ex.what() << std::endl;
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,293 @@
+#include "benchmark.h"
+#include "thread_pool.h"
+#include "pool_stats.h"
+#include "n_queens.h"
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <thread>
+
+typedef std::chrono::steady_clock clock_type;
+
+static std::vector<std::size_t> threadCounts()
+{
+  std::vector<std::size_t> counts = { 1, 2, 4 };
+  std::size_t hw = std::thread::hardware_concurrency();
+  if(hw > 4)
+  {
+    counts.push_back(hw);
+  }
+  return counts;
+}
+
+static double seconds(clock_type::time_point start)
+{
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+enum class Notification
+{
+  None,
+  Observer,
+  EventBus
+};
+
+/** tasks per second, from submitting the first to finishing the last task */
+static double emptyTaskThroughput(std::size_t numThreads, std::size_t n,
+                                  Notification notification)
+{
+  auto pool = ThreadPool::create(numThreads);
+  if(notification == Notification::EventBus)
+  {
+    pool->enableEventBus();
+    pool->onTaskEvents([](const std::vector<TaskEvent> &) {});
+  }
+  pool->activate();
+  std::vector<std::shared_ptr<Task> > tasks;
+  tasks.reserve(n);
+  for(std::size_t i = 0; i < n; i++)
+  {
+    auto task = Task::create([](){});
+    if(notification == Notification::Observer)
+    {
+      task->onStateChange([](Task::State, std::shared_ptr<Task>,
+                             std::shared_ptr<ThreadPool>) {});
+    }
+    tasks.push_back(task);
+  }
+  auto start = clock_type::now();
+  for(auto & t : tasks)
+  {
+    pool->addTask(t);
+  }
+  for(auto & t : tasks)
+  {
+    t->wait();
+  }
+  double dt = seconds(start);
+  pool->terminate();
+  return double(n) / dt;
+}
+
+static void benchEmptyTaskThroughput(BenchmarkContext & context)
+{
+  for(auto numThreads : threadCounts())
+  {
+    context.measure("threads=" + std::to_string(numThreads), "tasks/s", true,
+                    [numThreads]() {
+                      return emptyTaskThroughput(numThreads, 100000,
+                                                 Notification::None);
+                    });
+  }
+}
+
+static void benchSubmitToStartLatency(BenchmarkContext & context)
+{
+  // one task at a time, so the latency is the wake up of an idle worker
+  const std::size_t n = 5000;
+  LatencyHistogram histogram;
+  for(std::size_t r = 0; r < context.getRepetitions(); r++)
+  {
+    auto pool = ThreadPool::create(2);
+    pool->activate();
+    std::vector<clock_type::time_point> started(n);
+    for(std::size_t i = 0; i < n; i++)
+    {
+      auto task = Task::create([&started, i](){ started[i] = clock_type::now(); });
+      auto submitted = clock_type::now();
+      pool->addTask(task);
+      task->wait();
+      histogram.record(std::chrono::duration_cast<LatencyHistogram::duration>(
+                         started[i] - submitted));
+    }
+    pool->terminate();
+  }
+  const double q[] = { 0.5, 0.99, 0.999 };
+  const char * names[] = { "p50", "p99", "p999" };
+  for(std::size_t i = 0; i < 3; i++)
+  {
+    context.report(names[i], double(histogram.percentile(q[i]).count()) / 1000.0,
+                   "us", false);
+  }
+}
+
+static void benchWaitStrategies(BenchmarkContext & context)
+{
+  // one task after each pause, so the workers have run out of work;
+  // cpu is the number of cores busy meanwhile, the submitter included
+  const std::size_t n = 2000;
+  const ThreadPool::WaitStrategy strategies[] = { ThreadPool::WaitStrategy::Block,
+                                                  ThreadPool::WaitStrategy::Park,
+                                                  ThreadPool::WaitStrategy::SpinThenPark };
+  const char * names[] = { "block", "park", "spin_then_park" };
+  for(std::size_t s = 0; s < 3; s++)
+  {
+    LatencyHistogram histogram;
+    double cpu = 0.0;
+    double wall = 0.0;
+    for(std::size_t r = 0; r < std::max<std::size_t>(context.getRepetitions(), 1); r++)
+    {
+      auto pool = ThreadPool::create(2);
+      pool->setWaitStrategy(strategies[s]);
+      pool->activate();
+      std::vector<clock_type::time_point> started(n);
+      std::clock_t cpuStart = std::clock();
+      auto start = clock_type::now();
+      for(std::size_t i = 0; i < n; i++)
+      {
+        auto task = Task::create([&started, i](){ started[i] = clock_type::now(); });
+        auto submitted = clock_type::now();
+        pool->addTask(task);
+        task->wait();
+        histogram.record(std::chrono::duration_cast<LatencyHistogram::duration>(
+                           started[i] - submitted));
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+      }
+      wall += seconds(start);
+      cpu += double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+      pool->terminate();
+    }
+    std::string name(names[s]);
+    context.report(name + "/p50", double(histogram.percentile(0.5).count()) / 1000.0,
+                   "us", false);
+    context.report(name + "/p99", double(histogram.percentile(0.99).count()) / 1000.0,
+                   "us", false);
+    context.report(name + "/cpu", cpu / wall, "cores", false);
+  }
+}
+
+static double nQueensRate(std::size_t numThreads, std::size_t boards,
+                          ThreadPool::Affinity policy = ThreadPool::Affinity::None)
+{
+  auto pool = ThreadPool::create(numThreads);
+  pool->setAffinity(policy);
+  pool->activate();
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(std::size_t i = 0; i < boards; i++)
+  {
+    tasks.push_back(Task::create([](){
+          ChessBoard board(9);
+          board.solveNQueens(9, 0);
+        }));
+  }
+  auto start = clock_type::now();
+  pool->addTasks(tasks.begin(), tasks.end());
+  for(auto & t : tasks)
+  {
+    t->wait();
+  }
+  double dt = seconds(start);
+  pool->terminate();
+  return double(boards) / dt;
+}
+
+static void benchNQueensFanOut(BenchmarkContext & context)
+{
+  double single = 0.0;
+  for(auto numThreads : threadCounts())
+  {
+    std::vector<double> rates;
+    for(std::size_t r = 0; r < std::max<std::size_t>(context.getRepetitions(), 1); r++)
+    {
+      rates.push_back(nQueensRate(numThreads, 32));
+    }
+    std::sort(rates.begin(), rates.end());
+    double rate = rates[rates.size() / 2];
+    if(numThreads == 1)
+    {
+      single = rate;
+    }
+    context.report("threads=" + std::to_string(numThreads), rate, "boards/s", true);
+    if(single > 0.0 && numThreads > 1)
+    {
+      context.report("speedup/threads=" + std::to_string(numThreads),
+                     rate / single, "x", true);
+    }
+  }
+}
+
+static void benchAffinityNQueens(BenchmarkContext & context)
+{
+  std::size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+  std::size_t boards = 8 * numThreads;
+  context.report("nodes", double(CpuTopology::detect().numNodes()), "nodes", true);
+  const ThreadPool::Affinity policies[] = { ThreadPool::Affinity::None,
+                                            ThreadPool::Affinity::Compact,
+                                            ThreadPool::Affinity::Scatter,
+                                            ThreadPool::Affinity::NumaNode };
+  const char * names[] = { "none", "compact", "scatter", "numa" };
+  for(std::size_t i = 0; i < 4; i++)
+  {
+    ThreadPool::Affinity policy = policies[i];
+    context.measure(names[i], "boards/s", true, [numThreads, boards, policy]() {
+        return nQueensRate(numThreads, boards, policy);
+      });
+  }
+}
+
+static void benchObserverOverhead(BenchmarkContext & context)
+{
+  const std::size_t n = 100000;
+  const Notification kinds[] = { Notification::None,
+                                 Notification::Observer,
+                                 Notification::EventBus };
+  const char * names[] = { "none", "observer", "event_bus" };
+  std::vector<double> nsPerTask;
+  for(std::size_t i = 0; i < 3; i++)
+  {
+    Notification kind = kinds[i];
+    std::vector<double> rates;
+    for(std::size_t r = 0; r < std::max<std::size_t>(context.getRepetitions(), 1); r++)
+    {
+      rates.push_back(emptyTaskThroughput(1, n, kind));
+    }
+    std::sort(rates.begin(), rates.end());
+    double rate = rates[rates.size() / 2];
+    context.report(std::string(names[i]) + "/throughput", rate, "tasks/s", true);
+    nsPerTask.push_back(1e9 / rate);
+  }
+  context.report("observer/overhead", nsPerTask[1] - nsPerTask[0], "ns/task", false);
+  context.report("event_bus/overhead", nsPerTask[2] - nsPerTask[0], "ns/task", false);
+}
+
+static void benchParallelReduce(BenchmarkContext & context)
+{
+  const std::size_t n = 20000000;
+  for(auto numThreads : threadCounts())
+  {
+    context.measure("threads=" + std::to_string(numThreads), "elements/s", true,
+                    [numThreads, n]() {
+                      auto pool = ThreadPool::create(numThreads,
+                                                     ThreadPool::Scheduler::WorkStealing);
+                      pool->activate();
+                      auto start = clock_type::now();
+                      double sum = parallelReduce(pool, std::size_t(0), n, 0.0,
+                                                  [](std::size_t i) {
+                                                    return std::sqrt(double(i));
+                                                  },
+                                                  [](double a, double b) {
+                                                    return a + b;
+                                                  });
+                      double dt = seconds(start);
+                      pool->terminate();
+                      // keeps the loop from being optimized away
+                      return (sum > 0.0 ? double(n) / dt : 0.0);
+                    });
+  }
+}
+
+std::vector<Benchmark> threadPoolBenchmarks()
+{
+  return {
+    { "empty_task_throughput", benchEmptyTaskThroughput },
+    { "submit_to_start_latency", benchSubmitToStartLatency },
+    { "wait_strategies", benchWaitStrategies },
+    { "n_queens_fan_out", benchNQueensFanOut },
+    { "affinity_n_queens", benchAffinityNQueens },
+    { "observer_overhead", benchObserverOverhead },
+    { "parallel_reduce", benchParallelReduce }
+  };
+}
@@ -0,0 +1,123 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+BenchmarkContext::BenchmarkContext(const std::string & _benchmark,
+                                   std::size_t _repetitions,
+                                   std::vector<BenchmarkResult> & _results)
+  : benchmark(_benchmark), repetitions(_repetitions), results(_results)
+{
+}
+
+void BenchmarkContext::report(const std::string & metric, double value,
+                              const std::string & unit, bool higherIsBetter)
+{
+  BenchmarkResult result = { benchmark, metric, value, unit, higherIsBetter };
+  results.push_back(result);
+}
+
+void BenchmarkContext::measure(const std::string & metric, const std::string & unit,
+                               bool higherIsBetter, std::function<double()> func)
+{
+  std::vector<double> values;
+  for(std::size_t i = 0; i < std::max<std::size_t>(repetitions, 1); i++)
+  {
+    values.push_back(func());
+  }
+  std::sort(values.begin(), values.end());
+  report(metric, values[values.size() / 2], unit, higherIsBetter);
+}
+
+std::size_t BenchmarkContext::getRepetitions() const
+{
+  return repetitions;
+}
+
+void writeJson(std::ostream & os, const std::vector<BenchmarkResult> & results)
+{
+  os << "[";
+  for(std::size_t i = 0; i < results.size(); i++)
+  {
+    const BenchmarkResult & r = results[i];
+    os << (i ? ",\n " : "\n ")
+       << "{\"benchmark\":\"" << r.benchmark << "\""
+       << ",\"metric\":\"" << r.metric << "\""
+       << ",\"value\":" << r.value
+       << ",\"unit\":\"" << r.unit << "\""
+       << ",\"higherIsBetter\":" << (r.higherIsBetter ? "true" : "false")
+       << "}";
+  }
+  os << "\n]\n";
+}
+
+void writeCsv(std::ostream & os, const std::vector<BenchmarkResult> & results)
+{
+  os << "benchmark,metric,value,unit,higherIsBetter\n";
+  for(auto & r : results)
+  {
+    os << r.benchmark << "," << r.metric << "," << r.value << ","
+       << r.unit << "," << (r.higherIsBetter ? 1 : 0) << "\n";
+  }
+}
+
+std::vector<BenchmarkResult> readCsv(std::istream & is)
+{
+  std::vector<BenchmarkResult> results;
+  std::string line;
+  std::getline(is, line);
+  if(line != "benchmark,metric,value,unit,higherIsBetter")
+  {
+    throw std::runtime_error("not a benchmark CSV file");
+  }
+  while(std::getline(is, line))
+  {
+    if(line.empty())
+    {
+      continue;
+    }
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    std::string field;
+    while(std::getline(ss, field, ','))
+    {
+      fields.push_back(field);
+    }
+    if(fields.size() != 5)
+    {
+      throw std::runtime_error("invalid benchmark CSV line: " + line);
+    }
+    BenchmarkResult r = { fields[0], fields[1], std::stod(fields[2]),
+                          fields[3], fields[4] == "1" };
+    results.push_back(r);
+  }
+  return results;
+}
+
+std::vector<BenchmarkRegression> findRegressions(const std::vector<BenchmarkResult> & baseline,
+                                                 const std::vector<BenchmarkResult> & current,
+                                                 double tolerance)
+{
+  std::map<std::pair<std::string, std::string>, const BenchmarkResult*> index;
+  for(auto & r : baseline)
+  {
+    index[std::make_pair(r.benchmark, r.metric)] = &r;
+  }
+  std::vector<BenchmarkRegression> regressions;
+  for(auto & r : current)
+  {
+    auto itr = index.find(std::make_pair(r.benchmark, r.metric));
+    if(itr == index.end() || itr->second->value == 0.0)
+    {
+      continue;
+    }
+    const BenchmarkResult & base = *itr->second;
+    double change = (r.value - base.value) / base.value;
+    if(r.higherIsBetter ? change < -tolerance : change > tolerance)
+    {
+      BenchmarkRegression regression = { base, r, change };
+      regressions.push_back(regression);
+    }
+  }
+  return regressions;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/** one measured value, keyed by benchmark and metric */
+struct BenchmarkResult
+{
+  std::string benchmark;
+  std::string metric;
+  double value;
+  std::string unit;
+  bool higherIsBetter;
+};
+
+/**
+ * Passed to every benchmark.
+ * measure() repeats a measurement and reports the median, so a single
+ * disturbed run does not decide the result.
+ */
+class BenchmarkContext
+{
+public:
+  BenchmarkContext(const std::string & benchmark, std::size_t repetitions,
+                   std::vector<BenchmarkResult> & results);
+
+  void report(const std::string & metric, double value,
+              const std::string & unit, bool higherIsBetter);
+  void measure(const std::string & metric, const std::string & unit,
+               bool higherIsBetter, std::function<double()> func);
+  std::size_t getRepetitions() const;
+
+private:
+  std::string benchmark;
+  std::size_t repetitions;
+  std::vector<BenchmarkResult> & results;
+};
+
+struct Benchmark
+{
+  std::string name;
+  std::function<void(BenchmarkContext &)> func;
+};
+
+/** a metric that got worse than the tolerance allows */
+struct BenchmarkRegression
+{
+  BenchmarkResult baseline;
+  BenchmarkResult current;
+  double change;
+};
+
+void writeJson(std::ostream & os, const std::vector<BenchmarkResult> & results);
+void writeCsv(std::ostream & os, const std::vector<BenchmarkResult> & results);
+/** reads the CSV format written by writeCsv */
+std::vector<BenchmarkResult> readCsv(std::istream & is);
+/**
+ * Compares metrics present in both lists. A relative change of more
+ * than tolerance in the bad direction is a regression.
+ */
+std::vector<BenchmarkRegression> findRegressions(const std::vector<BenchmarkResult> & baseline,
+                                                 const std::vector<BenchmarkResult> & current,
+                                                 double tolerance);
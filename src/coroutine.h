@@ -0,0 +1,370 @@
+#pragma once
+/**
+ * C++20 coroutines on top of the ThreadPool, available when the library
+ * is built with make STD=c++20:
+ *
+ * CoTask<int> count(std::shared_ptr<ThreadPool> pool, std::shared_ptr<Task> task)
+ * {
+ *   co_await pool->schedule();              // continue on a worker
+ *   Task::State s = co_await task;          // suspend until task finished
+ *   co_return (s == Task::State::Done ? 1 : 0);
+ * }
+ *
+ * A suspended coroutine holds no worker, so any number of them can wait
+ * on a handful of workers.
+ */
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "thread_pool.h"
+#include "frame_allocator.h"
+
+/**
+ * co_await on a task resumes the coroutine after the task has
+ * finished and yields its final state. The coroutine resumes on a
+ * worker of the pool of the task, or on the thread that releases or
+ * cancels the continuation that resumes it when no pool runs that.
+ */
+class TaskAwaitable
+{
+public:
+  TaskAwaitable(std::shared_ptr<Task> _task) : task(std::move(_task))
+  {
+  }
+
+  bool await_ready() const
+  {
+    return isFinal(task->getState());
+  }
+
+  void await_suspend(std::coroutine_handle<> handle)
+  {
+    // like task->finally(), but the observer is in place before the
+    // continuation can be released: the pool may drop or discard it,
+    // the task has finished anyway, so the coroutine resumes either way
+    auto claimed = std::make_shared<std::atomic<bool> >(false);
+    auto next = Task::create([handle, claimed]() {
+        if(!claimed->exchange(true))
+        {
+          handle.resume();
+        }
+      });
+    next->onStateChange(Task::State::Canceled,
+                        [handle, claimed](std::shared_ptr<Task>, std::shared_ptr<ThreadPool>) {
+                          if(!claimed->exchange(true))
+                          {
+                            handle.resume();
+                          }
+                        });
+    next->priority = task->priority;
+    next->continueAfter(std::vector<std::shared_ptr<Task> >(1, task), Task::Join::Finally);
+  }
+
+  Task::State await_resume() const
+  {
+    return task->getState();
+  }
+
+private:
+  static bool isFinal(Task::State s)
+  {
+    return (s == Task::State::Done ||
+            s == Task::State::Failed ||
+            s == Task::State::Canceled);
+  }
+
+  std::shared_ptr<Task> task;
+};
+
+inline TaskAwaitable operator co_await(std::shared_ptr<Task> task)
+{
+  return TaskAwaitable(std::move(task));
+}
+
+template<typename T>
+class CoTask;
+
+/**
+ * Shared part of the CoTask promises.
+ * The frame is released by whichever of the coroutine and its CoTask
+ * finishes last. Coroutines whose first parameter is a
+ * std::shared_ptr<ThreadPool> get their frame from the FrameAllocator
+ * of that pool.
+ */
+class CoPromiseBase
+{
+public:
+  struct FinalAwaitable
+  {
+    bool await_ready() const noexcept
+    {
+      return false;
+    }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+    {
+      return handle.promise().complete(handle);
+    }
+
+    void await_resume() const noexcept
+    {
+    }
+  };
+
+  CoPromiseBase() : state(nullptr), refs(2)
+  {
+  }
+
+  std::suspend_never initial_suspend() const noexcept
+  {
+    return std::suspend_never();
+  }
+
+  FinalAwaitable final_suspend() const noexcept
+  {
+    return FinalAwaitable();
+  }
+
+  void unhandled_exception()
+  {
+    exception = std::current_exception();
+  }
+
+  template<typename... Args>
+  static void * operator new(std::size_t size,
+                             const std::shared_ptr<ThreadPool> & pool,
+                             const Args & ...)
+  {
+    return FrameAllocator::allocate(pool->getFrameAllocator(), size);
+  }
+
+  static void * operator new(std::size_t size)
+  {
+    return FrameAllocator::allocate(std::shared_ptr<FrameAllocator>(), size);
+  }
+
+  static void operator delete(void * p, std::size_t size)
+  {
+    FrameAllocator::deallocate(p, size);
+  }
+
+  bool isReady() const
+  {
+    return state.load() == finishedState();
+  }
+
+  /** blocks until the coroutine has returned */
+  void wait() const
+  {
+    void * s = state.load();
+    while(s != finishedState())
+    {
+      state.wait(s);
+      s = state.load();
+    }
+  }
+
+  /** false if the coroutine has returned, it is not suspended then */
+  bool setContinuation(std::coroutine_handle<> handle)
+  {
+    void * expected = nullptr;
+    return state.compare_exchange_strong(expected, handle.address());
+  }
+
+  /** true if the caller dropped the last reference to the frame */
+  bool release()
+  {
+    return refs.fetch_sub(1) == 1;
+  }
+
+protected:
+  std::coroutine_handle<> complete(std::coroutine_handle<> self) noexcept
+  {
+    void * continuation = state.exchange(finishedState());
+    state.notify_all();
+    if(release())
+    {
+      self.destroy();
+    }
+    if(continuation)
+    {
+      return std::coroutine_handle<>::from_address(continuation);
+    }
+    return std::noop_coroutine();
+  }
+
+  void rethrowIfFailed() const
+  {
+    if(exception)
+    {
+      std::rethrow_exception(exception);
+    }
+  }
+
+private:
+  static void * finishedState()
+  {
+    static char tag;
+    return &tag;
+  }
+
+  // null, the awaiting coroutine, or finishedState()
+  std::atomic<void*> state;
+  std::atomic<int> refs;
+  std::exception_ptr exception;
+};
+
+template<typename T>
+class CoPromise : public CoPromiseBase
+{
+public:
+  CoTask<T> get_return_object();
+
+  template<typename U>
+  void return_value(U && v)
+  {
+    value.emplace(std::forward<U>(v));
+  }
+
+  T result()
+  {
+    rethrowIfFailed();
+    return std::move(*value);
+  }
+
+private:
+  std::optional<T> value;
+};
+
+template<>
+class CoPromise<void> : public CoPromiseBase
+{
+public:
+  CoTask<void> get_return_object();
+
+  void return_void()
+  {
+  }
+
+  void result()
+  {
+    rethrowIfFailed();
+  }
+};
+
+/**
+ * Return type of coroutines.
+ * The coroutine starts on the calling thread and runs until it
+ * suspends, usually at co_await pool->schedule(). Its result is taken
+ * once, either by one co_await from another coroutine or by get() on a
+ * thread that may block. An exception of the coroutine is rethrown
+ * there.
+ */
+template<typename T>
+class CoTask
+{
+public:
+  typedef CoPromise<T> promise_type;
+  typedef std::coroutine_handle<promise_type> handle_type;
+
+  explicit CoTask(handle_type _handle) : handle(_handle)
+  {
+  }
+
+  CoTask(CoTask && other) : handle(other.handle)
+  {
+    other.handle = nullptr;
+  }
+
+  CoTask & operator=(CoTask && other)
+  {
+    if(this != &other)
+    {
+      reset();
+      handle = other.handle;
+      other.handle = nullptr;
+    }
+    return *this;
+  }
+
+  CoTask(const CoTask &) = delete;
+  CoTask & operator=(const CoTask &) = delete;
+
+  ~CoTask()
+  {
+    reset();
+  }
+
+  bool isReady() const
+  {
+    return handle.promise().isReady();
+  }
+
+  void wait() const
+  {
+    handle.promise().wait();
+  }
+
+  /** blocks, do not call it on a worker */
+  T get()
+  {
+    wait();
+    return handle.promise().result();
+  }
+
+  struct Awaitable
+  {
+    handle_type handle;
+
+    bool await_ready() const
+    {
+      return handle.promise().isReady();
+    }
+
+    bool await_suspend(std::coroutine_handle<> awaiting)
+    {
+      return handle.promise().setContinuation(awaiting);
+    }
+
+    T await_resume()
+    {
+      return handle.promise().result();
+    }
+  };
+
+  Awaitable operator co_await() const
+  {
+    return Awaitable{handle};
+  }
+
+private:
+  void reset()
+  {
+    if(handle && handle.promise().release())
+    {
+      handle.destroy();
+    }
+    handle = nullptr;
+  }
+
+  handle_type handle;
+};
+
+template<typename T>
+CoTask<T> CoPromise<T>::get_return_object()
+{
+  return CoTask<T>(CoTask<T>::handle_type::from_promise(*this));
+}
+
+inline CoTask<void> CoPromise<void>::get_return_object()
+{
+  return CoTask<void>(CoTask<void>::handle_type::from_promise(*this));
+}
+
+#endif
@@ -0,0 +1,220 @@
+#include "cpu_topology.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static bool readLine(const std::string & path, std::string & line)
+{
+  std::ifstream file(path.c_str());
+  return file && std::getline(file, line);
+}
+
+CpuTopology::CpuTopology(const std::vector<cpu_list_type> & _nodes)
+{
+  for(auto & node : _nodes)
+  {
+    if(!node.empty())
+    {
+      nodes.push_back(node);
+    }
+  }
+  if(nodes.empty())
+  {
+    throw std::logic_error("CpuTopology without CPUs");
+  }
+}
+
+CpuTopology CpuTopology::detect()
+{
+  cpu_list_type allowed;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if(sched_getaffinity(0, sizeof(set), &set) == 0)
+  {
+    for(unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      if(CPU_ISSET(cpu, &set))
+      {
+        allowed.push_back(cpu);
+      }
+    }
+  }
+#endif
+  auto isAllowed = [&allowed](unsigned int cpu) {
+    if(allowed.empty())
+    {
+      return true;
+    }
+    for(auto c : allowed)
+    {
+      if(c == cpu)
+      {
+        return true;
+      }
+    }
+    return false;
+  };
+  std::vector<cpu_list_type> nodes;
+  std::string line;
+  if(readLine("/sys/devices/system/node/online", line))
+  {
+    for(auto id : parseCpuList(line))
+    {
+      std::ostringstream path;
+      path << "/sys/devices/system/node/node" << id << "/cpulist";
+      cpu_list_type cpus;
+      if(readLine(path.str(), line))
+      {
+        for(auto cpu : parseCpuList(line))
+        {
+          if(isAllowed(cpu))
+          {
+            cpus.push_back(cpu);
+          }
+        }
+      }
+      // memory only nodes have no CPUs
+      if(!cpus.empty())
+      {
+        nodes.push_back(cpus);
+      }
+    }
+  }
+  if(nodes.empty())
+  {
+    cpu_list_type cpus;
+    if(!allowed.empty())
+    {
+      cpus = allowed;
+    }
+    else if(readLine("/sys/devices/system/cpu/online", line))
+    {
+      cpus = parseCpuList(line);
+    }
+    if(cpus.empty())
+    {
+      for(unsigned int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+      {
+        cpus.push_back(cpu);
+      }
+    }
+    nodes.push_back(cpus);
+  }
+  return CpuTopology(nodes);
+}
+
+CpuTopology::cpu_list_type CpuTopology::parseCpuList(const std::string & str)
+{
+  cpu_list_type ret;
+  std::istringstream input(str);
+  std::string range;
+  while(std::getline(input, range, ','))
+  {
+    std::istringstream r(range);
+    unsigned int first, last;
+    if(!(r >> first))
+    {
+      continue;
+    }
+    last = first;
+    char dash;
+    if(r >> dash && dash == '-')
+    {
+      r >> last;
+    }
+    for(unsigned int cpu = first; cpu <= last; cpu++)
+    {
+      ret.push_back(cpu);
+    }
+  }
+  return ret;
+}
+
+bool CpuTopology::setThreadAffinity(const cpu_list_type & cpus)
+{
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for(auto cpu : cpus)
+  {
+    if(cpu < CPU_SETSIZE)
+    {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+std::size_t CpuTopology::numNodes() const
+{
+  return nodes.size();
+}
+
+const CpuTopology::cpu_list_type & CpuTopology::getNodeCpus(std::size_t node) const
+{
+  return nodes.at(node);
+}
+
+CpuTopology::cpu_list_type CpuTopology::getCpus() const
+{
+  cpu_list_type ret;
+  for(auto & node : nodes)
+  {
+    ret.insert(ret.end(), node.begin(), node.end());
+  }
+  return ret;
+}
+
+std::vector<CpuTopology::cpu_list_type> CpuTopology::compact(std::size_t numWorkers) const
+{
+  cpu_list_type cpus = getCpus();
+  std::vector<cpu_list_type> ret;
+  for(std::size_t i = 0; i < numWorkers; i++)
+  {
+    ret.push_back(cpu_list_type(1, cpus[i % cpus.size()]));
+  }
+  return ret;
+}
+
+std::vector<CpuTopology::cpu_list_type> CpuTopology::scatter(std::size_t numWorkers) const
+{
+  // take one CPU from each node in turn, skipping nodes that ran out
+  std::size_t total = getCpus().size();
+  cpu_list_type cpus;
+  for(std::size_t i = 0; cpus.size() < total; i++)
+  {
+    for(auto & node : nodes)
+    {
+      if(i < node.size())
+      {
+        cpus.push_back(node[i]);
+      }
+    }
+  }
+  std::vector<cpu_list_type> ret;
+  for(std::size_t i = 0; i < numWorkers; i++)
+  {
+    ret.push_back(cpu_list_type(1, cpus[i % cpus.size()]));
+  }
+  return ret;
+}
+
+std::vector<CpuTopology::cpu_list_type> CpuTopology::nodeLocal(std::size_t numWorkers) const
+{
+  std::vector<cpu_list_type> ret;
+  for(std::size_t i = 0; i < numWorkers; i++)
+  {
+    ret.push_back(nodes[i % nodes.size()]);
+  }
+  return ret;
+}
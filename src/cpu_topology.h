@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * CPUs of the machine grouped by NUMA node.
+ * detect() reads the nodes from /sys/devices/system/node and keeps only
+ * the CPUs the process may run on. Without NUMA information all CPUs
+ * form a single node.
+ */
+class CpuTopology
+{
+public:
+  typedef std::vector<unsigned int> cpu_list_type;
+
+  /** empty nodes are dropped, at least one CPU is required */
+  CpuTopology(const std::vector<cpu_list_type> & nodes);
+  static CpuTopology detect();
+  /** parses the list format of the kernel, e.g. "0-3,8,10-11" */
+  static cpu_list_type parseCpuList(const std::string & str);
+  /** binds the calling thread to cpus, false if the system refuses */
+  static bool setThreadAffinity(const cpu_list_type & cpus);
+
+  std::size_t numNodes() const;
+  const cpu_list_type & getNodeCpus(std::size_t node) const;
+  /** all CPUs, node by node */
+  cpu_list_type getCpus() const;
+
+  /** one CPU per worker, the CPUs of a node are used before the next node */
+  std::vector<cpu_list_type> compact(std::size_t numWorkers) const;
+  /** one CPU per worker, consecutive workers go to different nodes */
+  std::vector<cpu_list_type> scatter(std::size_t numWorkers) const;
+  /** all CPUs of node (worker % numNodes()) for each worker */
+  std::vector<cpu_list_type> nodeLocal(std::size_t numWorkers) const;
+
+private:
+  std::vector<cpu_list_type> nodes;
+};
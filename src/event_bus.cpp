@@ -0,0 +1,237 @@
+#include "event_bus.h"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+const std::size_t EventBus::defaultCapacity = 4096u;
+
+namespace
+{
+  // bus whose dispatcher runs on this thread, if any
+  thread_local const EventBus * dispatchingBus = nullptr;
+
+  void sortByTime(std::vector<TaskEvent> & events)
+  {
+    std::stable_sort(events.begin(), events.end(),
+                     [](const TaskEvent & a, const TaskEvent & b) {
+                       return a.time < b.time;
+                     });
+  }
+}
+
+EventBus::EventBus(std::size_t numWorkers, std::size_t capacity,
+                   Overflow _overflow)
+  : overflow(_overflow), running(false), stopping(false), sleeping(false),
+    dropped(0), delivered(0)
+{
+  // one ring per worker plus the shared one
+  for(std::size_t i = 0; i <= numWorkers; i++)
+  {
+    rings.push_back(std::unique_ptr<ring_type>(new ring_type(capacity)));
+  }
+}
+
+EventBus::~EventBus()
+{
+  stop();
+}
+
+void EventBus::addListener(listener_type listener)
+{
+  if(running)
+  {
+    throw std::logic_error("EventBus already started");
+  }
+  listeners.push_back(listener);
+}
+
+void EventBus::start()
+{
+  if(running || dispatcher.joinable())
+  {
+    throw std::logic_error("EventBus already started");
+  }
+  running = true;
+  dispatcher = std::thread([this]() { run(); });
+}
+
+void EventBus::stop()
+{
+  if(!dispatcher.joinable())
+  {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  condition.notify_one();
+  dispatcher.join();
+  running = false;
+}
+
+bool EventBus::publish(std::size_t worker, const TaskEvent & event)
+{
+  bool shared = (worker >= rings.size() - 1);
+  ring_type & ring = *rings[shared ? rings.size() - 1 : worker];
+  {
+    std::unique_lock<std::mutex> lock(sharedMutex, std::defer_lock);
+    if(shared)
+    {
+      lock.lock();
+    }
+    while(!ring.tryPush(event))
+    {
+      // a listener that submits tasks publishes on the dispatcher,
+      // which would wait for itself
+      if(overflow == Overflow::Drop || !running || stopping ||
+         dispatchingBus == this)
+      {
+        dropped++;
+        return false;
+      }
+      std::this_thread::yield();
+    }
+  }
+  // pairs with the fence in run(): either the dispatcher sees the event
+  // or we see that it sleeps
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(sleeping.load(std::memory_order_relaxed))
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+    }
+    condition.notify_one();
+  }
+  return true;
+}
+
+EventBus::Overflow EventBus::getOverflow() const
+{
+  return overflow;
+}
+
+std::size_t EventBus::numDropped() const
+{
+  return dropped;
+}
+
+std::size_t EventBus::numDelivered() const
+{
+  return delivered;
+}
+
+void EventBus::drain(std::vector<TaskEvent> & batch)
+{
+  TaskEvent event;
+  for(auto & ring : rings)
+  {
+    // bounded, so one busy worker cannot starve the others
+    for(std::size_t n = ring->capacity(); n > 0 && ring->tryPop(event); n--)
+    {
+      batch.push_back(event);
+    }
+  }
+}
+
+bool EventBus::empty() const
+{
+  for(auto & ring : rings)
+  {
+    if(ring->size() > 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void EventBus::deliver(std::vector<TaskEvent> & batch)
+{
+  sortByTime(batch);
+  for(auto & listener : listeners)
+  {
+    listener(batch);
+  }
+  delivered += batch.size();
+  batch.clear();
+}
+
+void EventBus::run()
+{
+  // An event drained in one pass may have been published after an
+  // earlier event of the same task that went to a ring this pass had
+  // drained already. That event is published before the next pass
+  // starts, so events are held back for one pass, and the events of the
+  // next pass that precede a held event of their task go with it.
+  dispatchingBus = this;
+  std::vector<TaskEvent> held;
+  std::vector<TaskEvent> fresh;
+  std::vector<TaskEvent> batch;
+  std::unordered_map<std::size_t, std::chrono::steady_clock::time_point> latest;
+  while(true)
+  {
+    bool stop = stopping;
+    drain(fresh);
+    if(stop)
+    {
+      // the publishers are done, nothing can be missing any more
+      batch.swap(held);
+      batch.insert(batch.end(), fresh.begin(), fresh.end());
+      fresh.clear();
+      if(batch.empty())
+      {
+        break;
+      }
+      deliver(batch);
+      continue;
+    }
+    if(!held.empty())
+    {
+      latest.clear();
+      for(auto & event : held)
+      {
+        auto itr = latest.find(event.taskId);
+        if(itr == latest.end())
+        {
+          latest.insert(std::make_pair(event.taskId, event.time));
+        }
+        else if(itr->second < event.time)
+        {
+          itr->second = event.time;
+        }
+      }
+      batch.swap(held);
+      for(auto & event : fresh)
+      {
+        auto itr = latest.find(event.taskId);
+        if(itr != latest.end() && !(itr->second < event.time))
+        {
+          batch.push_back(event);
+        }
+        else
+        {
+          held.push_back(event);
+        }
+      }
+      fresh.clear();
+      deliver(batch);
+      continue;
+    }
+    if(!fresh.empty())
+    {
+      held.swap(fresh);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(empty() && !stopping)
+    {
+      // the timeout only guards against missed wake ups
+      condition.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    sleeping.store(false, std::memory_order_relaxed);
+  }
+  dispatchingBus = nullptr;
+}
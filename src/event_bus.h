@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "spsc_ring.h"
+#include "task.h"
+
+/** fixed size record of a task state change */
+struct TaskEvent
+{
+  std::size_t taskId;
+  // worker that made the transition, undefinedThreadId outside the pool
+  std::size_t threadId;
+  Task::State state;
+  std::chrono::steady_clock::time_point time;
+};
+
+/**
+ * Delivers TaskEvents to listeners on a dispatcher thread.
+ * Every worker publishes into its own single-producer ring, threads
+ * outside the pool share one ring guarded by a mutex. The dispatcher
+ * drains all rings and hands each batch, ordered by time, to the
+ * listeners; the events of one task arrive in the order they were
+ * published, even across batches. When a ring is full the event is
+ * dropped and counted, or with Overflow::Block the publisher waits for
+ * the dispatcher. Events published by the listeners on the dispatcher
+ * thread are dropped instead of waiting.
+ */
+class EventBus
+{
+public:
+  enum class Overflow : unsigned int
+  {
+    Drop               = 1,  // count and discard the event
+    Block              = 2   // wait until the dispatcher made room
+  };
+
+  typedef std::function<void(const std::vector<TaskEvent> &)> listener_type;
+
+  /** events per ring */
+  static const std::size_t defaultCapacity;
+
+  EventBus(std::size_t numWorkers, std::size_t capacity, Overflow overflow);
+  ~EventBus();
+
+  /** listeners must be added before start() */
+  void addListener(listener_type listener);
+  void start();
+  /** delivers the pending events and joins the dispatcher */
+  void stop();
+
+  /**
+   * worker is the index of the publishing worker, any index beyond the
+   * workers selects the shared ring. Returns false if the event was
+   * dropped. Blocking only happens while the dispatcher runs, and never
+   * on the dispatcher thread.
+   */
+  bool publish(std::size_t worker, const TaskEvent & event);
+
+  Overflow getOverflow() const;
+  std::size_t numDropped() const;
+  std::size_t numDelivered() const;
+
+private:
+  typedef SpscRing<TaskEvent> ring_type;
+
+  void run();
+  void drain(std::vector<TaskEvent> & batch);
+  /** sorts the batch, hands it to the listeners and clears it */
+  void deliver(std::vector<TaskEvent> & batch);
+  bool empty() const;
+
+  std::vector<std::unique_ptr<ring_type> > rings;
+  std::mutex sharedMutex;
+  Overflow overflow;
+  std::vector<listener_type> listeners;
+  std::thread dispatcher;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::atomic<bool> running;
+  std::atomic<bool> stopping;
+  std::atomic<bool> sleeping;
+  std::atomic<std::size_t> dropped;
+  std::atomic<std::size_t> delivered;
+};
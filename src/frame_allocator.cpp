@@ -0,0 +1,125 @@
+#include "frame_allocator.h"
+#include <new>
+
+const std::size_t FrameAllocator::granularity;
+const std::size_t FrameAllocator::numClasses;
+const std::size_t FrameAllocator::maxCached;
+
+/** placed in front of every block, padded to keep the frame aligned */
+struct FrameAllocator::Header
+{
+  std::shared_ptr<FrameAllocator> allocator;
+};
+
+namespace
+{
+  const std::size_t headerSize = ((sizeof(std::shared_ptr<FrameAllocator>) +
+                                   alignof(std::max_align_t) - 1) /
+                                  alignof(std::max_align_t) *
+                                  alignof(std::max_align_t));
+}
+
+FrameAllocator::FrameAllocator()
+{
+  for(std::size_t i = 0; i < numClasses; i++)
+  {
+    heads[i] = nullptr;
+    sizes[i] = 0;
+  }
+}
+
+FrameAllocator::~FrameAllocator()
+{
+  for(std::size_t i = 0; i < numClasses; i++)
+  {
+    while(heads[i])
+    {
+      Node * node = heads[i];
+      heads[i] = node->next;
+      ::operator delete(node);
+    }
+  }
+}
+
+std::size_t FrameAllocator::classOf(std::size_t size)
+{
+  return (size + headerSize + granularity - 1) / granularity - 1;
+}
+
+void * FrameAllocator::allocate(const std::shared_ptr<FrameAllocator> & allocator,
+                                std::size_t size)
+{
+  std::size_t sizeClass = classOf(size);
+  void * block = nullptr;
+  if(allocator && sizeClass < numClasses)
+  {
+    block = allocator->pop(sizeClass);
+    if(!block)
+    {
+      block = ::operator new((sizeClass + 1) * granularity);
+    }
+  }
+  else
+  {
+    block = ::operator new(size + headerSize);
+  }
+  new (block) Header{allocator};
+  return static_cast<char*>(block) + headerSize;
+}
+
+void FrameAllocator::deallocate(void * p, std::size_t size)
+{
+  void * block = static_cast<char*>(p) - headerSize;
+  Header * header = static_cast<Header*>(block);
+  // the block may hold the last reference to the allocator
+  std::shared_ptr<FrameAllocator> allocator(std::move(header->allocator));
+  header->~Header();
+  std::size_t sizeClass = classOf(size);
+  if(allocator && sizeClass < numClasses)
+  {
+    allocator->push(block, sizeClass);
+  }
+  else
+  {
+    ::operator delete(block);
+  }
+}
+
+std::size_t FrameAllocator::numCached() const
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  std::size_t ret = 0;
+  for(std::size_t i = 0; i < numClasses; i++)
+  {
+    ret += sizes[i];
+  }
+  return ret;
+}
+
+void * FrameAllocator::pop(std::size_t sizeClass)
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  Node * node = heads[sizeClass];
+  if(node)
+  {
+    heads[sizeClass] = node->next;
+    sizes[sizeClass]--;
+  }
+  return node;
+}
+
+void FrameAllocator::push(void * block, std::size_t sizeClass)
+{
+  {
+    std::lock_guard<mutex_type> lock(mutex);
+    if(sizes[sizeClass] < maxCached)
+    {
+      Node * node = static_cast<Node*>(block);
+      node->next = heads[sizeClass];
+      heads[sizeClass] = node;
+      sizes[sizeClass]++;
+      return;
+    }
+  }
+  ::operator delete(block);
+}
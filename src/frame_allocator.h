@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+/**
+ * Recycling allocator for coroutine frames, owned by a ThreadPool.
+ * Blocks are rounded up to size classes of granularity bytes and kept
+ * in one free list per class. Every block holds a reference to its
+ * allocator, so frames can outlive the pool that created them.
+ * Blocks larger than the biggest class come from the system.
+ */
+class FrameAllocator
+{
+public:
+  static const std::size_t granularity = 64;
+  static const std::size_t numClasses = 32;
+  /** free blocks kept per size class */
+  static const std::size_t maxCached = 1024;
+
+  FrameAllocator();
+  ~FrameAllocator();
+  FrameAllocator(const FrameAllocator &) = delete;
+  FrameAllocator & operator=(const FrameAllocator &) = delete;
+
+  /** allocator may be empty, then the block comes from the system */
+  static void * allocate(const std::shared_ptr<FrameAllocator> & allocator,
+                         std::size_t size);
+  static void deallocate(void * p, std::size_t size);
+
+  /** free blocks of all size classes */
+  std::size_t numCached() const;
+
+private:
+  struct Node
+  {
+    Node * next;
+  };
+
+  struct Header;
+
+  static std::size_t classOf(std::size_t size);
+  void * pop(std::size_t sizeClass);
+  void push(void * block, std::size_t sizeClass);
+
+  typedef std::mutex mutex_type;
+  mutable mutex_type mutex;
+  Node * heads[numClasses];
+  std::size_t sizes[numClasses];
+};
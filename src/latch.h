@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+/**
+ * Single use countdown latch.
+ * countDown() is one atomic decrement; only the call that reaches zero
+ * takes the mutex to wake the waiters.
+ */
+class Latch
+{
+public:
+  Latch(std::size_t count);
+
+  void countDown(std::size_t n = 1);
+  void wait();
+  /** false if the timeout expired first */
+  bool waitFor(std::chrono::steady_clock::duration timeout);
+  bool isReady() const;
+
+private:
+  std::atomic<std::size_t> count;
+  std::mutex mutex;
+  std::condition_variable condition;
+};
+
+inline Latch::Latch(std::size_t _count) : count(_count)
+{
+}
+
+inline void Latch::countDown(std::size_t n)
+{
+  if(count.fetch_sub(n) == n)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+    }
+    condition.notify_all();
+  }
+}
+
+inline void Latch::wait()
+{
+  if(isReady())
+  {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  condition.wait(lock, [this]() { return isReady(); });
+}
+
+inline bool Latch::waitFor(std::chrono::steady_clock::duration timeout)
+{
+  if(isReady())
+  {
+    return true;
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  return condition.wait_for(lock, timeout, [this]() { return isReady(); });
+}
+
+inline bool Latch::isReady() const
+{
+  return count.load() == 0u;
+}
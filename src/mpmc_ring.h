@@ -0,0 +1,144 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/**
+ * Bounded lock-free multi-producer/multi-consumer ring buffer.
+ * Every cell carries a sequence number that tells producers and
+ * consumers whether the cell is free for the current lap
+ * (Dmitry Vyukov's bounded MPMC queue).
+ * The capacity is rounded up to a power of two, storage is allocated
+ * once in the constructor and tryPush/tryPop never allocate.
+ */
+template<typename T>
+class MpmcRing
+{
+public:
+  MpmcRing(std::size_t capacity);
+
+  /** Moves value into the ring, leaves it untouched if the ring is full */
+  bool tryPush(T && value);
+  /** Moves the oldest element into value, returns false if the ring is empty */
+  bool tryPop(T & value);
+
+  std::size_t capacity() const;
+  /** approximate number of elements while producers or consumers are active */
+  std::size_t size() const;
+
+private:
+  struct Cell
+  {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+  static const std::size_t cacheLine = 64;
+  typedef std::atomic<std::size_t> index_type;
+
+  std::unique_ptr<Cell[]> cells;
+  std::size_t mask;
+  char pad0[cacheLine];
+  index_type enqueuePos;
+  char pad1[cacheLine - sizeof(index_type)];
+  index_type dequeuePos;
+  char pad2[cacheLine - sizeof(index_type)];
+};
+
+template<typename T>
+MpmcRing<T>::MpmcRing(std::size_t capacity)
+{
+  std::size_t n = 2;
+  while(n < capacity)
+  {
+    n <<= 1;
+  }
+  cells.reset(new Cell[n]);
+  mask = n - 1;
+  for(std::size_t i = 0; i < n; i++)
+  {
+    cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  enqueuePos.store(0, std::memory_order_relaxed);
+  dequeuePos.store(0, std::memory_order_relaxed);
+}
+
+template<typename T>
+bool MpmcRing<T>::tryPush(T && value)
+{
+  Cell * cell;
+  std::size_t pos = enqueuePos.load(std::memory_order_relaxed);
+  while(true)
+  {
+    cell = &cells[pos & mask];
+    std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+    std::intptr_t diff = (std::intptr_t)seq - (std::intptr_t)pos;
+    if(diff == 0)
+    {
+      if(enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if(diff < 0)
+    {
+      return false;
+    }
+    else
+    {
+      pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+  cell->value = std::move(value);
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+template<typename T>
+bool MpmcRing<T>::tryPop(T & value)
+{
+  Cell * cell;
+  std::size_t pos = dequeuePos.load(std::memory_order_relaxed);
+  while(true)
+  {
+    cell = &cells[pos & mask];
+    std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+    std::intptr_t diff = (std::intptr_t)seq - (std::intptr_t)(pos + 1);
+    if(diff == 0)
+    {
+      if(dequeuePos.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if(diff < 0)
+    {
+      return false;
+    }
+    else
+    {
+      pos = dequeuePos.load(std::memory_order_relaxed);
+    }
+  }
+  value = std::move(cell->value);
+  cell->value = T();
+  cell->sequence.store(pos + mask + 1, std::memory_order_release);
+  return true;
+}
+
+template<typename T>
+std::size_t MpmcRing<T>::capacity() const
+{
+  return mask + 1;
+}
+
+template<typename T>
+std::size_t MpmcRing<T>::size() const
+{
+  std::size_t tail = dequeuePos.load(std::memory_order_relaxed);
+  std::size_t head = enqueuePos.load(std::memory_order_relaxed);
+  return (head > tail ? head - tail : 0u);
+}
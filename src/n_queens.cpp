@@ -36,6 +36,17 @@ ChessBoard::ChessBoard(std::size_t _L)
   workspace_d_m_line.resize(2*L-1, 0);
   d_m_line = workspace_d_m_line.begin() + L-1;
   queens.resize(L2, 0);
+  canceled = false;
+}
+
+void ChessBoard::setCancelCheck(std::function<bool()> check)
+{
+  cancelCheck = check;
+}
+
+bool ChessBoard::isCanceled() const
+{
+  return canceled;
 }
 
 void ChessBoard::solveNQueens(NQueensSolution & solution,
@@ -59,7 +70,12 @@ void ChessBoard::solveNQueens(NQueensSolution & solution,
   }
   else 
   {
-    for(i = i0; i < L2; i++) 
+    // polling only near the root keeps the check off the hot path
+    if(n < 2 && cancelCheck && cancelCheck())
+    {
+      canceled = true;
+    }
+    for(i = i0; i < L2 && !canceled; i++) 
     {
       x = i % L;
       y = i / L;
@@ -1,4 +1,5 @@
 #pragma once
+#include <functional>
 #include <utility>
 #include <vector>
   
@@ -21,6 +22,11 @@ class ChessBoard
 public:
   ChessBoard(std::size_t _L);
   NQueensSolution solveNQueens(std::size_t n_queens, std::size_t maxPrint);
+
+  // polled while the first queens are placed, the search stops
+  // (with a partial solution) as soon as it returns true
+  void setCancelCheck(std::function<bool()> check);
+  bool isCanceled() const;
 private:
   typedef short int indicator_type;
   std::size_t L; // side length of the board
@@ -46,6 +52,9 @@ private:
   //indicator: field is occupied queens[0] ... queens[L2]
   std::vector<indicator_type> queens;
 
+  std::function<bool()> cancelCheck;
+  bool canceled;
+
   inline bool checkPosition(std::size_t x, std::size_t y) const;
   inline unsigned short checkSymmetry() const;
   inline void markPosition(std::size_t x, std::size_t y);
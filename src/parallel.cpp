@@ -0,0 +1,129 @@
+#include "parallel.h"
+#include <stdexcept>
+
+ParallelLoop::ParallelLoop(const std::shared_ptr<ThreadPool> & _pool,
+                           std::size_t n, std::size_t _grain, body_type && _body)
+  : pool(_pool), grain(_grain), body(std::move(_body)), latch(n), failed(false)
+{
+}
+
+std::size_t ParallelLoop::defaultGrain(std::size_t n, std::size_t numThreads)
+{
+  return std::max<std::size_t>(1u, n / (8 * std::max<std::size_t>(1u, numThreads)));
+}
+
+void ParallelLoop::run(const std::shared_ptr<ThreadPool> & pool, std::size_t n,
+                       std::size_t grain, body_type body)
+{
+  if(n == 0)
+  {
+    return;
+  }
+  if(pool->getState() != ThreadPool::State::Active)
+  {
+    throw std::logic_error("Parallel loops need an active ThreadPool");
+  }
+  if(grain == 0)
+  {
+    grain = defaultGrain(n, pool->getMaxSize());
+  }
+  std::shared_ptr<ParallelLoop> loop(new ParallelLoop(pool, n, grain, std::move(body)));
+  loop->runRange(0, n);
+  if(ThreadPool::getCurrentPool() == pool.get())
+  {
+    // nested loop: help with the chunks instead of blocking the worker
+    while(!loop->latch.isReady())
+    {
+      if(!pool->runPendingTask())
+      {
+        loop->latch.waitFor(ThreadPool::helpPollInterval);
+      }
+    }
+  }
+  loop->latch.wait();
+  if(loop->exception)
+  {
+    std::rethrow_exception(loop->exception);
+  }
+}
+
+bool ParallelLoop::shouldSplit() const
+{
+  // a half that would fill a bounded queue is better run here than
+  // dropped or rejected
+  std::size_t maxDepth = pool->getMaxQueueDepth();
+  if(maxDepth != 0 && pool->getQueueDepth() >= maxDepth)
+  {
+    return false;
+  }
+  // the maximum, so ready halves can make an elastic pool grow
+  return pool->numTasks(Task::State::Ready) < pool->getMaxSize();
+}
+
+bool ParallelLoop::submitRange(std::size_t begin, std::size_t end)
+{
+  auto self = shared_from_this();
+  // whichever of the chunk and its cancellation comes first owns the range
+  auto claimed = std::make_shared<std::atomic<bool> >(false);
+  auto task = Task::create([self, begin, end, claimed]() {
+      if(!claimed->exchange(true))
+      {
+        self->runRange(begin, end);
+      }
+    });
+  // dropped by the queue or discarded by terminate()
+  task->onStateChange(Task::State::Canceled,
+                      [self, begin, end, claimed](std::shared_ptr<Task>,
+                                                  std::shared_ptr<ThreadPool>) {
+                        if(!claimed->exchange(true))
+                        {
+                          self->setException(std::make_exception_ptr(TaskCanceled()));
+                          self->latch.countDown(end - begin);
+                        }
+                      });
+  try
+  {
+    return pool->trySubmit(task);
+  }
+  catch(const std::logic_error &)
+  {
+    // terminated meanwhile
+    return false;
+  }
+}
+
+void ParallelLoop::setException(std::exception_ptr e)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if(!exception)
+  {
+    exception = e;
+  }
+  failed = true;
+}
+
+void ParallelLoop::runRange(std::size_t begin, std::size_t end)
+{
+  while(end - begin > grain && shouldSplit())
+  {
+    std::size_t mid = begin + (end - begin) / 2;
+    if(!submitRange(mid, end))
+    {
+      // the pool does not take it, the caller runs all of it
+      break;
+    }
+    end = mid;
+  }
+  if(!failed)
+  {
+    try
+    {
+      body(begin, end);
+    }
+    catch(...)
+    {
+      setException(std::current_exception());
+    }
+  }
+  latch.countDown(end - begin);
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "latch.h"
+#include "thread_pool.h"
+#include "value_task.h"
+
+/**
+ * Runs body(begin, end) over the chunks of [0, n) on a ThreadPool.
+ * The calling thread works on the range itself. A range is halved and
+ * the upper half handed to the pool while it is larger than the grain
+ * and fewer tasks are ready than the pool has workers, so chunks stay
+ * large when the workers are busy and are split further when some of
+ * them become idle. All chunks count down one latch.
+ * A half the pool does not take (full queue, terminated pool) is run
+ * by the calling thread instead. A chunk the pool cancels before it
+ * runs, e.g. dropped by Overflow::DropOldest or discarded by
+ * terminate(), still counts down and makes run() throw TaskCanceled.
+ * The first exception thrown by body is rethrown by run(), chunks that
+ * have not started by then are skipped.
+ */
+class ParallelLoop : public std::enable_shared_from_this<ParallelLoop>
+{
+public:
+  typedef std::function<void(std::size_t, std::size_t)> body_type;
+
+  /** grain 0 picks a grain that gives every worker about eight chunks */
+  static void run(const std::shared_ptr<ThreadPool> & pool, std::size_t n,
+                  std::size_t grain, body_type body);
+  static std::size_t defaultGrain(std::size_t n, std::size_t numThreads);
+
+private:
+  ParallelLoop(const std::shared_ptr<ThreadPool> & pool, std::size_t n,
+               std::size_t grain, body_type && body);
+  void runRange(std::size_t begin, std::size_t end);
+  /** false if the pool does not take the chunk */
+  bool submitRange(std::size_t begin, std::size_t end);
+  bool shouldSplit() const;
+  void setException(std::exception_ptr e);
+
+  std::shared_ptr<ThreadPool> pool;
+  std::size_t grain;
+  body_type body;
+  Latch latch;
+  std::atomic<bool> failed;
+  std::mutex mutex;
+  std::exception_ptr exception;
+};
+
+/** f(i) for every i in [first, last) */
+template<typename Index, typename F>
+typename std::enable_if<std::is_integral<Index>::value>::type
+parallelFor(const std::shared_ptr<ThreadPool> & pool, Index first, Index last,
+            F f, std::size_t grain = 0)
+{
+  std::size_t n = (last > first ? std::size_t(last - first) : 0u);
+  ParallelLoop::run(pool, n, grain, [first, &f](std::size_t begin, std::size_t end) {
+      for(std::size_t i = begin; i < end; i++)
+      {
+        f(Index(first + Index(i)));
+      }
+    });
+}
+
+/** f(*itr) for every element of a random access range */
+template<typename ITR, typename F>
+void parallelForEach(const std::shared_ptr<ThreadPool> & pool, ITR first, ITR last,
+                     F f, std::size_t grain = 0)
+{
+  std::size_t n = std::size_t(std::distance(first, last));
+  ParallelLoop::run(pool, n, grain, [first, &f](std::size_t begin, std::size_t end) {
+      ITR itr = first + begin;
+      for(std::size_t i = begin; i < end; i++, ++itr)
+      {
+        f(*itr);
+      }
+    });
+}
+
+/** writes f(*itr) of every element to out, returns the end of the output */
+template<typename InputITR, typename OutputITR, typename F>
+OutputITR parallelTransform(const std::shared_ptr<ThreadPool> & pool,
+                            InputITR first, InputITR last, OutputITR out,
+                            F f, std::size_t grain = 0)
+{
+  std::size_t n = std::size_t(std::distance(first, last));
+  ParallelLoop::run(pool, n, grain, [first, out, &f](std::size_t begin, std::size_t end) {
+      InputITR in = first + begin;
+      OutputITR o = out + begin;
+      for(std::size_t i = begin; i < end; i++, ++in, ++o)
+      {
+        *o = f(*in);
+      }
+    });
+  return out + n;
+}
+
+/**
+ * Combines map(i) of every i in [first, last) with reduce, starting from
+ * identity. The partial results of the chunks are combined in index
+ * order, so reduce has to be associative but not commutative.
+ */
+template<typename Index, typename T, typename Map, typename Reduce>
+typename std::enable_if<std::is_integral<Index>::value, T>::type
+parallelReduce(const std::shared_ptr<ThreadPool> & pool, Index first, Index last,
+               T identity, Map map, Reduce reduce, std::size_t grain = 0)
+{
+  std::size_t n = (last > first ? std::size_t(last - first) : 0u);
+  std::mutex mutex;
+  std::vector<std::pair<std::size_t, T> > partials;
+  ParallelLoop::run(pool, n, grain,
+                    [&](std::size_t begin, std::size_t end) {
+                      T acc = identity;
+                      for(std::size_t i = begin; i < end; i++)
+                      {
+                        acc = reduce(std::move(acc), map(Index(first + Index(i))));
+                      }
+                      std::lock_guard<std::mutex> lock(mutex);
+                      partials.push_back(std::make_pair(begin, std::move(acc)));
+                    });
+  std::sort(partials.begin(), partials.end(),
+            [](const std::pair<std::size_t, T> & a,
+               const std::pair<std::size_t, T> & b) {
+              return a.first < b.first;
+            });
+  T result = identity;
+  for(auto & p : partials)
+  {
+    result = reduce(std::move(result), std::move(p.second));
+  }
+  return result;
+}
+
+/** combines the elements of a random access range with reduce */
+template<typename ITR, typename T, typename Reduce>
+typename std::enable_if<!std::is_integral<ITR>::value, T>::type
+parallelReduce(const std::shared_ptr<ThreadPool> & pool, ITR first, ITR last,
+               T identity, Reduce reduce, std::size_t grain = 0)
+{
+  std::size_t n = std::size_t(std::distance(first, last));
+  return parallelReduce(pool, std::size_t(0), n, identity,
+                        [first](std::size_t i) -> decltype(*first) {
+                          return first[i];
+                        },
+                        reduce, grain);
+}
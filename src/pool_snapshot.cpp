@@ -0,0 +1,70 @@
+#include "pool_snapshot.h"
+#include <thread>
+
+WorkerSlot::WorkerSlot()
+  : version(0), busy(false), taskId(Task::undefinedTaskId),
+    priority((unsigned int)Task::Priority::Normal), startTime(0)
+{
+}
+
+void WorkerSlot::set(std::size_t _taskId, Task::Priority _priority,
+                     std::chrono::steady_clock::time_point _startTime)
+{
+  write(true, _taskId, (unsigned int)_priority,
+        _startTime.time_since_epoch().count());
+}
+
+void WorkerSlot::clear()
+{
+  write(false, Task::undefinedTaskId, (unsigned int)Task::Priority::Normal, 0);
+}
+
+void WorkerSlot::restore(const WorkerSnapshot & snapshot)
+{
+  if(snapshot.busy)
+  {
+    set(snapshot.taskId, snapshot.priority, snapshot.startTime);
+  }
+  else
+  {
+    clear();
+  }
+}
+
+void WorkerSlot::write(bool _busy, std::size_t _taskId, unsigned int _priority,
+                       std::chrono::steady_clock::rep _startTime)
+{
+  std::uint64_t v = version.load(std::memory_order_relaxed);
+  version.store(v + 1, std::memory_order_relaxed);
+  // the odd version is visible before any of the fields
+  std::atomic_thread_fence(std::memory_order_release);
+  busy.store(_busy, std::memory_order_relaxed);
+  taskId.store(_taskId, std::memory_order_relaxed);
+  priority.store(_priority, std::memory_order_relaxed);
+  startTime.store(_startTime, std::memory_order_relaxed);
+  version.store(v + 2, std::memory_order_release);
+}
+
+WorkerSnapshot WorkerSlot::read() const
+{
+  WorkerSnapshot snapshot;
+  while(true)
+  {
+    std::uint64_t v = version.load(std::memory_order_acquire);
+    if((v & 1u) == 0)
+    {
+      snapshot.busy = busy.load(std::memory_order_relaxed);
+      snapshot.taskId = taskId.load(std::memory_order_relaxed);
+      snapshot.priority = (Task::Priority)priority.load(std::memory_order_relaxed);
+      snapshot.startTime = std::chrono::steady_clock::time_point(
+        std::chrono::steady_clock::duration(startTime.load(std::memory_order_relaxed)));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if(version.load(std::memory_order_relaxed) == v)
+      {
+        snapshot.version = v / 2;
+        return snapshot;
+      }
+    }
+    std::this_thread::yield();
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "task.h"
+
+/** what one worker runs, see ThreadPool::getSnapshot */
+struct WorkerSnapshot
+{
+  std::size_t workerId = 0;
+  bool busy = false;
+  // only set while busy
+  std::size_t taskId = Task::undefinedTaskId;
+  Task::Priority priority = Task::Priority::Normal;
+  std::chrono::steady_clock::time_point startTime;
+  // number of updates of the slot, changes whenever a task starts or ends
+  std::uint64_t version = 0;
+};
+
+struct PoolSnapshot
+{
+  std::size_t queueDepth = 0;
+  std::size_t numWaiting = 0;
+  std::size_t numThreads = 0;
+  std::vector<WorkerSnapshot> workers;
+};
+
+/**
+ * Descriptor of the task a worker runs, published under a sequence lock.
+ * Only the owning worker writes: the version is odd while it does, and
+ * readers copy the fields and retry if the version changed meanwhile,
+ * so neither side ever blocks the other. Padded like WorkerStats.
+ */
+class WorkerSlot
+{
+public:
+  WorkerSlot();
+
+  void set(std::size_t taskId, Task::Priority priority,
+           std::chrono::steady_clock::time_point startTime);
+  void clear();
+  /** copy that was not torn by a concurrent update */
+  WorkerSnapshot read() const;
+  /** puts back a copy taken by read(), after a nested task */
+  void restore(const WorkerSnapshot & snapshot);
+
+private:
+  static const std::size_t cacheLine = 64;
+
+  void write(bool busy, std::size_t taskId, unsigned int priority,
+             std::chrono::steady_clock::rep startTime);
+
+  char pad0[cacheLine];
+  std::atomic<std::uint64_t> version;
+  std::atomic<bool> busy;
+  std::atomic<std::size_t> taskId;
+  std::atomic<unsigned int> priority;
+  std::atomic<std::chrono::steady_clock::rep> startTime;
+  char pad1[cacheLine];
+};
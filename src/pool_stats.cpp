@@ -0,0 +1,173 @@
+#include "pool_stats.h"
+#include <algorithm>
+#include <cmath>
+
+static const std::size_t numSubBuckets = std::size_t(1) << LatencyHistogram::subBucketBits;
+
+// buckets 0 .. 2 * numSubBuckets - 1 hold the values below
+// 2 * numSubBuckets exactly, every further power of two adds numSubBuckets
+const std::size_t LatencyHistogram::numBuckets =
+  (64 - LatencyHistogram::subBucketBits) * numSubBuckets + numSubBuckets;
+
+LatencyHistogram::LatencyHistogram()
+  : counts(numBuckets, 0u), total(0), sum(0), maxValue(0)
+{
+}
+
+std::size_t LatencyHistogram::bucketOf(std::uint64_t ns)
+{
+  unsigned int msb = 0;
+#ifdef __GNUC__
+  msb = (ns ? 63u - unsigned(__builtin_clzll(ns)) : 0u);
+#else
+  for(std::uint64_t v = ns; v > 1u; v >>= 1)
+  {
+    msb++;
+  }
+#endif
+  unsigned int shift = (msb > subBucketBits ? msb - subBucketBits : 0);
+  return shift * numSubBuckets + std::size_t(ns >> shift);
+}
+
+std::uint64_t LatencyHistogram::upperBound(std::size_t bucket)
+{
+  unsigned int shift = (bucket < 2 * numSubBuckets ?
+                        0 : unsigned(bucket / numSubBuckets) - 1);
+  std::uint64_t sub = bucket - shift * numSubBuckets;
+  return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(duration d)
+{
+  std::uint64_t ns = (d.count() > 0 ? std::uint64_t(d.count()) : 0u);
+  counts[bucketOf(ns)]++;
+  total++;
+  sum += ns;
+  maxValue = std::max(maxValue, ns);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram & other)
+{
+  for(std::size_t i = 0; i < numBuckets; i++)
+  {
+    counts[i] += other.counts[i];
+  }
+  total += other.total;
+  sum += other.sum;
+  maxValue = std::max(maxValue, other.maxValue);
+}
+
+std::uint64_t LatencyHistogram::count() const
+{
+  return total;
+}
+
+LatencyHistogram::duration LatencyHistogram::max() const
+{
+  return duration(maxValue);
+}
+
+LatencyHistogram::duration LatencyHistogram::mean() const
+{
+  return duration(total ? sum / total : 0u);
+}
+
+LatencyHistogram::duration LatencyHistogram::percentile(double q) const
+{
+  if(total == 0)
+  {
+    return duration::zero();
+  }
+  std::uint64_t rank = std::uint64_t(std::ceil(q * double(total)));
+  rank = std::max<std::uint64_t>(1u, std::min(rank, total));
+  std::uint64_t seen = 0;
+  for(std::size_t i = 0; i < numBuckets; i++)
+  {
+    seen += counts[i];
+    if(seen >= rank)
+    {
+      return duration(std::min(upperBound(i), maxValue));
+    }
+  }
+  return duration(maxValue);
+}
+
+/** WorkerStats */
+WorkerStats::Histogram::Histogram()
+  : counts(new counter_type[LatencyHistogram::numBuckets]), sum(0), maxValue(0)
+{
+  for(std::size_t i = 0; i < LatencyHistogram::numBuckets; i++)
+  {
+    counts[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void WorkerStats::Histogram::record(duration d)
+{
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  std::uint64_t v = (ns > 0 ? std::uint64_t(ns) : 0u);
+  increment(counts[LatencyHistogram::bucketOf(v)]);
+  sum.store(sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+  if(v > maxValue.load(std::memory_order_relaxed))
+  {
+    maxValue.store(v, std::memory_order_relaxed);
+  }
+}
+
+void WorkerStats::Histogram::addTo(LatencyHistogram & histogram) const
+{
+  std::uint64_t total = 0;
+  for(std::size_t i = 0; i < LatencyHistogram::numBuckets; i++)
+  {
+    std::uint64_t n = counts[i].load(std::memory_order_relaxed);
+    histogram.counts[i] += n;
+    total += n;
+  }
+  histogram.total += total;
+  histogram.sum += sum.load(std::memory_order_relaxed);
+  histogram.maxValue = std::max(histogram.maxValue,
+                                maxValue.load(std::memory_order_relaxed));
+}
+
+WorkerStats::WorkerStats() : numStarted(0), numDone(0), numFailed(0), numCanceled(0)
+{
+}
+
+void WorkerStats::increment(counter_type & counter)
+{
+  // single writer, no read-modify-write needed
+  counter.store(counter.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+}
+
+void WorkerStats::taskStarted(duration wait)
+{
+  increment(numStarted);
+  queueWait.record(wait);
+}
+
+void WorkerStats::taskFinished(bool done, bool canceled, duration run)
+{
+  runTime.record(run);
+  // counted last, so a reader never sees more finished than started tasks
+  increment(canceled ? numCanceled : (done ? numDone : numFailed));
+}
+
+void WorkerStats::addCountsTo(PoolStats & stats) const
+{
+  // read the finished counts first: they never get ahead of numStarted
+  std::size_t done = numDone.load(std::memory_order_acquire);
+  std::size_t failed = numFailed.load(std::memory_order_acquire);
+  std::size_t canceled = numCanceled.load(std::memory_order_acquire);
+  std::size_t started = numStarted.load(std::memory_order_acquire);
+  stats.numDone += done;
+  stats.numFailed += failed;
+  stats.numCanceled += canceled;
+  stats.numRunning += started - done - failed - canceled;
+}
+
+void WorkerStats::addHistogramsTo(PoolStats & stats) const
+{
+  queueWait.addTo(stats.queueWait);
+  runTime.addTo(stats.runTime);
+}
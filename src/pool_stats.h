@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Log-bucketed latency histogram in the style of HdrHistogram.
+ * Every power of two range of nanoseconds is split into 2^subBucketBits
+ * linear buckets, so a recorded value is known within 1/16 of itself
+ * over the whole range of uint64_t.
+ */
+class LatencyHistogram
+{
+public:
+  typedef std::chrono::nanoseconds duration;
+
+  static const unsigned int subBucketBits = 4;
+  static const std::size_t numBuckets;
+
+  LatencyHistogram();
+
+  void record(duration d);
+  void merge(const LatencyHistogram & other);
+
+  std::uint64_t count() const;
+  duration max() const;
+  duration mean() const;
+  /** smallest recorded latency that q of the values do not exceed, q in (0, 1] */
+  duration percentile(double q) const;
+
+  static std::size_t bucketOf(std::uint64_t ns);
+  /** largest value that falls into bucket */
+  static std::uint64_t upperBound(std::size_t bucket);
+
+private:
+  friend class WorkerStats;
+
+  std::vector<std::uint64_t> counts;
+  std::uint64_t total;
+  std::uint64_t sum;
+  std::uint64_t maxValue;
+};
+
+/** consistent enough view of a ThreadPool, see ThreadPool::getStats */
+struct PoolStats
+{
+  std::size_t numThreads = 0;
+  std::size_t numIdle = 0;
+  std::size_t numWaiting = 0;
+  std::size_t numReady = 0;
+  std::size_t numRunning = 0;
+  std::size_t numDone = 0;
+  std::size_t numFailed = 0;
+  std::size_t numCanceled = 0;
+  // submissions that found the queue full (ThreadPool::Overflow)
+  std::size_t numRejected = 0;
+  std::size_t numDropped = 0;
+  std::size_t numCallerRuns = 0;
+  // time from Ready to Running
+  LatencyHistogram queueWait;
+  // time from Running to the final state
+  LatencyHistogram runTime;
+};
+
+/**
+ * Counters and histograms of one worker.
+ * Only the owning worker writes, so updates are plain relaxed stores
+ * and the structure is padded to keep workers off each other's cache
+ * lines. Readers merge all workers without a lock.
+ */
+class WorkerStats
+{
+public:
+  typedef std::chrono::steady_clock::duration duration;
+
+  WorkerStats();
+
+  void taskStarted(duration queueWait);
+  /** canceled counts tasks that were canceled while running */
+  void taskFinished(bool done, bool canceled, duration runTime);
+  void addCountsTo(PoolStats & stats) const;
+  void addHistogramsTo(PoolStats & stats) const;
+
+private:
+  static const std::size_t cacheLine = 64;
+  typedef std::atomic<std::uint64_t> counter_type;
+
+  struct Histogram
+  {
+    Histogram();
+    void record(duration d);
+    void addTo(LatencyHistogram & histogram) const;
+
+    std::unique_ptr<counter_type[]> counts;
+    counter_type sum;
+    counter_type maxValue;
+  };
+
+  static void increment(counter_type & counter);
+
+  char pad0[cacheLine];
+  counter_type numStarted;
+  counter_type numDone;
+  counter_type numFailed;
+  counter_type numCanceled;
+  Histogram queueWait;
+  Histogram runTime;
+  char pad1[cacheLine];
+};
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <sstream>
 #include <chrono>
 #include <exception>
@@ -13,8 +14,35 @@ extern "C" {
 
 static sig_atomic_t s_signal_received = 0;
 static std::size_t maxSolutions = 10000;
+static std::size_t eventCapacity = 16384;
+// boards waiting for a worker, further requests are rejected
+static std::size_t maxQueuedRequests = 256;
+// queued task ids listed by /list, the queue depth is always complete
+static std::size_t listPageSize = 100;
 static struct mg_serve_http_opts s_http_server_opts;
 
+// small boards are interactive requests, they must not queue behind
+// long running solutions of large boards
+static Task::Priority boardPriority(std::size_t n)
+{
+  if(n <= 10)
+  {
+    return Task::Priority::Interactive;
+  }
+  else if(n <= 12)
+  {
+    return Task::Priority::High;
+  }
+  else if(n <= 14)
+  {
+    return Task::Priority::Normal;
+  }
+  else
+  {
+    return Task::Priority::Low;
+  }
+}
+
 static void signal_handler(int sig_num)
 {
   signal(sig_num, signal_handler);  // Reinstantiate signal handler
@@ -35,10 +63,15 @@ static void ev_handler(struct mg_connection *nc,
   switch (ev) {
     case MG_EV_WEBSOCKET_FRAME: {
       struct websocket_message *wm = (struct websocket_message *) ev_data;
-      server->handleWebsocketFrame(std::string((char *) wm->data,
+      server->handleWebsocketFrame(nc,
+                                   std::string((char *) wm->data,
                                                (char *) wm->data + wm->size));
       break;
     }
+    case MG_EV_CLOSE: {
+      server->handleWebsocketClose(nc);
+      break;
+    }
     case MG_EV_HTTP_REQUEST: {
       auto result = server->
         handleRequest(std::string(((struct http_message *) ev_data)->uri.p,
@@ -77,7 +110,8 @@ void HttpServer::run()
 
   printf("Started on port %s\n", port.c_str());
   while (s_signal_received == 0) {
-    mg_mgr_poll(&mgr, 200);
+    mg_mgr_poll(&mgr, 20);
+    sendPendingFrames();
   }
   mg_mgr_free(&mgr);
   nc = nullptr;
@@ -115,7 +149,8 @@ void HttpServer::sendWebsocketFrame(const std::string & msg)
   }
 }
 
-void HttpServer::handleWebsocketFrame(const std::string & data)
+void HttpServer::handleWebsocketFrame(struct mg_connection * c,
+                                      const std::string & data)
 {
   if(pool)
   {
@@ -123,82 +158,152 @@ void HttpServer::handleWebsocketFrame(const std::string & data)
     
     std::stringstream tmp(data);
     tmp >> n;
-    auto task = Task::create([n](std::shared_ptr<Task> task){
+    auto task = ValueTask<NQueensSolution>::create([n](std::shared_ptr<Task> task){
         ChessBoard board(n);
-        auto sol = board.solveNQueens(n, maxSolutions);
-        std::stringstream ss;
-        ss << "{";
-        ss << "\"numQueens\":" << n;
-        ss << ",\"numSolutions\":" << sol.getNumSolutions();
-        ss << ",\"fundamentalSolutions\":" << sol.getFundamentalSolutions();
-        ss << "}";
-        task->setMessage(ss.str());
+        Task * t = task.get();
+        board.setCancelCheck([t](){ return t->isCancelRequested(); });
+        return board.solveNQueens(n, maxSolutions);
       });
-    task->setMessage("{\"numQueens\":" + std::to_string(n) + "}");
-    task->onStateChange([this](Task::State s,
-                               std::shared_ptr<Task> task,
-                               std::shared_ptr<ThreadPool> pool){
-                          std::stringstream ss;
-                          ss << "{ \"state\": \""
-                             << Task::stateToString(s) << "\"";
-                          if(task->getTaskId() != Task::undefinedTaskId)
-                          {
-                            ss << ",\"taskId\":" << task->getTaskId();
-                          }
-                          if(task->getThreadId() != Task::undefinedTaskId)
-                          {
-                            ss << ",\"threadId\":" << task->getThreadId();
-                          }
-                          ss << ",\"numThreads\":" << pool->size();
-                          ss << ",\"result\":" << task->getMessage();
-                          ss << "}";
-                          sendWebsocketFrame(ss.str());
-                        });
-    pool->addTask(task);
+    std::shared_future<NQueensSolution> result = task->getFuture().share();
+    task->setPriority(boardPriority(n));
+    auto & tasks = clientTasks[c];
+    tasks.erase(std::remove_if(tasks.begin(), tasks.end(),
+                               [](const std::weak_ptr<Task> & t) {
+                                 return t.expired();
+                               }),
+                tasks.end());
+    tasks.push_back(task);
+    // the dispatcher waits for the request to be registered before it
+    // handles the first event of the task
+    std::lock_guard<std::mutex> lock(eventMutex);
+    if(!pool->trySubmit(task))
+    {
+      tasks.pop_back();
+      std::stringstream ss;
+      ss << "{ \"state\": \"Rejected\""
+         << ",\"numThreads\":" << pool->size()
+         << ",\"result\":{\"numQueens\":" << n << "}}";
+      std::string msg = ss.str();
+      mg_send_websocket_frame(c, WEBSOCKET_OP_TEXT, msg.c_str(), msg.size());
+      return;
+    }
+    Request & request = requests[task->getTaskId()];
+    request.numQueens = n;
+    request.result = result;
   }
 }
 
-void HttpServer::setThreadPool(std::shared_ptr<ThreadPool> _pool)
+void HttpServer::handleTaskEvents(const std::vector<TaskEvent> & events)
 {
-  pool = _pool;
-  pool->onStateChange(ThreadPool::State::Terminated, [](std::shared_ptr<ThreadPool> p){
-    });
+  std::size_t numThreads = pool->size();
+  std::lock_guard<std::mutex> lock(eventMutex);
+  for(auto & event : events)
+  {
+    auto itr = requests.find(event.taskId);
+    if(itr == requests.end())
+    {
+      continue;
+    }
+    std::stringstream ss;
+    ss << "{ \"state\": \""
+       << Task::stateToString(event.state) << "\"";
+    ss << ",\"taskId\":" << event.taskId;
+    if(event.threadId != Task::undefinedThreadId)
+    {
+      ss << ",\"threadId\":" << event.threadId;
+    }
+    ss << ",\"numThreads\":" << numThreads;
+    ss << ",\"result\":{\"numQueens\":" << itr->second.numQueens;
+    if(event.state == Task::State::Done)
+    {
+      // ready before the Done event is published
+      const NQueensSolution & sol = itr->second.result.get();
+      ss << ",\"numSolutions\":" << sol.getNumSolutions();
+      ss << ",\"fundamentalSolutions\":" << sol.getFundamentalSolutions();
+    }
+    ss << "}}";
+    pendingFrames.push_back(ss.str());
+    if(event.state == Task::State::Done ||
+       event.state == Task::State::Failed ||
+       event.state == Task::State::Canceled)
+    {
+      requests.erase(itr);
+    }
+  }
 }
 
-static void streamVectorTasks(std::stringstream & ss,
-                              const std::vector<std::shared_ptr<Task> > & tasks)
+void HttpServer::sendPendingFrames()
 {
-  bool first = true;
-  ss << "[";
-  for(auto task : tasks)
+  std::vector<std::string> frames;
   {
-    if(first) first = false;
-    else ss << ",";
-    ss << "{";
-    if(task)
+    std::lock_guard<std::mutex> lock(eventMutex);
+    frames.swap(pendingFrames);
+  }
+  for(auto & frame : frames)
+  {
+    sendWebsocketFrame(frame);
+  }
+}
+
+void HttpServer::handleWebsocketClose(struct mg_connection * c)
+{
+  auto itr = clientTasks.find(c);
+  if(itr != clientTasks.end())
+  {
+    for(auto & t : itr->second)
     {
-      ss<< "\"state\":\"" << Task::stateToString(task->getState()) << "\"";
-      if(task->getTaskId() !=  Task::undefinedTaskId)
+      if(auto task = t.lock())
       {
-        ss << ",\"taskId\":" << task->getTaskId();
+        task->cancel();
       }
     }
-    ss << "}";
+    clientTasks.erase(itr);
   }
-  ss << "]";
+}
+
+void HttpServer::setThreadPool(std::shared_ptr<ThreadPool> _pool)
+{
+  pool = _pool;
+  pool->setMaxQueueDepth(maxQueuedRequests, ThreadPool::Overflow::Reject);
+  // observers would format and send frames on the workers
+  pool->enableEventBus(eventCapacity, EventBus::Overflow::Drop);
+  pool->onTaskEvents([this](const std::vector<TaskEvent> & events) {
+      handleTaskEvents(events);
+    });
+  pool->onStateChange(ThreadPool::State::Terminated, [](std::shared_ptr<ThreadPool> p){
+    });
 }
 
 std::string HttpServer::getTasksJson() const
 {
   if(pool)
   {
-    auto tasks = pool->getTasks();
+    // no task is copied or locked, the page of ids is the only part
+    // that touches the queue
+    auto snapshot = pool->getSnapshot();
+    auto ids = pool->getQueuedTaskIds(0, listPageSize);
     std::stringstream ss;
-    ss << "{\"queue\":";
-    streamVectorTasks(ss, tasks.first);
-    ss << ",\"threads\":";
-    streamVectorTasks(ss, tasks.second);
-    ss << "}";
+    ss << "{\"queueDepth\":" << snapshot.queueDepth;
+    ss << ",\"queue\":[";
+    for(std::size_t i = 0; i < ids.size(); i++)
+    {
+      if(i > 0) ss << ",";
+      ss << "{\"taskId\":" << ids[i] << "}";
+    }
+    ss << "],\"threads\":[";
+    for(std::size_t i = 0; i < snapshot.workers.size(); i++)
+    {
+      const WorkerSnapshot & worker = snapshot.workers[i];
+      if(i > 0) ss << ",";
+      ss << "{";
+      if(worker.busy)
+      {
+        ss << "\"state\":\"" << Task::stateToString(Task::State::Running) << "\"";
+        ss << ",\"taskId\":" << worker.taskId;
+      }
+      ss << "}";
+    }
+    ss << "]}";
     return ss.str();
   }
   else
@@ -206,4 +311,3 @@ std::string HttpServer::getTasksJson() const
     return std::string("{}");
   }
 }
-
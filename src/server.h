@@ -1,12 +1,16 @@
 #pragma once
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
 #include <map>
+#include "n_queens.h"
 
 class ThreadPool;
 class Task;
+struct TaskEvent;
 struct mg_connection;
 
 class HttpServer
@@ -16,12 +20,29 @@ public:
   void run();
   void setThreadPool(std::shared_ptr<ThreadPool> _pool);
   std::pair<std::string, std::string> handleRequest(const std::string & uri);
-  void handleWebsocketFrame(const std::string & data);
+  void handleWebsocketFrame(struct mg_connection * c, const std::string & data);
+  void handleWebsocketClose(struct mg_connection * c);
   void sendWebsocketFrame(const std::string & msg);
   std::string getTasksJson() const;
+  void handleTaskEvents(const std::vector<TaskEvent> & events);
 private:
+  struct Request
+  {
+    std::size_t numQueens;
+    std::shared_future<NQueensSolution> result;
+  };
+
+  void sendPendingFrames();
+
   std::string index;
   std::shared_ptr<ThreadPool> pool;
   struct mg_connection * nc;
   std::string port;
+  // tasks requested by each websocket client, canceled when it goes away
+  std::map<struct mg_connection *, std::vector<std::weak_ptr<Task> > > clientTasks;
+  // requests by task id and frames for the clients, shared with the
+  // event dispatcher of the pool
+  std::mutex eventMutex;
+  std::map<std::size_t, Request> requests;
+  std::vector<std::string> pendingFrames;
 };
@@ -1,17 +1,24 @@
 #include "server.h"
 #include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 static const char *s_http_port_1 = "8000";
+// boards still queued after it are dropped, so a restart does not wait
+// for a deep queue
+static const std::chrono::seconds s_shutdown_timeout(5);
 
 int main()
 {
-  std::size_t n_threads = 4;
+  std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
   HttpServer server1(s_http_port_1);
-  auto pool = ThreadPool::create(n_threads);
+  auto pool = ThreadPool::createElastic(1, max_threads,
+                                        ThreadPool::Scheduler::Priority);
   server1.setThreadPool(pool);
   pool->activate();
   server1.run();
-  pool->terminate();
+  pool->terminate(ThreadPool::Shutdown::DrainUntil, s_shutdown_timeout);
   return 0;
 }
 
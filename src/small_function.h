@@ -0,0 +1,198 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template<typename Signature>
+class SmallFunction;
+
+/**
+ * Move-only replacement for std::function.
+ * Callables up to bufferSize bytes that can be moved without throwing
+ * are stored inline, larger ones on the heap. Dispatch goes through one
+ * static table per callable type.
+ */
+template<typename R, typename... Args>
+class SmallFunction<R(Args...)>
+{
+public:
+  static const std::size_t bufferSize = 64;
+
+  SmallFunction() : ops(nullptr)
+  {
+  }
+
+  template<typename F,
+           typename = typename std::enable_if<
+             !std::is_same<typename std::decay<F>::type, SmallFunction>::value>::type>
+  SmallFunction(F && func) : ops(nullptr)
+  {
+    typedef typename std::decay<F>::type callable_type;
+    init<callable_type>(std::forward<F>(func),
+                        std::integral_constant<bool, fitsInline<callable_type>()>());
+  }
+
+  SmallFunction(SmallFunction && other) : ops(other.ops)
+  {
+    if(ops)
+    {
+      ops->move(&other.buffer, &buffer);
+      other.ops = nullptr;
+    }
+  }
+
+  SmallFunction & operator=(SmallFunction && other)
+  {
+    if(this != &other)
+    {
+      reset();
+      if(other.ops)
+      {
+        other.ops->move(&other.buffer, &buffer);
+        ops = other.ops;
+        other.ops = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  SmallFunction(const SmallFunction &) = delete;
+  SmallFunction & operator=(const SmallFunction &) = delete;
+
+  ~SmallFunction()
+  {
+    reset();
+  }
+
+  explicit operator bool() const
+  {
+    return ops != nullptr;
+  }
+
+  R operator()(Args... args)
+  {
+    return ops->invoke(&buffer, std::forward<Args>(args)...);
+  }
+
+  /** false if the callable did not fit into the buffer */
+  bool isInline() const
+  {
+    return ops == nullptr || ops->inlined;
+  }
+
+  template<typename F>
+  static constexpr bool fitsInline()
+  {
+    return (sizeof(F) <= bufferSize &&
+            alignof(F) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<F>::value);
+  }
+
+private:
+  typedef typename std::aligned_storage<bufferSize,
+                                        alignof(std::max_align_t)>::type buffer_type;
+
+  struct Ops
+  {
+    R (*invoke)(buffer_type * buffer, Args&&... args);
+    void (*move)(buffer_type * from, buffer_type * to);
+    void (*destroy)(buffer_type * buffer);
+    bool inlined;
+  };
+
+  template<typename F>
+  struct InlineOps
+  {
+    static R invoke(buffer_type * buffer, Args&&... args)
+    {
+      return (*reinterpret_cast<F*>(buffer))(std::forward<Args>(args)...);
+    }
+
+    static void move(buffer_type * from, buffer_type * to)
+    {
+      F * f = reinterpret_cast<F*>(from);
+      new (to) F(std::move(*f));
+      f->~F();
+    }
+
+    static void destroy(buffer_type * buffer)
+    {
+      reinterpret_cast<F*>(buffer)->~F();
+    }
+
+    static const Ops table;
+  };
+
+  template<typename F>
+  struct HeapOps
+  {
+    static F *& pointer(buffer_type * buffer)
+    {
+      return *reinterpret_cast<F**>(buffer);
+    }
+
+    static R invoke(buffer_type * buffer, Args&&... args)
+    {
+      return (*pointer(buffer))(std::forward<Args>(args)...);
+    }
+
+    static void move(buffer_type * from, buffer_type * to)
+    {
+      new (to) F*(pointer(from));
+    }
+
+    static void destroy(buffer_type * buffer)
+    {
+      delete pointer(buffer);
+    }
+
+    static const Ops table;
+  };
+
+  template<typename F, typename G>
+  void init(G && func, std::true_type)
+  {
+    new (&buffer) F(std::forward<G>(func));
+    ops = &InlineOps<F>::table;
+  }
+
+  template<typename F, typename G>
+  void init(G && func, std::false_type)
+  {
+    new (&buffer) F*(new F(std::forward<G>(func)));
+    ops = &HeapOps<F>::table;
+  }
+
+  void reset()
+  {
+    if(ops)
+    {
+      ops->destroy(&buffer);
+      ops = nullptr;
+    }
+  }
+
+  buffer_type buffer;
+  const Ops * ops;
+};
+
+template<typename R, typename... Args>
+template<typename F>
+const typename SmallFunction<R(Args...)>::Ops
+SmallFunction<R(Args...)>::InlineOps<F>::table = {
+  &SmallFunction<R(Args...)>::InlineOps<F>::invoke,
+  &SmallFunction<R(Args...)>::InlineOps<F>::move,
+  &SmallFunction<R(Args...)>::InlineOps<F>::destroy,
+  true
+};
+
+template<typename R, typename... Args>
+template<typename F>
+const typename SmallFunction<R(Args...)>::Ops
+SmallFunction<R(Args...)>::HeapOps<F>::table = {
+  &SmallFunction<R(Args...)>::HeapOps<F>::invoke,
+  &SmallFunction<R(Args...)>::HeapOps<F>::move,
+  &SmallFunction<R(Args...)>::HeapOps<F>::destroy,
+  false
+};
@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/**
+ * Bounded lock-free single-producer/single-consumer ring buffer.
+ * Exactly one thread may push and one thread may pop at a time. Each
+ * side caches the index of the other side and only reloads it when the
+ * ring looks full or empty, so the indices rarely change cache lines.
+ * The capacity is rounded up to a power of two.
+ */
+template<typename T>
+class SpscRing
+{
+public:
+  SpscRing(std::size_t capacity);
+
+  /** false if the ring is full */
+  bool tryPush(const T & value);
+  /** false if the ring is empty */
+  bool tryPop(T & value);
+
+  std::size_t capacity() const;
+  /** approximate number of elements while producer or consumer are active */
+  std::size_t size() const;
+
+private:
+  static const std::size_t cacheLine = 64;
+  typedef std::atomic<std::size_t> index_type;
+
+  std::unique_ptr<T[]> cells;
+  std::size_t mask;
+  char pad0[cacheLine];
+  // written by the consumer
+  index_type head;
+  std::size_t cachedTail;
+  char pad1[cacheLine - sizeof(index_type) - sizeof(std::size_t)];
+  // written by the producer
+  index_type tail;
+  std::size_t cachedHead;
+  char pad2[cacheLine - sizeof(index_type) - sizeof(std::size_t)];
+};
+
+template<typename T>
+SpscRing<T>::SpscRing(std::size_t capacity)
+{
+  std::size_t n = 2;
+  while(n < capacity)
+  {
+    n <<= 1;
+  }
+  cells.reset(new T[n]);
+  mask = n - 1;
+  head.store(0, std::memory_order_relaxed);
+  tail.store(0, std::memory_order_relaxed);
+  cachedTail = 0;
+  cachedHead = 0;
+}
+
+template<typename T>
+bool SpscRing<T>::tryPush(const T & value)
+{
+  std::size_t t = tail.load(std::memory_order_relaxed);
+  if(t - cachedHead > mask)
+  {
+    cachedHead = head.load(std::memory_order_acquire);
+    if(t - cachedHead > mask)
+    {
+      return false;
+    }
+  }
+  cells[t & mask] = value;
+  tail.store(t + 1, std::memory_order_release);
+  return true;
+}
+
+template<typename T>
+bool SpscRing<T>::tryPop(T & value)
+{
+  std::size_t h = head.load(std::memory_order_relaxed);
+  if(h == cachedTail)
+  {
+    cachedTail = tail.load(std::memory_order_acquire);
+    if(h == cachedTail)
+    {
+      return false;
+    }
+  }
+  value = cells[h & mask];
+  head.store(h + 1, std::memory_order_release);
+  return true;
+}
+
+template<typename T>
+std::size_t SpscRing<T>::capacity() const
+{
+  return mask + 1;
+}
+
+template<typename T>
+std::size_t SpscRing<T>::size() const
+{
+  std::size_t h = head.load(std::memory_order_relaxed);
+  std::size_t t = tail.load(std::memory_order_relaxed);
+  return (t > h ? t - h : 0u);
+}
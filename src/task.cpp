@@ -1,51 +1,33 @@
 #include "task.h"
+#include "thread_pool.h"
+#include <condition_variable>
+#include <cstdint>
 #include <stdexcept>
-#include <unordered_map>
 
 const std::size_t Task::undefinedThreadId = std::size_t(-1);
 const std::size_t Task::undefinedTaskId = std::size_t(-1);
+const unsigned int Task::numPriorities = 4u;
 
-std::shared_ptr<Task> Task::create(std::function<void()> func)
+namespace
 {
-  return std::shared_ptr<Task>( new Task([func](std::shared_ptr<Task> t){
-        try
-        {
-          func();
-        }
-        catch(...)
-        {
-          return false;
-        }
-        return true;
-      }));
-}
-
-std::shared_ptr<Task> Task::create(std::function<bool()> func)
-{
-  return std::shared_ptr<Task>( new Task([func](std::shared_ptr<Task> task){ return func(); }));
-}
+  // Tasks share a small table of condition variables for wait(), rather
+  // than carrying a promise/future pair each.
+  struct WaitSlot
+  {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::atomic<std::size_t> waiters;
+  };
 
-std::shared_ptr<Task> Task::create(std::function<void(std::shared_ptr<Task>)> func)
-{
-  return std::shared_ptr<Task>( new Task([func](std::shared_ptr<Task> task){
-        try
-        {
-          func(task);
-        }
-        catch(...)
-        {
-          return false;
-        }
-        return true;
-      }));
-}
+  const std::size_t numWaitSlots = 64;
+  WaitSlot waitSlots[numWaitSlots];
 
-std::shared_ptr<Task> Task::create(std::function<bool(std::shared_ptr<Task>)> func)
-{
-  return std::shared_ptr<Task>( new Task(func) );
+  WaitSlot & getWaitSlot(const Task * task)
+  {
+    return waitSlots[(std::uintptr_t(task) / 64) % numWaitSlots];
+  }
 }
 
-
 std::string Task::stateToString(State s)
 {
   switch(s)
@@ -61,12 +43,24 @@ std::string Task::stateToString(State s)
   };
 }
 
-Task::Task(std::function<bool(std::shared_ptr<Task> task)> func)
-  : function(func),
+Task::Task(ConstructTag, function_type && func)
+  : Task(std::move(func))
+{
+}
+
+Task::Task(function_type && func)
+  : function(std::move(func)),
+    observerMask(0u),
     threadId(Task::undefinedThreadId),
     taskId(Task::undefinedTaskId),
     state(State::Waiting),
-    future(promise.get_future())
+    priority(Priority::Normal),
+    finished(false),
+    numPending(1),
+    predecessorFailed(false),
+    join(Join::None),
+    anyReleased(false),
+    successorsReleased(false)
 {
 }
 
@@ -89,41 +83,233 @@ Task::State Task::getState() const
   return state;
 }
 
+Task::Priority Task::getPriority() const
+{
+  return priority;
+}
+
+std::chrono::steady_clock::time_point Task::getReadyTime() const
+{
+  return readyTime;
+}
+
+void Task::setPriority(Priority p)
+{
+  if(state != State::Waiting)
+  {
+    throw std::logic_error("Task priority can only be changed before the task is added");
+  }
+  priority = p;
+}
+
 std::string Task::getMessage() const
 {
-  return message;
+  std::lock_guard<std::mutex> main_lock(taskMutex);
+  return (message ? *message : std::string());
 }
 
 void Task::setMessage(const std::string & msg)
 {
   std::lock_guard<std::mutex> main_lock(taskMutex);
-  message = msg;
+  if(message)
+  {
+    *message = msg;
+  }
+  else
+  {
+    message.reset(new std::string(msg));
+  }
 }
 
 void Task::onStateChange(Task::State s,
                          std::function<void(std::shared_ptr<Task>,
                                             std::shared_ptr<ThreadPool>)> func)
 {
-  unsigned int ints = (unsigned int)s;
-  stateChanges[ints].push_back(func);
+  if(!observers)
+  {
+    observers.reset(new Observers());
+  }
+  observers->stateChanges[stateIndex(s)].push_back(func);
+  observerMask |= (unsigned int)s;
 }
 
 void Task::onStateChange(std::function<void(State s,
 					    std::shared_ptr<Task>,
 					    std::shared_ptr<ThreadPool>)> func)
 {
-  genStateChanges.push_back(func);
+  if(!observers)
+  {
+    observers.reset(new Observers());
+  }
+  observers->genStateChanges.push_back(func);
+  observerMask = ~0u;
+}
+
+void Task::dependsOn(std::shared_ptr<Task> predecessor)
+{
+  if(taskId != undefinedTaskId || state != State::Waiting)
+  {
+    throw std::logic_error("Dependencies must be declared before the task is added");
+  }
+  if(predecessor.get() == this)
+  {
+    throw std::logic_error("Task cannot depend on itself");
+  }
+  std::lock_guard<std::mutex> lock(predecessor->taskMutex);
+  if(predecessor->successorsReleased)
+  {
+    if(predecessor->state != State::Done)
+    {
+      predecessorFailed = true;
+    }
+  }
+  else
+  {
+    numPending++;
+    predecessor->successors.push_back(shared_from_this());
+  }
+}
+
+std::shared_ptr<Task> Task::whenAll(const std::vector<std::shared_ptr<Task> > & tasks)
+{
+  if(tasks.empty())
+  {
+    throw std::logic_error("whenAll needs at least one task");
+  }
+  auto all = create([](){});
+  all->continueAfter(tasks, Join::All);
+  return all;
+}
+
+std::shared_ptr<Task> Task::whenAny(const std::vector<std::shared_ptr<Task> > & tasks)
+{
+  if(tasks.empty())
+  {
+    throw std::logic_error("whenAny needs at least one task");
+  }
+  auto any = create([](){});
+  any->continueAfter(tasks, Join::Any);
+  return any;
+}
+
+void Task::continueAfter(const std::vector<std::shared_ptr<Task> > & predecessors, Join j)
+{
+  join = j;
+  // held while registering, so no predecessor can release the
+  // continuation before all edges exist
+  numPending++;
+  bool done = false;
+  std::shared_ptr<ThreadPool> pool;
+  for(auto & predecessor : predecessors)
+  {
+    std::lock_guard<std::mutex> lock(predecessor->taskMutex);
+    if(!predecessor->successorsReleased)
+    {
+      numPending++;
+      predecessor->successors.push_back(shared_from_this());
+    }
+    else
+    {
+      if(predecessor->state == State::Done)
+      {
+        done = true;
+      }
+      else
+      {
+        predecessorFailed = true;
+      }
+      if(auto owner = predecessor->owner.lock())
+      {
+        pool = owner;
+      }
+    }
+  }
+  if(releaseContinuation(done))
+  {
+    ThreadPool::releaseContinuation(shared_from_this(), pool, done);
+  }
+}
+
+bool Task::releaseContinuation(bool done)
+{
+  // the count drops to one (the task is never added) after the last
+  // predecessor
+  std::size_t pending = --numPending;
+  if(join == Join::Any)
+  {
+    return (done || pending == 1) && !anyReleased.exchange(true);
+  }
+  return pending == 1;
+}
+
+bool Task::cancel()
+{
+  return ThreadPool::cancel(shared_from_this());
+}
+
+bool Task::isCancelRequested() const
+{
+  return state.load(std::memory_order_relaxed) == State::CancelRequested;
 }
 
 void Task::wait()
 {
-  future.wait();
+  if(finished)
+  {
+    return;
+  }
+  if(ThreadPool * pool = ThreadPool::getCurrentPool())
+  {
+    // poll, tasks may become Ready while the queue is empty
+    while(!finished)
+    {
+      if(!pool->runPendingTask())
+      {
+        waitFor(ThreadPool::helpPollInterval);
+      }
+    }
+    return;
+  }
+  WaitSlot & slot = getWaitSlot(this);
+  std::unique_lock<std::mutex> lock(slot.mutex);
+  // announce the waiter before checking, notifyFinished sets the flag
+  // before it looks for waiters
+  slot.waiters++;
+  while(!finished)
+  {
+    slot.condition.wait(lock);
+  }
+  slot.waiters--;
+}
+
+void Task::waitFor(std::chrono::steady_clock::duration timeout)
+{
+  WaitSlot & slot = getWaitSlot(this);
+  std::unique_lock<std::mutex> lock(slot.mutex);
+  slot.waiters++;
+  if(!finished)
+  {
+    slot.condition.wait_for(lock, timeout);
+  }
+  slot.waiters--;
+}
+
+void Task::notifyFinished()
+{
+  finished = true;
+  WaitSlot & slot = getWaitSlot(this);
+  if(slot.waiters > 0)
+  {
+    {
+      std::lock_guard<std::mutex> lock(slot.mutex);
+    }
+    slot.condition.notify_all();
+  }
 }
 
-bool Task::run()
+bool Task::run(const shared_self_type & self)
 {
   bool ret = true;
-  auto self = shared_from_this();
   try
   {
     ret = function(self);
@@ -135,84 +321,80 @@ bool Task::run()
   return ret;
 }
 
-void Task::handleStateChange(std::shared_ptr<ThreadPool> pool)
+void Task::finish(State s)
 {
-  auto itr = stateChanges.find((unsigned int)state);
-  if(itr != stateChanges.end())
+}
+
+void Task::handleStateChange(const std::shared_ptr<ThreadPool> & pool)
+{
+  handleStateChange(state, pool);
+}
+
+void Task::handleStateChange(State s, const std::shared_ptr<ThreadPool> & pool)
+{
+  // s is the state of the transition being reported; the task may
+  // already have moved on when another thread picked it up meanwhile
+  if(!hasObservers(s))
   {
-    auto self = shared_from_this();
-    for(auto func : itr->second)
-    {
-      func(self, pool);
-    }
+    return;
   }
-  if(!genStateChanges.empty())
+  auto self = shared_from_this();
+  for(auto & func : observers->stateChanges[stateIndex(s)])
   {
-    auto self = shared_from_this();
-    for(auto func : genStateChanges)
-    {
-      func(state, self, pool);
-    }
+    func(self, pool);
+  }
+  for(auto & func : observers->genStateChanges)
+  {
+    func(s, self, pool);
   }
 }
 
-void Task::setState(Task::State s)
+unsigned int Task::stateIndex(State s)
+{
+  unsigned int index = 0;
+  for(unsigned int bits = (unsigned int)s; bits > 1u; bits >>= 1)
+  {
+    index++;
+  }
+  return index;
+}
+
+bool Task::isValidTransition(State from, State to)
 {
-  switch(state)
+  switch(from)
   {
   case State::Waiting:
-    if(s == State::Ready)
-    {
-      state = State::Ready;
-      return;
-    }
-    else if(s == State::Canceled)
-    {
-      state = State::Canceled;
-      return;
-    }
-    break;
+    return (to == State::Ready || to == State::Canceled);
   case State::Ready:
-    if(s == State::Running)
-    {
-      state = State::Running;
-      return;
-    }
-    else if(s == State::Canceled)
-    {
-      state = State::Canceled;
-      return;
-    }
-    break;
+    return (to == State::Running || to == State::Canceled);
   case State::Running:
-    if(s == State::Done) 
-    {
-      state = State::Done;
-      return;
-    }
-    else if(s == State::Failed)
-    {
-      state = State::Failed;
-      return;
-    }
-    else if(s == State::CancelRequested)
-    {
-      state = State::CancelRequested;
-      return;
-    }
-    break;
+    return (to == State::Done ||
+            to == State::Failed ||
+            to == State::CancelRequested);
   case State::CancelRequested:
-    if(s == State::Canceled)
+    return (to == State::Canceled);
+  default:
+    return false;
+  }
+}
+
+bool Task::transition(State from, State to)
+{
+  return state.compare_exchange_strong(from, to);
+}
+
+void Task::setState(Task::State s)
+{
+  State current = state.load();
+  do
+  {
+    if(!isValidTransition(current, s))
     {
-      state = State::Canceled;
-      return;
+      throw std::logic_error("Invalid Task transition " +
+                             Task::stateToString(current) +
+                             " -> " +
+                             Task::stateToString(s));
     }
-    break;
-  default:
-    break;
   }
-  throw std::logic_error("Invalid Task transition " +
-                         Task::stateToString(state) +
-                         " -> " +
-                         Task::stateToString(s));
+  while(!state.compare_exchange_weak(current, s));
 }
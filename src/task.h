@@ -1,12 +1,16 @@
 #pragma once
-#include <unordered_map>
-#include <list>
+#include <vector>
+#include <atomic>
+#include <chrono>
 
 #include <functional>
 #include <string>
 #include <memory>
 
 #include <future>
+#include <type_traits>
+#include "small_function.h"
+#include "task_allocator.h"
 
 class ThreadPool;
 
@@ -14,6 +18,8 @@ class Task : public std::enable_shared_from_this<Task>
 {
 public:
   friend class ThreadPool;
+  // registers its continuation with an observer before releasing it
+  friend class TaskAwaitable;
   enum class State : unsigned int
   {
     Waiting         = 1,  //-> Ready, Canceled
@@ -25,19 +31,38 @@ public:
     Failed          = 64 
   };
 
+  enum class Priority : unsigned int
+  {
+    Low             = 0,
+    Normal          = 1,
+    High            = 2,
+    Interactive     = 3
+  };
+  static const unsigned int numPriorities;
+  static const unsigned int numStates = 7;
+
   static const std::size_t undefinedThreadId;
   static const std::size_t undefinedTaskId;
   virtual ~Task();
 
-  static std::shared_ptr<Task> create(std::function<void()> func);
-  static std::shared_ptr<Task> create(std::function<bool()> func);
-  static std::shared_ptr<Task> create(std::function<void(std::shared_ptr<Task>)> func);
-  static std::shared_ptr<Task> create(std::function<bool(std::shared_ptr<Task>)> func);
+  typedef SmallFunction<bool(const std::shared_ptr<Task> &)> function_type;
+
+  /**
+   * func is called with no arguments or with the task itself.
+   * If it returns bool, false marks the task as Failed, so does an
+   * exception; any other return value is ignored.
+   */
+  template<typename F>
+  static std::shared_ptr<Task> create(F && func);
   static std::string stateToString(State s);
 
   std::size_t getThreadId() const;
   std::size_t getTaskId() const;
   State getState() const;
+  Priority getPriority() const;
+  /** when the task was last queued */
+  std::chrono::steady_clock::time_point getReadyTime() const;
+  void setPriority(Priority p);
   std::string getMessage() const;
   void setMessage(const std::string & msg);
   void onStateChange(State s,
@@ -46,11 +71,73 @@ public:
   void onStateChange(std::function<void(State s,
 					std::shared_ptr<Task>,
                                         std::shared_ptr<ThreadPool>)> func);
+  /**
+   * The task becomes Ready only after predecessor is Done.
+   * If the predecessor fails or is canceled, this task is canceled.
+   * Dependencies must be declared before the task is added to a pool.
+   */
+  void dependsOn(std::shared_ptr<Task> predecessor);
+  /**
+   * Continuation that runs func once this task is Done, in the pool
+   * that ran this task. It is canceled if this task fails or is
+   * canceled, and inherits the priority of this task.
+   * Continuations are queued by their predecessors and must not be
+   * added to a pool.
+   */
+  template<typename F>
+  std::shared_ptr<Task> then(F && func);
+  /**
+   * Like then(), but func also runs if this task fails or is canceled.
+   * If no pool can run it, because this task was canceled before it
+   * was added or its pool has terminated, the thread that releases the
+   * continuation runs it. Once queued it can still be dropped or
+   * discarded by the pool like any other task.
+   */
+  template<typename F>
+  std::shared_ptr<Task> finally(F && func);
+  /** continuation that is Done after all tasks are Done */
+  static std::shared_ptr<Task> whenAll(const std::vector<std::shared_ptr<Task> > & tasks);
+  /**
+   * continuation that is Done after one of the tasks is Done and
+   * canceled if none of them succeeds
+   */
+  static std::shared_ptr<Task> whenAny(const std::vector<std::shared_ptr<Task> > & tasks);
+  /**
+   * Waiting and Ready tasks are canceled right away, running tasks
+   * are asked to stop (CancelRequested) and are Canceled when they
+   * return. Returns false if the task has already finished.
+   */
+  bool cancel();
+  /** cheap poll for running task functions */
+  bool isCancelRequested() const;
+  /**
+   * Blocks until the task has finished. On a pool worker the thread
+   * runs other Ready tasks of its pool meanwhile, so fork-join code
+   * cannot run out of workers.
+   */
   void wait();
+
+protected:
+  /** restricts construction to create(), which allocates through TaskAllocator */
+  struct ConstructTag
+  {
+  };
+
+public:
+  Task(ConstructTag, function_type && func);
+
 protected:
   void setState(State s);
-  void handleStateChange(std::shared_ptr<ThreadPool> pool);
-  Task(std::function<bool(std::shared_ptr<Task>)> func);
+  /** true if an observer listens to s */
+  bool hasObservers(State s) const
+  {
+    return (observerMask & (unsigned int)s) != 0u;
+  }
+  void handleStateChange(const std::shared_ptr<ThreadPool> & pool);
+  void handleStateChange(State s, const std::shared_ptr<ThreadPool> & pool);
+  /** called once with the final state, before its observers run */
+  virtual void finish(State s);
+  Task(function_type && func);
 private:
   typedef std::shared_ptr<Task> shared_self_type;
   typedef std::shared_ptr<ThreadPool> shared_pool_type;
@@ -59,17 +146,166 @@ private:
   typedef std::function<void(State,
 			     shared_self_type,
 			     shared_pool_type)> gen_state_change_func_type;
-  typedef std::list<state_change_func_type> state_change_func_list_type;
+  typedef std::vector<state_change_func_type> state_change_func_list_type;
 
-  bool run();
-  std::mutex taskMutex;
-  std::function<bool(shared_self_type)> function;
-  std::unordered_map<unsigned int, state_change_func_list_type> stateChanges;
-  std::list<gen_state_change_func_type> genStateChanges;
+  // most tasks have none, so they are allocated on first use
+  struct Observers
+  {
+    // indexed by the bit of the state
+    state_change_func_list_type stateChanges[numStates];
+    std::vector<gen_state_change_func_type> genStateChanges;
+  };
+
+  static unsigned int stateIndex(State s);
+  static bool isValidTransition(State from, State to);
+  bool transition(State from, State to);
+  bool run(const shared_self_type & self);
+  /** releases wait(), after observers and successors have been handled */
+  void notifyFinished();
+  /** blocks until the task has finished or the timeout expired */
+  void waitFor(std::chrono::steady_clock::duration timeout);
+  // how a continuation is released by its predecessors, None for
+  // tasks that are added to a pool explicitly
+  enum class Join : unsigned char
+  {
+    None,
+    All,     // after all predecessors are Done
+    Any,     // after the first predecessor that is Done
+    Finally  // after all predecessors have finished
+  };
+
+  /** registers this task as continuation of the predecessors */
+  void continueAfter(const std::vector<std::shared_ptr<Task> > & predecessors, Join j);
+  /**
+   * Called once per released predecessor of a continuation, true if
+   * the call decides whether the continuation runs or is canceled.
+   */
+  bool releaseContinuation(bool done);
+  mutable std::mutex taskMutex;
+  function_type function;
+  std::unique_ptr<Observers> observers;
+  // states with at least one observer
+  unsigned int observerMask;
   std::size_t threadId;
   std::size_t taskId;
-  State state;
-  std::promise<void> promise;
-  std::future<void> future;
-  std::string message;
+  std::atomic<State> state;
+  Priority priority;
+  std::atomic<bool> finished;
+  // guarded by taskMutex
+  std::unique_ptr<std::string> message;
+
+  // unfinished predecessors, plus one until the task is added to a pool
+  std::atomic<std::size_t> numPending;
+  std::atomic<bool> predecessorFailed;
+  // continuations are queued by the pool of the predecessor that
+  // releases them
+  Join join;
+  std::atomic<bool> anyReleased;
+  // guarded by taskMutex
+  std::vector<std::shared_ptr<Task> > successors;
+  bool successorsReleased;
+  std::weak_ptr<ThreadPool> owner;
+  // set when the task is queued
+  std::chrono::steady_clock::time_point readyTime;
+};
+
+/** result of calling F with Args; std::result_of is deprecated in C++17 */
+#if __cplusplus >= 201703L
+template<typename F, typename... Args>
+struct InvokeResult : std::invoke_result<F, Args...>
+{
+};
+#else
+template<typename F, typename... Args>
+struct InvokeResult : std::result_of<F(Args...)>
+{
+};
+#endif
+
+/** true if F can be called with the task */
+template<typename F>
+class TaskFunctionTakesTask
+{
+  template<typename G>
+  static std::true_type test(decltype((void)std::declval<G&>()(std::declval<const std::shared_ptr<Task>&>()))*);
+  template<typename G>
+  static std::false_type test(...);
+
+public:
+  static const bool value = decltype(test<F>(nullptr))::value;
+};
+
+/**
+ * Calls a task function with the task if it takes one, without
+ * arguments otherwise.
+ */
+template<typename F, bool = TaskFunctionTakesTask<F>::value>
+struct TaskInvoker
+{
+  typedef typename InvokeResult<F&, const std::shared_ptr<Task>&>::type result_type;
+
+  static result_type invoke(F & func, const std::shared_ptr<Task> & task)
+  {
+    return func(task);
+  }
 };
+
+template<typename F>
+struct TaskInvoker<F, false>
+{
+  typedef typename InvokeResult<F&>::type result_type;
+
+  static result_type invoke(F & func, const std::shared_ptr<Task> &)
+  {
+    return func();
+  }
+};
+
+/** adapts a task function to Task::function_type */
+template<typename F>
+struct TaskBody
+{
+  F func;
+
+  bool operator()(const std::shared_ptr<Task> & task)
+  {
+    return call(task, std::is_same<typename TaskInvoker<F>::result_type, bool>());
+  }
+
+  bool call(const std::shared_ptr<Task> & task, std::true_type)
+  {
+    return TaskInvoker<F>::invoke(func, task);
+  }
+
+  bool call(const std::shared_ptr<Task> & task, std::false_type)
+  {
+    TaskInvoker<F>::invoke(func, task);
+    return true;
+  }
+};
+
+template<typename F>
+std::shared_ptr<Task> Task::create(F && func)
+{
+  typedef TaskBody<typename std::decay<F>::type> body_type;
+  return std::allocate_shared<Task>(TaskAllocator<Task>(), ConstructTag(),
+                                    function_type(body_type{ std::forward<F>(func) }));
+}
+
+template<typename F>
+std::shared_ptr<Task> Task::then(F && func)
+{
+  auto next = create(std::forward<F>(func));
+  next->priority = priority;
+  next->continueAfter(std::vector<std::shared_ptr<Task> >(1, shared_from_this()), Join::All);
+  return next;
+}
+
+template<typename F>
+std::shared_ptr<Task> Task::finally(F && func)
+{
+  auto next = create(std::forward<F>(func));
+  next->priority = priority;
+  next->continueAfter(std::vector<std::shared_ptr<Task> >(1, shared_from_this()), Join::Finally);
+  return next;
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+/**
+ * Recycling allocator for tasks, used with std::allocate_shared so the
+ * task and its control block share one block.
+ * Freed blocks go to a cache of the freeing thread. Workers free more
+ * tasks than they create, so full caches hand batches of blocks to a
+ * shared list, from which threads with an empty cache refill.
+ * Blocks are only returned to the system when the shared list is full.
+ */
+template<typename T>
+class TaskAllocator
+{
+public:
+  typedef T value_type;
+
+  /** blocks moved between a thread cache and the shared list at once */
+  static const std::size_t batchSize = 64;
+  static const std::size_t maxThreadCached = 2 * batchSize;
+  static const std::size_t maxShared = 64 * 1024;
+
+  TaskAllocator()
+  {
+  }
+
+  template<typename U>
+  TaskAllocator(const TaskAllocator<U> &)
+  {
+  }
+
+  T * allocate(std::size_t n)
+  {
+    if(n != 1)
+    {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    Cache & cache = getCache();
+    if(!cache.head)
+    {
+      cache.refill();
+    }
+    if(cache.head)
+    {
+      Node * node = cache.head;
+      cache.head = node->next;
+      cache.size--;
+      return reinterpret_cast<T*>(node);
+    }
+    return static_cast<T*>(::operator new(blockSize()));
+  }
+
+  void deallocate(T * p, std::size_t n)
+  {
+    if(n != 1)
+    {
+      ::operator delete(p);
+      return;
+    }
+    Cache & cache = getCache();
+    Node * node = reinterpret_cast<Node*>(p);
+    node->next = cache.head;
+    cache.head = node;
+    cache.size++;
+    if(cache.size > maxThreadCached)
+    {
+      cache.release(batchSize);
+    }
+  }
+
+  /** blocks kept in the shared list, for tests and statistics */
+  static std::size_t numShared()
+  {
+    Shared & shared = getShared();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    return shared.size;
+  }
+
+private:
+  struct Node
+  {
+    Node * next;
+  };
+
+  struct Shared
+  {
+    std::mutex mutex;
+    Node * head = nullptr;
+    std::size_t size = 0;
+  };
+
+  struct Cache
+  {
+    Node * head = nullptr;
+    std::size_t size = 0;
+
+    ~Cache()
+    {
+      release(size);
+    }
+
+    void refill()
+    {
+      Shared & shared = getShared();
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      for(std::size_t i = 0; i < batchSize && shared.head; i++)
+      {
+        Node * node = shared.head;
+        shared.head = node->next;
+        shared.size--;
+        node->next = head;
+        head = node;
+        size++;
+      }
+    }
+
+    void release(std::size_t n)
+    {
+      Shared & shared = getShared();
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      for(std::size_t i = 0; i < n && head; i++)
+      {
+        Node * node = head;
+        head = node->next;
+        size--;
+        if(shared.size < maxShared)
+        {
+          node->next = shared.head;
+          shared.head = node;
+          shared.size++;
+        }
+        else
+        {
+          ::operator delete(node);
+        }
+      }
+    }
+  };
+
+  static constexpr std::size_t blockSize()
+  {
+    return sizeof(T) < sizeof(Node) ? sizeof(Node) : sizeof(T);
+  }
+
+  static Shared & getShared()
+  {
+    // never destroyed, thread caches may be released after static
+    // destructors have run
+    static Shared * shared = new Shared();
+    return *shared;
+  }
+
+  static Cache & getCache()
+  {
+    static thread_local Cache cache;
+    return cache;
+  }
+};
+
+template<typename T, typename U>
+bool operator==(const TaskAllocator<T> &, const TaskAllocator<U> &)
+{
+  return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const TaskAllocator<T> &, const TaskAllocator<U> &)
+{
+  return false;
+}
@@ -0,0 +1,657 @@
+#include "task_queue.h"
+#include "task.h"
+#include <algorithm>
+
+const std::size_t TaskQueue::noWorker = std::size_t(-1);
+
+namespace
+{
+  /**
+   * Appends the ids of the tasks of a random access container, the
+   * offset is consumed by the entries that are skipped.
+   */
+  template<typename C, typename F>
+  void appendIds(const C & container, F taskOf, std::size_t & offset,
+                 std::size_t limit, std::vector<std::size_t> & ids)
+  {
+    if(offset >= container.size())
+    {
+      offset -= container.size();
+      return;
+    }
+    for(auto itr = container.begin() + offset;
+        itr != container.end() && ids.size() < limit; ++itr)
+    {
+      ids.push_back(taskOf(*itr)->getTaskId());
+    }
+    offset = 0;
+  }
+
+  inline const std::shared_ptr<Task> & taskOfPtr(const std::shared_ptr<Task> & task)
+  {
+    return task;
+  }
+}
+
+TaskQueue::TaskQueue() : count(0)
+{
+}
+
+TaskQueue::~TaskQueue()
+{
+}
+
+bool TaskQueue::tryPush(std::shared_ptr<Task> task, std::size_t worker)
+{
+  push(task, worker);
+  return true;
+}
+
+void TaskQueue::pushBulk(const std::vector<std::shared_ptr<Task> > & tasks,
+                         std::size_t worker)
+{
+  for(auto & task : tasks)
+  {
+    push(task, worker);
+  }
+}
+
+std::shared_ptr<Task> TaskQueue::popOldest()
+{
+  return pop(noWorker);
+}
+
+std::chrono::steady_clock::time_point TaskQueue::oldestTime() const
+{
+  return (empty() ? std::chrono::steady_clock::time_point::max() :
+          std::chrono::steady_clock::time_point::min());
+}
+
+std::size_t TaskQueue::capacity() const
+{
+  return 0u;
+}
+
+std::size_t TaskQueue::size() const
+{
+  return count.load();
+}
+
+std::vector<std::size_t> TaskQueue::getTaskIds(std::size_t offset,
+                                               std::size_t limit) const
+{
+  std::vector<std::size_t> ids;
+  appendIds(getTasks(), taskOfPtr, offset, limit, ids);
+  return ids;
+}
+
+bool TaskQueue::empty() const
+{
+  return count.load() == 0u;
+}
+
+/** FifoTaskQueue */
+void FifoTaskQueue::push(std::shared_ptr<Task> task, std::size_t worker)
+{
+  {
+    std::lock_guard<mutex_type> lock(mutex);
+    queue.push_back(task);
+  }
+  count++;
+}
+
+void FifoTaskQueue::pushBulk(const std::vector<std::shared_ptr<Task> > & tasks,
+                             std::size_t worker)
+{
+  {
+    std::lock_guard<mutex_type> lock(mutex);
+    queue.insert(queue.end(), tasks.begin(), tasks.end());
+  }
+  count += tasks.size();
+}
+
+std::shared_ptr<Task> FifoTaskQueue::pop(std::size_t worker)
+{
+  std::shared_ptr<Task> task;
+  {
+    std::lock_guard<mutex_type> lock(mutex);
+    if(queue.empty())
+    {
+      return task;
+    }
+    task = queue.front();
+    queue.pop_front();
+  }
+  count--;
+  return task;
+}
+
+std::chrono::steady_clock::time_point FifoTaskQueue::oldestTime() const
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  return (queue.empty() ? std::chrono::steady_clock::time_point::max() :
+          queue.front()->getReadyTime());
+}
+
+std::vector<std::shared_ptr<Task> > FifoTaskQueue::getTasks() const
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  return std::vector<std::shared_ptr<Task> >(queue.begin(), queue.end());
+}
+
+std::vector<std::size_t> FifoTaskQueue::getTaskIds(std::size_t offset,
+                                                   std::size_t limit) const
+{
+  std::vector<std::size_t> ids;
+  std::lock_guard<mutex_type> lock(mutex);
+  appendIds(queue, taskOfPtr, offset, limit, ids);
+  return ids;
+}
+
+/** WorkStealingTaskQueue */
+WorkStealingTaskQueue::WorkStealingTaskQueue(std::size_t n)
+{
+  for(std::size_t i = 0; i < n; i++)
+  {
+    workers.push_back(std::unique_ptr<WorkerDeque>(new WorkerDeque()));
+  }
+}
+
+void WorkStealingTaskQueue::push(std::shared_ptr<Task> task, std::size_t worker)
+{
+  WorkerDeque & target = (worker < workers.size() ? *workers[worker] : injection);
+  {
+    std::lock_guard<mutex_type> lock(target.mutex);
+    target.deque.push_back(task);
+  }
+  count++;
+}
+
+void WorkStealingTaskQueue::pushBulk(const std::vector<std::shared_ptr<Task> > & tasks,
+                                     std::size_t worker)
+{
+  WorkerDeque & target = (worker < workers.size() ? *workers[worker] : injection);
+  {
+    std::lock_guard<mutex_type> lock(target.mutex);
+    target.deque.insert(target.deque.end(), tasks.begin(), tasks.end());
+  }
+  count += tasks.size();
+}
+
+std::shared_ptr<Task> WorkStealingTaskQueue::pop(std::size_t worker)
+{
+  std::shared_ptr<Task> task;
+  if(worker < workers.size())
+  {
+    WorkerDeque & own = *workers[worker];
+    std::lock_guard<mutex_type> lock(own.mutex);
+    if(!own.deque.empty())
+    {
+      task = own.deque.back();
+      own.deque.pop_back();
+    }
+  }
+  if(!task)
+  {
+    task = popInjected();
+  }
+  if(!task)
+  {
+    task = steal(worker);
+  }
+  if(task)
+  {
+    count--;
+  }
+  return task;
+}
+
+std::shared_ptr<Task> WorkStealingTaskQueue::popInjected()
+{
+  std::shared_ptr<Task> task;
+  std::lock_guard<mutex_type> lock(injection.mutex);
+  if(!injection.deque.empty())
+  {
+    task = injection.deque.front();
+    injection.deque.pop_front();
+  }
+  return task;
+}
+
+std::shared_ptr<Task> WorkStealingTaskQueue::steal(std::size_t worker)
+{
+  std::shared_ptr<Task> task;
+  std::size_t n = workers.size();
+  std::size_t start = (worker < n ? worker + 1 : 0);
+  for(std::size_t i = 0; i < n && !task; i++)
+  {
+    WorkerDeque & victim = *workers[(start + i) % n];
+    std::lock_guard<mutex_type> lock(victim.mutex);
+    if(!victim.deque.empty())
+    {
+      task = victim.deque.front();
+      victim.deque.pop_front();
+    }
+  }
+  return task;
+}
+
+std::chrono::steady_clock::time_point WorkStealingTaskQueue::oldestTime() const
+{
+  // pop(noWorker) takes injected tasks first, then steals from the fronts
+  {
+    std::lock_guard<mutex_type> lock(injection.mutex);
+    if(!injection.deque.empty())
+    {
+      return injection.deque.front()->getReadyTime();
+    }
+  }
+  auto oldest = std::chrono::steady_clock::time_point::max();
+  for(auto & w : workers)
+  {
+    std::lock_guard<mutex_type> lock(w->mutex);
+    if(!w->deque.empty())
+    {
+      oldest = std::min(oldest, w->deque.front()->getReadyTime());
+    }
+  }
+  return oldest;
+}
+
+std::vector<std::shared_ptr<Task> > WorkStealingTaskQueue::getTasks() const
+{
+  std::vector<std::shared_ptr<Task> > ret;
+  {
+    std::lock_guard<mutex_type> lock(injection.mutex);
+    ret.insert(ret.end(), injection.deque.begin(), injection.deque.end());
+  }
+  for(auto & w : workers)
+  {
+    std::lock_guard<mutex_type> lock(w->mutex);
+    ret.insert(ret.end(), w->deque.begin(), w->deque.end());
+  }
+  return ret;
+}
+
+std::vector<std::size_t> WorkStealingTaskQueue::getTaskIds(std::size_t offset,
+                                                           std::size_t limit) const
+{
+  std::vector<std::size_t> ids;
+  {
+    std::lock_guard<mutex_type> lock(injection.mutex);
+    appendIds(injection.deque, taskOfPtr, offset, limit, ids);
+  }
+  for(auto & w : workers)
+  {
+    if(ids.size() >= limit)
+    {
+      break;
+    }
+    std::lock_guard<mutex_type> lock(w->mutex);
+    appendIds(w->deque, taskOfPtr, offset, limit, ids);
+  }
+  return ids;
+}
+
+/** RingTaskQueue */
+RingTaskQueue::RingTaskQueue(std::size_t capacity) : ring(capacity), overflowCount(0)
+{
+}
+
+void RingTaskQueue::push(std::shared_ptr<Task> task, std::size_t worker)
+{
+  // tasks wait behind the ones that overflowed before them
+  if(overflowCount == 0 && ring.tryPush(std::move(task)))
+  {
+    count++;
+    return;
+  }
+  {
+    std::lock_guard<mutex_type> lock(overflowMutex);
+    overflow.push_back(std::move(task));
+    overflowCount++;
+  }
+  count++;
+}
+
+bool RingTaskQueue::tryPush(std::shared_ptr<Task> task, std::size_t worker)
+{
+  // like push, never ahead of tasks that overflowed
+  if(overflowCount == 0 && ring.tryPush(std::move(task)))
+  {
+    count++;
+    return true;
+  }
+  return false;
+}
+
+std::shared_ptr<Task> RingTaskQueue::pop(std::size_t worker)
+{
+  std::shared_ptr<Task> task;
+  if(ring.tryPop(task))
+  {
+    count--;
+    return task;
+  }
+  if(overflowCount != 0)
+  {
+    std::lock_guard<mutex_type> lock(overflowMutex);
+    if(!overflow.empty())
+    {
+      task = std::move(overflow.front());
+      overflow.pop_front();
+      overflowCount--;
+      count--;
+    }
+  }
+  return task;
+}
+
+std::vector<std::shared_ptr<Task> > RingTaskQueue::getTasks() const
+{
+  return std::vector<std::shared_ptr<Task> >();
+}
+
+std::size_t RingTaskQueue::capacity() const
+{
+  return ring.capacity();
+}
+
+/** PriorityTaskQueue */
+PriorityTaskQueue::PriorityTaskQueue(clock_type::duration interval)
+  : levels(Task::numPriorities), agingInterval(interval)
+{
+}
+
+void PriorityTaskQueue::push(std::shared_ptr<Task> task, std::size_t worker)
+{
+  auto now = clock_type::now();
+  {
+    std::lock_guard<mutex_type> lock(mutex);
+    levels[(unsigned int)task->getPriority()].push_back(entry_type(now, task));
+  }
+  count++;
+}
+
+void PriorityTaskQueue::pushBulk(const std::vector<std::shared_ptr<Task> > & tasks,
+                                 std::size_t worker)
+{
+  auto now = clock_type::now();
+  {
+    std::lock_guard<mutex_type> lock(mutex);
+    for(auto & task : tasks)
+    {
+      levels[(unsigned int)task->getPriority()].push_back(entry_type(now, task));
+    }
+  }
+  count += tasks.size();
+}
+
+std::shared_ptr<Task> PriorityTaskQueue::pop(std::size_t worker)
+{
+  auto now = clock_type::now();
+  std::shared_ptr<Task> task;
+  {
+    std::lock_guard<mutex_type> lock(mutex);
+    std::size_t best = levels.size();
+    double bestPriority = 0.0;
+    // the front of each level is its oldest task; ties go to the higher level
+    for(std::size_t level = levels.size(); level-- > 0; )
+    {
+      if(!levels[level].empty())
+      {
+        double p = double(level);
+        if(agingInterval.count() > 0)
+        {
+          p += (double((now - levels[level].front().first).count()) /
+                double(agingInterval.count()));
+        }
+        if(best == levels.size() || p > bestPriority)
+        {
+          best = level;
+          bestPriority = p;
+        }
+      }
+    }
+    if(best == levels.size())
+    {
+      return task;
+    }
+    task = levels[best].front().second;
+    levels[best].pop_front();
+  }
+  count--;
+  return task;
+}
+
+std::shared_ptr<Task> PriorityTaskQueue::popOldest()
+{
+  std::shared_ptr<Task> task;
+  {
+    std::lock_guard<mutex_type> lock(mutex);
+    std::size_t oldest = levels.size();
+    for(std::size_t level = 0; level < levels.size(); level++)
+    {
+      if(!levels[level].empty() &&
+         (oldest == levels.size() ||
+          levels[level].front().first < levels[oldest].front().first))
+      {
+        oldest = level;
+      }
+    }
+    if(oldest == levels.size())
+    {
+      return task;
+    }
+    task = levels[oldest].front().second;
+    levels[oldest].pop_front();
+  }
+  count--;
+  return task;
+}
+
+PriorityTaskQueue::clock_type::time_point PriorityTaskQueue::oldestTime() const
+{
+  auto oldest = clock_type::time_point::max();
+  std::lock_guard<mutex_type> lock(mutex);
+  for(auto & level : levels)
+  {
+    if(!level.empty())
+    {
+      oldest = std::min(oldest, level.front().first);
+    }
+  }
+  return oldest;
+}
+
+std::vector<std::shared_ptr<Task> > PriorityTaskQueue::getTasks() const
+{
+  std::vector<std::shared_ptr<Task> > ret;
+  std::lock_guard<mutex_type> lock(mutex);
+  for(std::size_t level = levels.size(); level-- > 0; )
+  {
+    for(auto & entry : levels[level])
+    {
+      ret.push_back(entry.second);
+    }
+  }
+  return ret;
+}
+
+std::vector<std::size_t> PriorityTaskQueue::getTaskIds(std::size_t offset,
+                                                       std::size_t limit) const
+{
+  std::vector<std::size_t> ids;
+  std::lock_guard<mutex_type> lock(mutex);
+  for(std::size_t level = levels.size(); level-- > 0 && ids.size() < limit; )
+  {
+    appendIds(levels[level],
+              [](const entry_type & entry) -> const std::shared_ptr<Task> &
+              {
+                return entry.second;
+              },
+              offset, limit, ids);
+  }
+  return ids;
+}
+
+PriorityTaskQueue::clock_type::duration PriorityTaskQueue::getAgingInterval() const
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  return agingInterval;
+}
+
+void PriorityTaskQueue::setAgingInterval(clock_type::duration interval)
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  agingInterval = interval;
+}
+
+/** NumaTaskQueue */
+NumaTaskQueue::NumaTaskQueue(std::vector<std::unique_ptr<TaskQueue> > && _nodes,
+                             const std::vector<std::size_t> & _workerNode)
+  : nodes(std::move(_nodes)), workerNode(_workerNode), nextNode(0)
+{
+}
+
+std::size_t NumaTaskQueue::nodeOf(std::size_t worker)
+{
+  if(worker < workerNode.size())
+  {
+    return workerNode[worker];
+  }
+  return nextNode++ % nodes.size();
+}
+
+void NumaTaskQueue::push(std::shared_ptr<Task> task, std::size_t worker)
+{
+  nodes[nodeOf(worker)]->push(task, worker);
+  count++;
+}
+
+bool NumaTaskQueue::tryPush(std::shared_ptr<Task> task, std::size_t worker)
+{
+  if(nodes[nodeOf(worker)]->tryPush(task, worker))
+  {
+    count++;
+    return true;
+  }
+  return false;
+}
+
+void NumaTaskQueue::pushBulk(const std::vector<std::shared_ptr<Task> > & tasks,
+                             std::size_t worker)
+{
+  nodes[nodeOf(worker)]->pushBulk(tasks, worker);
+  count += tasks.size();
+}
+
+std::shared_ptr<Task> NumaTaskQueue::pop(std::size_t worker)
+{
+  std::shared_ptr<Task> task;
+  std::size_t n = nodes.size();
+  std::size_t start = (worker < workerNode.size() ? workerNode[worker] : 0);
+  for(std::size_t i = 0; i < n && !task; i++)
+  {
+    task = nodes[(start + i) % n]->pop(worker);
+  }
+  if(task)
+  {
+    count--;
+  }
+  return task;
+}
+
+std::shared_ptr<Task> NumaTaskQueue::popOldest()
+{
+  // nodes by the age of their oldest task; a node emptied by a worker
+  // meanwhile is skipped
+  std::vector<std::pair<std::chrono::steady_clock::time_point, std::size_t> > order;
+  for(std::size_t node = 0; node < nodes.size(); node++)
+  {
+    auto time = nodes[node]->oldestTime();
+    if(time != std::chrono::steady_clock::time_point::max())
+    {
+      order.push_back(std::make_pair(time, node));
+    }
+  }
+  std::sort(order.begin(), order.end());
+  for(auto & entry : order)
+  {
+    if(auto task = nodes[entry.second]->popOldest())
+    {
+      count--;
+      return task;
+    }
+  }
+  return std::shared_ptr<Task>();
+}
+
+std::chrono::steady_clock::time_point NumaTaskQueue::oldestTime() const
+{
+  auto oldest = std::chrono::steady_clock::time_point::max();
+  for(auto & node : nodes)
+  {
+    oldest = std::min(oldest, node->oldestTime());
+  }
+  return oldest;
+}
+
+std::vector<std::shared_ptr<Task> > NumaTaskQueue::getTasks() const
+{
+  std::vector<std::shared_ptr<Task> > ret;
+  for(auto & node : nodes)
+  {
+    auto tasks = node->getTasks();
+    ret.insert(ret.end(), tasks.begin(), tasks.end());
+  }
+  return ret;
+}
+
+std::vector<std::size_t> NumaTaskQueue::getTaskIds(std::size_t offset,
+                                                   std::size_t limit) const
+{
+  std::vector<std::size_t> ids;
+  for(auto & node : nodes)
+  {
+    if(ids.size() >= limit)
+    {
+      break;
+    }
+    // whole nodes are skipped by their size, without copying them
+    std::size_t n = node->size();
+    if(offset >= n)
+    {
+      offset -= n;
+      continue;
+    }
+    auto page = node->getTaskIds(offset, limit - ids.size());
+    ids.insert(ids.end(), page.begin(), page.end());
+    offset = 0;
+  }
+  return ids;
+}
+
+std::size_t NumaTaskQueue::capacity() const
+{
+  std::size_t ret = 0;
+  for(auto & node : nodes)
+  {
+    if(node->capacity() == 0)
+    {
+      return 0u;
+    }
+    ret += node->capacity();
+  }
+  return ret;
+}
+
+std::size_t NumaTaskQueue::numNodes() const
+{
+  return nodes.size();
+}
+
+TaskQueue & NumaTaskQueue::getNode(std::size_t node)
+{
+  return *nodes[node];
+}
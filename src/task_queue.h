@@ -0,0 +1,211 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "mpmc_ring.h"
+
+class Task;
+
+/**
+ * Ready queue of a ThreadPool.
+ * Implementations are internally synchronized, so workers can push and
+ * pop without holding the mutex of the pool.
+ */
+class TaskQueue
+{
+public:
+  /** worker index used for submissions from threads outside the pool */
+  static const std::size_t noWorker;
+
+  virtual ~TaskQueue();
+  virtual void push(std::shared_ptr<Task> task, std::size_t worker) = 0;
+  /** push without blocking, false if the queue is full */
+  virtual bool tryPush(std::shared_ptr<Task> task, std::size_t worker);
+  /** push a batch of tasks, taking the lock only once */
+  virtual void pushBulk(const std::vector<std::shared_ptr<Task> > & tasks,
+                        std::size_t worker);
+  virtual std::shared_ptr<Task> pop(std::size_t worker) = 0;
+  /** the task queued first, as far as the queue keeps track */
+  virtual std::shared_ptr<Task> popOldest();
+  /**
+   * when the task popOldest() returns was queued, time_point::max() if
+   * the queue is empty and time_point::min() if it does not keep track
+   */
+  virtual std::chrono::steady_clock::time_point oldestTime() const;
+  virtual std::vector<std::shared_ptr<Task> > getTasks() const = 0;
+  /**
+   * Ids of at most limit queued tasks, skipping the first offset ones in
+   * the order of getTasks(). Copies only the ids, so a page is cheap even
+   * if the queue is long; pages taken while workers run may overlap or
+   * miss tasks that moved in between.
+   */
+  virtual std::vector<std::size_t> getTaskIds(std::size_t offset,
+                                              std::size_t limit) const;
+  /** maximum number of queued tasks, 0 if unbounded */
+  virtual std::size_t capacity() const;
+
+  std::size_t size() const;
+  bool empty() const;
+
+protected:
+  TaskQueue();
+  std::atomic<std::size_t> count;
+};
+
+/**
+ * Single FIFO queue shared by all workers.
+ */
+class FifoTaskQueue : public TaskQueue
+{
+public:
+  void push(std::shared_ptr<Task> task, std::size_t worker) override;
+  void pushBulk(const std::vector<std::shared_ptr<Task> > & tasks,
+                std::size_t worker) override;
+  std::shared_ptr<Task> pop(std::size_t worker) override;
+  std::chrono::steady_clock::time_point oldestTime() const override;
+  std::vector<std::shared_ptr<Task> > getTasks() const override;
+  std::vector<std::size_t> getTaskIds(std::size_t offset,
+                                      std::size_t limit) const override;
+
+private:
+  typedef std::mutex mutex_type;
+  mutable mutex_type mutex;
+  std::deque<std::shared_ptr<Task> > queue;
+};
+
+/**
+ * One deque per worker plus a shared injection queue.
+ * A worker pushes to and pops from the back of its own deque (LIFO),
+ * external submissions go to the injection queue and idle workers
+ * steal from the front of the deques of their peers (FIFO).
+ */
+class WorkStealingTaskQueue : public TaskQueue
+{
+public:
+  WorkStealingTaskQueue(std::size_t n);
+  void push(std::shared_ptr<Task> task, std::size_t worker) override;
+  void pushBulk(const std::vector<std::shared_ptr<Task> > & tasks,
+                std::size_t worker) override;
+  std::shared_ptr<Task> pop(std::size_t worker) override;
+  std::chrono::steady_clock::time_point oldestTime() const override;
+  std::vector<std::shared_ptr<Task> > getTasks() const override;
+  std::vector<std::size_t> getTaskIds(std::size_t offset,
+                                      std::size_t limit) const override;
+
+private:
+  typedef std::mutex mutex_type;
+  struct WorkerDeque
+  {
+    mutable mutex_type mutex;
+    std::deque<std::shared_ptr<Task> > deque;
+  };
+
+  std::shared_ptr<Task> popInjected();
+  std::shared_ptr<Task> steal(std::size_t worker);
+
+  WorkerDeque injection;
+  std::vector<std::unique_ptr<WorkerDeque> > workers;
+};
+
+/**
+ * Fixed capacity lock-free ring shared by all workers.
+ * tryPush fails while the ring is full or the list below holds tasks,
+ * so it never overtakes them. push never waits: it moves on
+ * to an unbounded list under a mutex, and keeps using the list until
+ * the workers have drained it, so a full ring cannot deadlock a worker
+ * that submits to its own pool or a pool that is not activated yet.
+ * The ring cannot be inspected while workers are running, so getTasks
+ * and getTaskIds return empty lists; size() stays exact.
+ */
+class RingTaskQueue : public TaskQueue
+{
+public:
+  RingTaskQueue(std::size_t capacity);
+  void push(std::shared_ptr<Task> task, std::size_t worker) override;
+  bool tryPush(std::shared_ptr<Task> task, std::size_t worker) override;
+  std::shared_ptr<Task> pop(std::size_t worker) override;
+  std::vector<std::shared_ptr<Task> > getTasks() const override;
+  std::size_t capacity() const override;
+
+private:
+  typedef std::mutex mutex_type;
+
+  MpmcRing<std::shared_ptr<Task> > ring;
+  mutex_type overflowMutex;
+  std::deque<std::shared_ptr<Task> > overflow;
+  // size of overflow, read without the mutex
+  std::atomic<std::size_t> overflowCount;
+};
+
+/**
+ * One FIFO per Task::Priority level.
+ * A queued task gains one priority level per aging interval, and pop
+ * takes the oldest task of the level with the highest effective
+ * priority, so low priority work cannot starve.
+ * An aging interval of zero disables aging.
+ */
+class PriorityTaskQueue : public TaskQueue
+{
+public:
+  typedef std::chrono::steady_clock clock_type;
+
+  PriorityTaskQueue(clock_type::duration agingInterval);
+  void push(std::shared_ptr<Task> task, std::size_t worker) override;
+  void pushBulk(const std::vector<std::shared_ptr<Task> > & tasks,
+                std::size_t worker) override;
+  std::shared_ptr<Task> pop(std::size_t worker) override;
+  std::shared_ptr<Task> popOldest() override;
+  clock_type::time_point oldestTime() const override;
+  std::vector<std::shared_ptr<Task> > getTasks() const override;
+  std::vector<std::size_t> getTaskIds(std::size_t offset,
+                                      std::size_t limit) const override;
+
+  clock_type::duration getAgingInterval() const;
+  void setAgingInterval(clock_type::duration interval);
+
+private:
+  typedef std::mutex mutex_type;
+  typedef std::pair<clock_type::time_point, std::shared_ptr<Task> > entry_type;
+
+  mutable mutex_type mutex;
+  std::vector<std::deque<entry_type> > levels;
+  clock_type::duration agingInterval;
+};
+
+/**
+ * One queue per NUMA node.
+ * Workers push to and pop from the queue of their node and only take
+ * tasks from other nodes when their own node has none. Submissions
+ * from outside the pool are spread round robin over the nodes.
+ */
+class NumaTaskQueue : public TaskQueue
+{
+public:
+  NumaTaskQueue(std::vector<std::unique_ptr<TaskQueue> > && nodes,
+                const std::vector<std::size_t> & workerNode);
+  void push(std::shared_ptr<Task> task, std::size_t worker) override;
+  bool tryPush(std::shared_ptr<Task> task, std::size_t worker) override;
+  void pushBulk(const std::vector<std::shared_ptr<Task> > & tasks,
+                std::size_t worker) override;
+  std::shared_ptr<Task> pop(std::size_t worker) override;
+  /** the oldest task of the node that has the oldest one */
+  std::shared_ptr<Task> popOldest() override;
+  std::chrono::steady_clock::time_point oldestTime() const override;
+  std::vector<std::shared_ptr<Task> > getTasks() const override;
+  std::vector<std::size_t> getTaskIds(std::size_t offset,
+                                      std::size_t limit) const override;
+  std::size_t capacity() const override;
+
+  std::size_t numNodes() const;
+  TaskQueue & getNode(std::size_t node);
+
+private:
+  std::size_t nodeOf(std::size_t worker);
+
+  std::vector<std::unique_ptr<TaskQueue> > nodes;
+  std::vector<std::size_t> workerNode;
+  std::atomic<std::size_t> nextNode;
+};
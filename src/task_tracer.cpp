@@ -0,0 +1,187 @@
+#include "task_tracer.h"
+#include "task.h"
+#include <algorithm>
+#include <iomanip>
+
+const std::size_t TaskTracer::defaultCapacity = 65536u;
+
+TaskTracer::Ring::Ring(std::size_t capacity)
+  : head(0), first(0), slots(new Slot[capacity])
+{
+  for(std::size_t i = 0; i < capacity; i++)
+  {
+    slots[i].sequence.store(0, std::memory_order_relaxed);
+  }
+}
+
+TaskTracer::TaskTracer(std::size_t numWorkers, std::size_t capacity)
+  : epoch(clock_type::now()), recording(false)
+{
+  std::size_t n = 2;
+  while(n < capacity)
+  {
+    n <<= 1;
+  }
+  mask = n - 1;
+  // one ring per worker plus the shared one
+  for(std::size_t i = 0; i <= numWorkers; i++)
+  {
+    rings.push_back(std::unique_ptr<Ring>(new Ring(n)));
+  }
+}
+
+void TaskTracer::start()
+{
+  for(auto & ring : rings)
+  {
+    ring->first.store(ring->head.load());
+  }
+  recording = true;
+}
+
+void TaskTracer::stop()
+{
+  recording = false;
+}
+
+void TaskTracer::record(std::size_t worker, Kind kind, std::size_t taskId,
+                        clock_type::time_point begin, clock_type::time_point end)
+{
+  Ring & ring = *rings[std::min(worker, rings.size() - 1)];
+  std::uint64_t i = ring.head.fetch_add(1, std::memory_order_relaxed);
+  Slot & slot = ring.slots[i & mask];
+  // odd while written, 2 * (i + 1) once span i is complete
+  slot.sequence.store(2 * i + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.kind.store((unsigned int)kind, std::memory_order_relaxed);
+  slot.taskId.store(taskId, std::memory_order_relaxed);
+  slot.begin.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     begin - epoch).count(), std::memory_order_relaxed);
+  slot.end.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   end - epoch).count(), std::memory_order_relaxed);
+  slot.sequence.store(2 * i + 2, std::memory_order_release);
+}
+
+std::size_t TaskTracer::numSpans() const
+{
+  std::size_t ret = 0;
+  for(auto & ring : rings)
+  {
+    std::uint64_t n = ring->head.load() - ring->first.load();
+    ret += std::size_t(std::min<std::uint64_t>(n, mask + 1));
+  }
+  return ret;
+}
+
+std::vector<TaskTracer::Span> TaskTracer::collect() const
+{
+  std::vector<Span> spans;
+  for(std::size_t r = 0; r < rings.size(); r++)
+  {
+    const Ring & ring = *rings[r];
+    std::uint64_t head = ring.head.load();
+    std::uint64_t i = ring.first.load();
+    if(head - i > mask + 1)
+    {
+      i = head - (mask + 1);
+    }
+    for(; i < head; i++)
+    {
+      const Slot & slot = ring.slots[i & mask];
+      std::uint64_t seq = slot.sequence.load(std::memory_order_acquire);
+      if(seq != 2 * i + 2)
+      {
+        // still being written or already overwritten
+        continue;
+      }
+      Span span;
+      span.thread = r;
+      span.kind = Kind(slot.kind.load(std::memory_order_relaxed));
+      span.taskId = slot.taskId.load(std::memory_order_relaxed);
+      span.begin = slot.begin.load(std::memory_order_relaxed);
+      span.end = slot.end.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if(slot.sequence.load(std::memory_order_relaxed) == seq)
+      {
+        spans.push_back(span);
+      }
+    }
+  }
+  std::stable_sort(spans.begin(), spans.end(),
+                   [](const Span & a, const Span & b) {
+                     return a.begin < b.begin;
+                   });
+  return spans;
+}
+
+std::string TaskTracer::kindToString(Kind kind)
+{
+  switch(kind)
+  {
+  case Kind::QueueWait: return "queue wait";
+  case Kind::Run: return "run";
+  case Kind::Observers: return "observers";
+  case Kind::LockWait: return "lock wait";
+  default: return "";
+  }
+}
+
+// trace-event timestamps are microseconds
+static void writeMicroseconds(std::ostream & os, std::int64_t ns)
+{
+  ns = std::max<std::int64_t>(ns, 0);
+  os << ns / 1000 << "." << std::setw(3) << std::setfill('0') << ns % 1000
+     << std::setfill(' ');
+}
+
+void TaskTracer::write(std::ostream & os) const
+{
+  auto spans = collect();
+  std::size_t external = rings.size() - 1;
+  os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  for(std::size_t t = 0; t < rings.size(); t++)
+  {
+    os << (t ? ",\n" : "\n")
+       << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+       << ",\"args\":{\"name\":\"";
+    if(t == external)
+    {
+      os << "external";
+    }
+    else
+    {
+      os << "worker " << t;
+    }
+    os << "\"}}";
+  }
+  for(auto & span : spans)
+  {
+    bool hasTask = (span.taskId != Task::undefinedTaskId);
+    if(span.kind == Kind::QueueWait)
+    {
+      // overlaps the runs of the worker, so it gets an async track
+      for(int phase = 0; phase < 2; phase++)
+      {
+        os << ",\n{\"name\":\"" << kindToString(span.kind)
+           << "\",\"cat\":\"task\",\"ph\":\"" << (phase ? "e" : "b")
+           << "\",\"id\":" << span.taskId
+           << ",\"pid\":1,\"tid\":" << span.thread << ",\"ts\":";
+        writeMicroseconds(os, phase ? span.end : span.begin);
+        os << "}";
+      }
+      continue;
+    }
+    os << ",\n{\"name\":\"" << kindToString(span.kind)
+       << "\",\"cat\":\"" << (hasTask ? "task" : "pool")
+       << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.thread << ",\"ts\":";
+    writeMicroseconds(os, span.begin);
+    os << ",\"dur\":";
+    writeMicroseconds(os, std::max<std::int64_t>(span.end - span.begin, 0));
+    if(hasTask)
+    {
+      os << ",\"args\":{\"taskId\":" << span.taskId << "}";
+    }
+    os << "}";
+  }
+  os << "\n]}\n";
+}
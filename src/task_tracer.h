@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+/**
+ * Records timestamped spans of the workers of a ThreadPool and writes
+ * them as Chrome trace-event JSON (chrome://tracing, Perfetto).
+ * Every worker records into its own ring, threads outside the pool
+ * share one more ring. Rings keep the latest spans and overwrite the
+ * oldest; recording never blocks and never allocates. A slot carries a
+ * sequence number, so a concurrent write() skips slots that are being
+ * overwritten instead of reading torn spans.
+ */
+class TaskTracer
+{
+public:
+  typedef std::chrono::steady_clock clock_type;
+
+  enum class Kind : unsigned int
+  {
+    QueueWait          = 1,  // Ready -> Running
+    Run                = 2,  // the function of the task
+    Observers          = 4,  // state change observers of a task
+    LockWait           = 8   // blocked on the mutex of the pool
+  };
+
+  /** spans per ring */
+  static const std::size_t defaultCapacity;
+
+  TaskTracer(std::size_t numWorkers, std::size_t capacity);
+
+  /** drops the spans recorded so far and starts recording */
+  void start();
+  void stop();
+  bool isRecording() const
+  {
+    return recording.load(std::memory_order_relaxed);
+  }
+
+  /** worker beyond the workers of the pool selects the shared ring */
+  void record(std::size_t worker, Kind kind, std::size_t taskId,
+              clock_type::time_point begin, clock_type::time_point end);
+  /** spans since start(), at most the capacity of each ring */
+  std::size_t numSpans() const;
+  void write(std::ostream & os) const;
+
+  static std::string kindToString(Kind kind);
+
+private:
+  static const std::size_t cacheLine = 64;
+
+  struct Span
+  {
+    std::size_t thread;
+    Kind kind;
+    std::size_t taskId;
+    std::int64_t begin;
+    std::int64_t end;
+  };
+
+  struct Slot
+  {
+    std::atomic<std::uint64_t> sequence;
+    std::atomic<unsigned int> kind;
+    std::atomic<std::size_t> taskId;
+    std::atomic<std::int64_t> begin;
+    std::atomic<std::int64_t> end;
+  };
+
+  struct Ring
+  {
+    Ring(std::size_t capacity);
+
+    char pad0[cacheLine];
+    std::atomic<std::uint64_t> head;
+    // spans before first belong to an earlier recording
+    std::atomic<std::uint64_t> first;
+    std::unique_ptr<Slot[]> slots;
+    char pad1[cacheLine];
+  };
+
+  std::vector<Span> collect() const;
+
+  std::vector<std::unique_ptr<Ring> > rings;
+  std::size_t mask;
+  clock_type::time_point epoch;
+  std::atomic<bool> recording;
+};
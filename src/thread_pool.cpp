@@ -1,11 +1,83 @@
 #include "thread_pool.h"
 #include "task.h"
+#include <algorithm>
 #include <iostream>
 #include <chrono>
 
-std::shared_ptr<ThreadPool> ThreadPool::create(std::size_t n)
+// worker of the pool that the current thread belongs to
+static thread_local ThreadPool * currentPool = nullptr;
+static thread_local std::size_t currentWorkerId = std::size_t(-1);
+
+namespace
+{
+  // marks a submission that may race with terminate()
+  class SubmissionGuard
+  {
+  public:
+    SubmissionGuard(std::atomic<std::size_t> & _counter) : counter(_counter)
+    {
+      counter++;
+    }
+
+    ~SubmissionGuard()
+    {
+      counter--;
+    }
+
+  private:
+    std::atomic<std::size_t> & counter;
+  };
+
+  /** hint to the CPU that we are spinning */
+  inline void cpuRelax()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+  }
+}
+
+// position of the bit of a state
+static unsigned int stateIndex(unsigned int bits)
+{
+  unsigned int index = 0;
+  for(; bits > 1u; bits >>= 1)
+  {
+    index++;
+  }
+  return index;
+}
+
+const std::size_t ThreadPool::defaultRingCapacity = 1024u;
+const std::chrono::milliseconds ThreadPool::defaultAgingInterval(1000);
+const std::chrono::milliseconds ThreadPool::defaultKeepAlive(10000);
+const std::chrono::milliseconds ThreadPool::defaultGrowQueueWait(10);
+const std::chrono::microseconds ThreadPool::helpPollInterval(500);
+const std::chrono::milliseconds ThreadPool::timerResolution(1);
+const std::size_t ThreadPool::defaultSpinCount = 4000u;
+
+std::shared_ptr<ThreadPool> ThreadPool::create(std::size_t n,
+                                               Scheduler scheduler,
+                                               std::size_t capacity)
+{
+  return std::shared_ptr<ThreadPool>(new ThreadPool(n, n, scheduler, capacity));
+}
+
+std::shared_ptr<ThreadPool> ThreadPool::createElastic(std::size_t minThreads,
+                                                      std::size_t maxThreads,
+                                                      Scheduler scheduler,
+                                                      std::size_t capacity)
 {
-  return std::shared_ptr<ThreadPool>(new ThreadPool(n));
+  if(maxThreads == 0 || minThreads > maxThreads)
+  {
+    throw std::logic_error("Invalid elastic ThreadPool bounds");
+  }
+  return std::shared_ptr<ThreadPool>(new ThreadPool(minThreads, maxThreads,
+                                                    scheduler, capacity));
 }
 
 std::string ThreadPool::stateToString(State s)
@@ -19,16 +91,76 @@ std::string ThreadPool::stateToString(State s)
   };
 }
 
-ThreadPool::ThreadPool(std::size_t n)
+ThreadPool::ThreadPool(std::size_t _minThreads, std::size_t _maxThreads,
+                       Scheduler _scheduler, std::size_t capacity)
 {
   std::lock_guard<mutex_type> main_lock(mutex);
   state = State::Waiting;
-  threadPoolSize = n;
-  numDone = 0;
-  numFailed = 0;
+  scheduler = _scheduler;
+  queueCapacity = capacity;
+  affinity = Affinity::None;
+  agingInterval = defaultAgingInterval;
+  taskQueue.reset(createTaskQueue(scheduler, _maxThreads, capacity, agingInterval));
+  minThreads = _minThreads;
+  maxThreads = _maxThreads;
+  numThreads = _minThreads;
+  growQueueDepth = 1;
+  growQueueWait = defaultGrowQueueWait;
+  keepAlive = defaultKeepAlive;
+  threads.resize(_maxThreads);
+  workerActive.reset(new std::atomic<bool>[_maxThreads]);
+  for(std::size_t id = 0; id < _maxThreads; id++)
+  {
+    workerActive[id] = (id < _minThreads);
+  }
+  numIdle = 0;
+  waitStrategy = WaitStrategy::Block;
+  spinCount = defaultSpinCount;
+  parkers.reset(new Parker[_maxThreads]);
+  for(std::size_t id = 0; id < _maxThreads; id++)
+  {
+    parkers[id].notified = false;
+  }
+  idleWorkers.reserve(_maxThreads);
+  numSubmitting = 0;
+  numWaiting = 0;
+  numReady = 0;
+  numCanceled = 0;
+  workerStats.reset(new WorkerStats[_maxThreads + 1]);
+  maxQueueDepth = 0;
+  overflow = Overflow::Block;
+  numBlocked = 0;
+  numRejected = 0;
+  numDropped = 0;
+  numCallerRuns = 0;
   taskCounter = 0;
+  timerCount = 0;
+  timerDeadline = std::chrono::steady_clock::time_point::max().time_since_epoch().count();
+  discardTime = std::chrono::steady_clock::duration::max().count();
+  numExited = 0;
+  unrunCollected = false;
   mainThreadId = std::this_thread::get_id();
-  tasksInThreads.resize(n);
+  tasksInThreads.resize(_maxThreads);
+  workerSlots.reset(new WorkerSlot[_maxThreads]);
+  frameAllocator = std::make_shared<FrameAllocator>();
+}
+
+TaskQueue * ThreadPool::createTaskQueue(Scheduler scheduler,
+                                        std::size_t numWorkers,
+                                        std::size_t capacity,
+                                        std::chrono::steady_clock::duration agingInterval)
+{
+  switch(scheduler)
+  {
+  case Scheduler::WorkStealing:
+    return new WorkStealingTaskQueue(numWorkers);
+  case Scheduler::LockFreeRing:
+    return new RingTaskQueue(capacity ? capacity : defaultRingCapacity);
+  case Scheduler::Priority:
+    return new PriorityTaskQueue(agingInterval);
+  default:
+    return new FifoTaskQueue();
+  }
 }
 
 ThreadPool::~ThreadPool()
@@ -36,7 +168,15 @@ ThreadPool::~ThreadPool()
   condition.notify_all();
   for(auto & t : threads)
   {
-    t.join();
+    if(t.get_id() == std::this_thread::get_id())
+    {
+      // a retired worker released the last reference
+      t.detach();
+    }
+    else if(t.joinable())
+    {
+      t.join();
+    }
   }
   threads.clear();
 }
@@ -47,17 +187,24 @@ void ThreadPool::activate()
   {
     if(mainThreadId == std::this_thread::get_id())
     {
-      auto self = shared_from_this();
       {
         std::unique_lock<mutex_type> lock(mutex);
         state = State::Active;
-	handleStateChange();
+        handleStateChange();
+        if(eventBus)
+        {
+          eventBus->start();
+        }
+        for(std::size_t id = 0; id < minThreads; id++)
+        {
+          startWorker(id);
+        }
       }
-      for(std::size_t id = 0; id < threadPoolSize; id++)
+      if(!taskQueue->empty() || timerCount > 0)
       {
-        threads.push_back(std::thread([self, id]() {
-              self->runThread(id);
-            }));
+        // tasks and timers added before activation did not grow the
+        // pool, an elastic pool without minimum threads has no worker yet
+        growIfBusy(std::chrono::steady_clock::duration::zero());
       }
     }
     else
@@ -74,156 +221,1862 @@ void ThreadPool::activate()
   }
 }
 
-void ThreadPool::terminate()
+std::vector<std::shared_ptr<Task> >
+ThreadPool::terminate(Shutdown mode, std::chrono::steady_clock::duration timeout)
 {
+  std::unique_lock<mutex_type> lock(mutex);
+  if(state != State::Active)
+  {
+    throw std::logic_error("Invalid Task transition " +
+                           ThreadPool::stateToString(state) +
+                           " -> " +
+                           ThreadPool::stateToString(State::Terminated));
+  }
+  if(mainThreadId != std::this_thread::get_id())
+  {
+    throw std::logic_error("Attempt to terminate ThreadPool from thread ");
+  }
+  auto deadline = std::chrono::steady_clock::now();
+  if(mode == Shutdown::DrainUntil)
+  {
+    deadline += timeout;
+  }
+  if(mode != Shutdown::Drain)
+  {
+    // the workers cancel what they pop from now on, or after the timeout
+    discardTime = deadline.time_since_epoch().count();
+  }
+  state = State::Terminated;
+  handleStateChange();
+  lock.unlock();
+  condition.notify_all();
+  unparkWorkers(maxThreads);
+  if(mode == Shutdown::DrainUntil)
   {
-    std::unique_lock<mutex_type> lock(mutex);
-    if(state != State::Active)
+    lock.lock();
+    bool drained = exitCondition.wait_until(lock, deadline, [this]() {
+        return numExited == numThreads;
+      });
+    lock.unlock();
+    if(!drained)
     {
-      throw std::logic_error("Invalid Task transition " +
-                             ThreadPool::stateToString(state) +
-                             " -> " +
-                             ThreadPool::stateToString(State::Terminated));
+      cancelRunning();
     }
-    if(mainThreadId != std::this_thread::get_id())
+  }
+  else if(mode == Shutdown::Cancel)
+  {
+    cancelRunning();
+  }
+  // grow() does not start workers after termination, so the slots
+  // are stable here
+  for(auto & t : threads)
+  {
+    if(t.joinable())
     {
-      throw std::logic_error("Attempt to terminate ThreadPool from thread ");
+      t.join();
     }
-    else
+  }
+  std::vector<TimerWheel::Entry> entries;
+  {
+    std::lock_guard<mutex_type> timerLock(timerMutex);
+    if(timerWheel)
     {
-      state = State::Terminated;
-      handleStateChange();
-      lock.unlock();
-      condition.notify_all();
-      for(auto & t : threads)
-      {
-        t.join();
-      }
-      threads.clear();
+      timerWheel->clear(entries);
+    }
+    timerCount = 0;
+    timerDeadline = std::chrono::steady_clock::time_point::max().time_since_epoch().count();
+  }
+  cancelTimers(entries);
+  std::vector<std::shared_ptr<Task> > unrun;
+  {
+    std::lock_guard<mutex_type> unrunLock(unrunMutex);
+    unrun.swap(unrunTasks);
+    unrunCollected = true;
+  }
+  if(eventBus)
+  {
+    // delivers what the workers published
+    eventBus->stop();
+  }
+  return unrun;
+}
+
+void ThreadPool::cancelRunning()
+{
+  for(std::size_t id = 0; id < maxThreads; id++)
+  {
+    // the last task of the worker, cancel() ignores it once it finished
+    auto task = std::atomic_load(&tasksInThreads[id]);
+    if(task)
+    {
+      cancel(task);
+    }
+  }
+}
+
+bool ThreadPool::isDiscarding() const
+{
+  auto t = discardTime.load(std::memory_order_relaxed);
+  return (t != std::chrono::steady_clock::duration::max().count() &&
+          std::chrono::steady_clock::now().time_since_epoch().count() >= t);
+}
+
+void ThreadPool::discard(const std::shared_ptr<Task> & task)
+{
+  if(!task->transition(Task::State::Ready, Task::State::Canceled))
+  {
+    // canceled while it was queued
+    return;
+  }
+  finishCanceled(task, Task::State::Ready);
+  releaseSuccessors(task);
+}
+
+void ThreadPool::addUnrun(const std::shared_ptr<Task> & task)
+{
+  std::lock_guard<mutex_type> lock(unrunMutex);
+  if(!unrunCollected)
+  {
+    unrunTasks.push_back(task);
+  }
+}
+
+void ThreadPool::startWorker(std::size_t id)
+{
+  auto self = shared_from_this();
+  threads[id] = std::thread([self, id]() {
+      self->runThread(id);
+    });
+}
+
+void ThreadPool::growIfBusy(std::chrono::steady_clock::duration waited)
+{
+  // cheap checks first, a fixed size pool never gets past them
+  std::size_t n = numThreads;
+  if(n < maxThreads && numIdle == 0 &&
+     (n == 0 || numReady >= growQueueDepth ||
+      (waited > growQueueWait && !taskQueue->empty())))
+  {
+    grow();
+  }
+}
+
+void ThreadPool::grow()
+{
+  std::thread retired;
+  {
+    std::unique_lock<mutex_type> lock(mutex, std::defer_lock);
+    lockTraced(lock);
+    if(state != State::Active || numThreads >= maxThreads)
+    {
+      return;
     }
+    std::size_t id = 0;
+    while(workerActive[id])
+    {
+      id++;
+    }
+    // the previous worker of the slot has left its loop, it is joined
+    // outside of the lock
+    retired.swap(threads[id]);
+    workerActive[id] = true;
+    numThreads++;
+    startWorker(id);
+  }
+  if(retired.joinable())
+  {
+    retired.join();
   }
 }
 
 void ThreadPool::addTask(std::shared_ptr<Task> task)
 {
+  enqueue(task, true);
+}
+
+bool ThreadPool::trySubmit(std::shared_ptr<Task> task)
+{
+  return enqueue(task, false);
+}
+
+bool ThreadPool::enqueue(std::shared_ptr<Task> task, bool block)
+{
+  std::size_t worker = getCurrentWorker();
+  auto self = shared_from_this();
+  bool canceled = false;
+  bool runHere = false;
   {
-    std::unique_lock<mutex_type> lock(mutex);
+    // Announce the submission before checking the state: if terminate()
+    // sets the state after our check, the workers see the pending
+    // submission and do not exit until the task is queued.
+    SubmissionGuard guard(numSubmitting);
     if(state == State::Terminated)
     {
       throw std::logic_error("ThreadPool already terminated");
     }
+    if(task->taskId != Task::undefinedTaskId ||
+       task->state != Task::State::Waiting)
+    {
+      throw std::logic_error("Task already added");
+    }
+    if(task->join != Task::Join::None)
+    {
+      throw std::logic_error("Continuations are added by their predecessors");
+    }
+    // tasks that wait for predecessors do not take a queue slot yet
+    if(isQueueFull(1) && task->numPending == 1 && !task->predecessorFailed)
+    {
+      if(overflow == Overflow::CallerRuns)
+      {
+        numCallerRuns++;
+        runHere = true;
+      }
+      else if(!makeRoom(block, 1))
+      {
+        if(block)
+        {
+          throw QueueFull();
+        }
+        return false;
+      }
+    }
     task->taskId = taskCounter++;
-    task->setState(Task::State::Ready);
-    taskQueue.push_back(task);
+    task->owner = self;
+    numWaiting++;
+    if(--task->numPending != 0)
     {
-      auto self = shared_from_this();
-      lock.unlock();
-      task->handleStateChange(self);
-      lock.lock();
+      // the last predecessor that finishes queues the task
+      return true;
+    }
+    if(task->predecessorFailed)
+    {
+      canceled = task->transition(Task::State::Waiting, Task::State::Canceled);
+      if(!canceled)
+      {
+        return true;
+      }
+    }
+    else
+    {
+      task->readyTime = std::chrono::steady_clock::now();
+      // count first, whoever moves the task out of Ready uncounts it
+      numReady++;
+      if(!task->transition(Task::State::Waiting, Task::State::Ready))
+      {
+        // canceled concurrently
+        numReady--;
+        return true;
+      }
+      numWaiting--;
+      if(!runHere)
+      {
+        // announced before a worker can take the task, so Ready is
+        // never published after Running
+        handleTaskStateChange(task, Task::State::Ready);
+      }
+      if(runHere)
+      {
+        // not queued, the caller runs it below
+      }
+      else if(block)
+      {
+        taskQueue->push(task, worker);
+      }
+      else if(!taskQueue->tryPush(task, worker))
+      {
+        if(task->transition(Task::State::Ready, Task::State::Waiting))
+        {
+          // nobody else has seen the task, undo the submission and
+          // tell those that saw it Ready
+          numReady--;
+          handleTaskStateChange(task, Task::State::Waiting);
+          task->taskId = Task::undefinedTaskId;
+          task->owner.reset();
+          task->numPending++;
+          return false;
+        }
+        // canceled concurrently, the canceler did the bookkeeping
+        return true;
+      }
     }
-    condition.notify_all();
   }
+  if(canceled)
+  {
+    finishCanceled(task, Task::State::Waiting);
+    releaseSuccessors(task);
+  }
+  else if(runHere)
+  {
+    handleTaskStateChange(task, Task::State::Ready);
+    runInCaller(task);
+  }
+  else
+  {
+    notifyWorkers(1);
+    growIfBusy(std::chrono::steady_clock::duration::zero());
+  }
+  return true;
 }
 
-std::size_t ThreadPool::size() const
+void ThreadPool::addTaskAt(std::chrono::steady_clock::time_point time,
+                           std::shared_ptr<Task> task)
+{
+  // the timer holds the task back like a predecessor that has not finished
+  task->numPending++;
+  try
+  {
+    enqueue(task, true);
+  }
+  catch(...)
+  {
+    task->numPending--;
+    throw;
+  }
+  addTimer(TimerWheel::Entry{time, task, nullptr});
+}
+
+void ThreadPool::addTaskAfter(std::chrono::steady_clock::duration delay,
+                              std::shared_ptr<Task> task)
 {
-  return threadPoolSize;
+  addTaskAt(std::chrono::steady_clock::now() + delay, task);
 }
 
-std::size_t ThreadPool::numTasks(Task::State s) const
+void ThreadPool::addPeriodic(std::shared_ptr<PeriodicTask> periodic)
 {
-  std::lock_guard<mutex_type> lock(mutex);
-  switch(s)
+  if(state == State::Terminated)
   {
-  case Task::State::Ready: return taskQueue.size();
-  case Task::State::Done: return numDone;
-  case Task::State::Failed: return numFailed;
-  default:
-    return 0u;
+    throw std::logic_error("ThreadPool already terminated");
   }
+  auto time = std::chrono::steady_clock::now() + periodic->getPeriod();
+  addTimer(TimerWheel::Entry{time, nullptr, periodic});
 }
 
-ThreadPool::State ThreadPool::getState() const
+std::size_t ThreadPool::numTimers() const
 {
-  return state;
+  return timerCount;
 }
 
-std::pair<std::vector<std::shared_ptr<Task> >,
-	  std::vector<std::shared_ptr<Task> > > ThreadPool::getTasks() const
+void ThreadPool::addTimer(TimerWheel::Entry && entry)
 {
-  std::unique_lock<mutex_type> lock(mutex);
-  std::vector<std::shared_ptr<Task> > q(taskQueue.begin(),
-					taskQueue.end());
-  return std::make_pair(q, tasksInThreads);
+  auto rep = entry.time.time_since_epoch().count();
+  bool added = false;
+  bool earlier = false;
+  {
+    std::lock_guard<mutex_type> lock(timerMutex);
+    // terminate() sets the state before it clears the wheel
+    if(state != State::Terminated)
+    {
+      if(!timerWheel)
+      {
+        timerWheel.reset(new TimerWheel(timerResolution,
+                                        std::chrono::steady_clock::now()));
+      }
+      timerWheel->add(std::move(entry));
+      timerCount++;
+      added = true;
+      if(rep < timerDeadline)
+      {
+        timerDeadline = rep;
+        earlier = true;
+      }
+    }
+  }
+  if(!added)
+  {
+    std::vector<TimerWheel::Entry> entries(1, std::move(entry));
+    cancelTimers(entries);
+    return;
+  }
+  if(minThreads == 0)
+  {
+    // The workers fire the timers, and the last one does not retire
+    // while timers are pending. It may have left before this timer was
+    // counted, then the pool has to grow again.
+    bool noWorker = false;
+    {
+      std::lock_guard<mutex_type> lock(mutex);
+      noWorker = (numThreads == 0);
+    }
+    if(noWorker)
+    {
+      grow();
+      return;
+    }
+  }
+  if(earlier)
+  {
+    // an idle worker has to shorten its wait
+    notifyWorkers(1);
+  }
 }
 
+std::chrono::steady_clock::time_point ThreadPool::getTimerDeadline() const
+{
+  return std::chrono::steady_clock::time_point(
+    std::chrono::steady_clock::duration(timerDeadline));
+}
 
-void ThreadPool::runThread(std::size_t id)
+void ThreadPool::pollTimers()
 {
-  std::unique_lock<mutex_type> lock(mutex);
-  do 
+  auto now = std::chrono::steady_clock::now();
+  if(timerCount == 0 || now < getTimerDeadline())
+  {
+    return;
+  }
+  std::vector<TimerWheel::Entry> expired;
   {
-    if(state != State::Terminated && taskQueue.empty())
+    std::unique_lock<mutex_type> lock(timerMutex, std::try_to_lock);
+    if(!lock.owns_lock() || !timerWheel)
     {
-      condition.wait(lock);
+      // another worker fires them
+      return;
     }
-    if(!taskQueue.empty())
+    timerWheel->advance(now, expired);
+    for(auto & entry : expired)
     {
-      auto task = taskQueue.front();
-      taskQueue.pop_front();
-      task->threadId = id;
-      tasksInThreads[id] = task;
-      task->setState(Task::State::Running);
+      if(entry.periodic && !entry.periodic->isCanceled())
       {
-        auto self = shared_from_this();
-        lock.unlock();
-        task->handleStateChange(self);
+        // late runs are not caught up
+        auto time = entry.time + entry.periodic->getPeriod();
+        timerWheel->add(TimerWheel::Entry{(time > now ? time : now + entry.periodic->getPeriod()),
+                                          nullptr, entry.periodic});
       }
-      bool ret = task->run();
-      lock.lock();
-      if(ret)
+    }
+    timerCount = timerWheel->size();
+    timerDeadline = timerWheel->nextExpiry().time_since_epoch().count();
+  }
+  fireTimers(expired);
+}
+
+void ThreadPool::fireTimers(std::vector<TimerWheel::Entry> & expired)
+{
+  std::vector<std::shared_ptr<Task> > ready;
+  std::vector<std::shared_ptr<Task> > released;
+  std::vector<std::shared_ptr<Task> > canceled;
+  for(auto & entry : expired)
+  {
+    if(entry.periodic)
+    {
+      if(!entry.periodic->isCanceled())
       {
-        numDone++;
-        task->setState(Task::State::Done);
-        {
-          auto self = shared_from_this();
-          lock.unlock();
-          task->handleStateChange(self);
-          lock.lock();
-          task->promise.set_value();
-        }
+        auto task = entry.periodic->createTask();
+        // the timer was its only predecessor
+        task->numPending--;
+        released.push_back(task);
       }
-      else
+    }
+    else if(--entry.task->numPending == 0)
+    {
+      if(!entry.task->predecessorFailed)
       {
-        numFailed++;
-        task->setState(Task::State::Failed);
-        {
-          auto self = shared_from_this();
-          lock.unlock();
-          task->handleStateChange(self);
-          lock.lock();
-          task->promise.set_value();
-        }
+        ready.push_back(entry.task);
+      }
+      else if(entry.task->transition(Task::State::Waiting, Task::State::Canceled))
+      {
+        canceled.push_back(entry.task);
+      }
+    }
+  }
+  if(!ready.empty())
+  {
+    makeReady(ready);
+  }
+  if(!released.empty())
+  {
+    addContinuations(released);
+  }
+  for(auto & task : canceled)
+  {
+    finishCanceled(task, Task::State::Waiting);
+    releaseSuccessors(task);
+  }
+}
+
+void ThreadPool::cancelTimers(std::vector<TimerWheel::Entry> & entries)
+{
+  for(auto & entry : entries)
+  {
+    if(entry.periodic)
+    {
+      entry.periodic->cancel();
+    }
+    else if(entry.task->transition(Task::State::Waiting, Task::State::Canceled))
+    {
+      finishCanceled(entry.task, Task::State::Waiting);
+      releaseSuccessors(entry.task);
+    }
+  }
+}
+
+void ThreadPool::addTasks(std::vector<std::shared_ptr<Task> > && tasks)
+{
+  if(tasks.empty())
+  {
+    return;
+  }
+  auto self = shared_from_this();
+  std::vector<std::shared_ptr<Task> > ready;
+  std::vector<std::shared_ptr<Task> > canceled;
+  {
+    SubmissionGuard guard(numSubmitting);
+    if(state == State::Terminated)
+    {
+      throw std::logic_error("ThreadPool already terminated");
+    }
+    // all or nothing: claim every task before the overflow policy
+    // drops, waits or rejects anything for the batch
+    auto unclaim = [&tasks](std::size_t n) {
+      for(std::size_t j = 0; j < n; j++)
+      {
+        tasks[j]->taskId = Task::undefinedTaskId;
+      }
+    };
+    // tasks that wait for predecessors do not take a queue slot yet
+    std::size_t numSlots = 0;
+    for(std::size_t i = 0; i < tasks.size(); i++)
+    {
+      if(tasks[i]->taskId != Task::undefinedTaskId ||
+         tasks[i]->state != Task::State::Waiting ||
+         tasks[i]->join != Task::Join::None)
+      {
+        unclaim(i);
+        throw std::logic_error(tasks[i]->join != Task::Join::None ?
+                               "Continuations are added by their predecessors" :
+                               "Task already added");
+      }
+      tasks[i]->taskId = i;
+      if(tasks[i]->numPending == 1 && !tasks[i]->predecessorFailed)
+      {
+        numSlots++;
       }
     }
-  } while (state != State::Terminated ||
-           !taskQueue.empty());
+    // the policy applies to the batch as a whole, unless the caller
+    // runs tasks
+    if(numSlots != 0 && isQueueFull(numSlots))
+    {
+      switch(overflow)
+      {
+      case Overflow::CallerRuns:
+        // the policy applies to each task on its own, the batch is
+        // known to be valid
+        unclaim(tasks.size());
+        for(auto & task : tasks)
+        {
+          addTask(task);
+        }
+        return;
+      case Overflow::DropOldest:
+        while(numReady + numSlots > maxQueueDepth && dropOldest())
+        {
+        }
+        break;
+      default:
+        try
+        {
+          if(!makeRoom(true, numSlots))
+          {
+            throw QueueFull();
+          }
+        }
+        catch(...)
+        {
+          unclaim(tasks.size());
+          throw;
+        }
+        break;
+      }
+    }
+    std::size_t id = taskCounter.fetch_add(tasks.size());
+    numWaiting += tasks.size();
+    for(auto & task : tasks)
+    {
+      task->taskId = id++;
+      task->owner = self;
+      if(--task->numPending == 0)
+      {
+        if(!task->predecessorFailed)
+        {
+          ready.push_back(task);
+        }
+        else if(task->transition(Task::State::Waiting, Task::State::Canceled))
+        {
+          canceled.push_back(task);
+        }
+      }
+    }
+    queueReady(ready);
+  }
+  for(auto & task : canceled)
+  {
+    finishCanceled(task, Task::State::Waiting);
+    releaseSuccessors(task);
+  }
+}
+
+bool ThreadPool::acceptsReleased()
+{
+  if(state != State::Terminated)
+  {
+    return true;
+  }
+  // A worker leaves under the mutex, after it found no pending
+  // submission. The caller's SubmissionGuard keeps the others until the
+  // released tasks are queued.
+  std::lock_guard<mutex_type> lock(mutex);
+  return numExited < numThreads;
+}
+
+void ThreadPool::adopt(const std::shared_ptr<Task> & task)
+{
+  // continuations a running pool cancels stay out of its counts
+  if(state != State::Terminated)
+  {
+    return;
+  }
+  task->taskId = taskCounter++;
+  task->owner = shared_from_this();
+  numWaiting++;
+}
+
+void ThreadPool::makeReady(const std::vector<std::shared_ptr<Task> > & tasks)
+{
+  {
+    SubmissionGuard guard(numSubmitting);
+    if(acceptsReleased())
+    {
+      queueReady(tasks);
+      return;
+    }
+  }
+  // released after the workers of the terminated pool have left, like
+  // continuations they are canceled
+  for(auto & task : tasks)
+  {
+    if(task->transition(Task::State::Waiting, Task::State::Canceled))
+    {
+      finishCanceled(task, Task::State::Waiting);
+      releaseSuccessors(task);
+    }
+  }
+}
+
+void ThreadPool::queueReady(const std::vector<std::shared_ptr<Task> > & tasks)
+{
+  std::vector<std::shared_ptr<Task> > ready;
+  ready.reserve(tasks.size());
+  auto now = std::chrono::steady_clock::now();
+  for(auto & task : tasks)
+  {
+    task->readyTime = now;
+    numReady++;
+    if(task->transition(Task::State::Waiting, Task::State::Ready))
+    {
+      ready.push_back(task);
+    }
+    else
+    {
+      // canceled concurrently
+      numReady--;
+    }
+  }
+  if(ready.empty())
+  {
+    return;
+  }
+  numWaiting -= ready.size();
+  for(auto & task : ready)
+  {
+    handleTaskStateChange(task, Task::State::Ready);
+  }
+  taskQueue->pushBulk(ready, getCurrentWorker());
+  notifyWorkers(ready.size());
+  growIfBusy(std::chrono::steady_clock::duration::zero());
+}
+
+bool ThreadPool::cancel(std::shared_ptr<Task> task)
+{
+  Task::State s = task->state;
+  while(true)
+  {
+    switch(s)
+    {
+    case Task::State::Waiting:
+    case Task::State::Ready:
+      // a canceled Ready task stays in the queue, the worker that pops
+      // it fails to claim it and drops it
+      if(task->state.compare_exchange_weak(s, Task::State::Canceled))
+      {
+        finishCanceled(task, s);
+        releaseSuccessors(task);
+        return true;
+      }
+      break;
+    case Task::State::Running:
+      if(task->state.compare_exchange_weak(s, Task::State::CancelRequested))
+      {
+        auto pool = task->owner.lock();
+        if(pool)
+        {
+          pool->handleTaskStateChange(task, Task::State::CancelRequested);
+        }
+        else
+        {
+          task->handleStateChange(Task::State::CancelRequested, pool);
+        }
+        return true;
+      }
+      break;
+    default:
+      return false;
+    }
+  }
+}
+
+void ThreadPool::finishCanceled(std::shared_ptr<Task> task, Task::State from)
+{
+  auto pool = task->owner.lock();
+  if(pool)
+  {
+    if(from == Task::State::Ready)
+    {
+      pool->releaseQueueSlot();
+    }
+    else if(from == Task::State::Waiting)
+    {
+      pool->numWaiting--;
+    }
+    pool->numCanceled++;
+    if(pool->state == State::Terminated)
+    {
+      // discarded, timed or released into the terminating pool, either
+      // way it never ran
+      pool->addUnrun(task);
+    }
+  }
+  task->finish(Task::State::Canceled);
+  if(pool)
+  {
+    pool->handleTaskStateChange(task, Task::State::Canceled);
+  }
+  else
+  {
+    task->handleStateChange(Task::State::Canceled, pool);
+  }
+  task->notifyFinished();
+}
+
+namespace
+{
+  typedef std::vector<std::pair<std::shared_ptr<ThreadPool>,
+                                std::vector<std::shared_ptr<Task> > > > pool_batches_type;
+
+  void addToBatch(pool_batches_type & batches,
+                  const std::shared_ptr<ThreadPool> & pool,
+                  const std::shared_ptr<Task> & task)
+  {
+    auto itr = batches.begin();
+    while(itr != batches.end() && itr->first != pool)
+    {
+      ++itr;
+    }
+    if(itr == batches.end())
+    {
+      itr = batches.insert(itr, std::make_pair(pool,
+                                               std::vector<std::shared_ptr<Task> >()));
+    }
+    itr->second.push_back(task);
+  }
+}
+
+void ThreadPool::releaseSuccessors(std::shared_ptr<Task> task)
+{
+  // Each edge costs one atomic decrement, successors that become ready
+  // are queued in one batch per pool. Cancellation spreads through a
+  // work list rather than recursion, so long chains do not exhaust the
+  // stack.
+  std::vector<std::shared_ptr<Task> > finished(1, task);
+  pool_batches_type ready;
+  pool_batches_type continuations;
+  std::vector<std::shared_ptr<Task> > detached;
+  while(!finished.empty())
+  {
+    auto t = std::move(finished.back());
+    finished.pop_back();
+    std::vector<std::shared_ptr<Task> > successors;
+    {
+      std::lock_guard<std::mutex> lock(t->taskMutex);
+      t->successorsReleased = true;
+      successors.swap(t->successors);
+    }
+    bool failed = (t->state != Task::State::Done);
+    for(auto & succ : successors)
+    {
+      if(failed)
+      {
+        succ->predecessorFailed = true;
+      }
+      if(succ->join != Task::Join::None)
+      {
+        if(!succ->releaseContinuation(!failed))
+        {
+          continue;
+        }
+        auto pool = t->owner.lock();
+        if(pool && !isContinuationCanceled(succ, !failed))
+        {
+          addToBatch(continuations, pool, succ);
+        }
+        else if(succ->join == Task::Join::Finally)
+        {
+          detached.push_back(succ);
+        }
+        else if(succ->transition(Task::State::Waiting, Task::State::Canceled))
+        {
+          if(pool)
+          {
+            pool->adopt(succ);
+          }
+          finishCanceled(succ, Task::State::Waiting);
+          finished.push_back(succ);
+        }
+        continue;
+      }
+      if(--succ->numPending != 0)
+      {
+        continue;
+      }
+      if(succ->predecessorFailed)
+      {
+        if(succ->transition(Task::State::Waiting, Task::State::Canceled))
+        {
+          finishCanceled(succ, Task::State::Waiting);
+          finished.push_back(succ);
+        }
+      }
+      else if(auto pool = succ->owner.lock())
+      {
+        addToBatch(ready, pool, succ);
+      }
+    }
+  }
+  for(auto & batch : ready)
+  {
+    batch.first->makeReady(batch.second);
+  }
+  for(auto & batch : continuations)
+  {
+    batch.first->addContinuations(batch.second);
+  }
+  for(auto & succ : detached)
+  {
+    runDetached(succ);
+  }
+}
+
+void ThreadPool::addContinuations(const std::vector<std::shared_ptr<Task> > & tasks)
+{
+  {
+    SubmissionGuard guard(numSubmitting);
+    if(acceptsReleased())
+    {
+      auto self = shared_from_this();
+      std::size_t id = taskCounter.fetch_add(tasks.size());
+      numWaiting += tasks.size();
+      for(auto & task : tasks)
+      {
+        task->taskId = id++;
+        task->owner = self;
+      }
+      queueReady(tasks);
+      return;
+    }
+  }
+  for(auto & task : tasks)
+  {
+    if(task->join == Task::Join::Finally)
+    {
+      runDetached(task);
+    }
+    else if(task->transition(Task::State::Waiting, Task::State::Canceled))
+    {
+      // owned, so terminate() returns it
+      adopt(task);
+      finishCanceled(task, Task::State::Waiting);
+      releaseSuccessors(task);
+    }
+  }
+}
+
+void ThreadPool::releaseContinuation(std::shared_ptr<Task> task,
+                                     std::shared_ptr<ThreadPool> pool,
+                                     bool done)
+{
+  if(pool && !isContinuationCanceled(task, done))
+  {
+    pool->addContinuations(std::vector<std::shared_ptr<Task> >(1, task));
+  }
+  else if(task->join == Task::Join::Finally)
+  {
+    runDetached(task);
+  }
+  else if(task->transition(Task::State::Waiting, Task::State::Canceled))
+  {
+    if(pool)
+    {
+      pool->adopt(task);
+    }
+    finishCanceled(task, Task::State::Waiting);
+    releaseSuccessors(task);
+  }
+}
+
+void ThreadPool::runDetached(std::shared_ptr<Task> task)
+{
+  // no pool can run the continuation, so the releasing thread does;
+  // a failed transition means it was canceled meanwhile
+  std::shared_ptr<ThreadPool> pool;
+  if(!task->transition(Task::State::Waiting, Task::State::Ready))
+  {
+    return;
+  }
+  task->handleStateChange(Task::State::Ready, pool);
+  if(!task->transition(Task::State::Ready, Task::State::Running))
+  {
+    return;
+  }
+  task->handleStateChange(Task::State::Running, pool);
+  bool ret = task->run(task);
+  Task::State s = (ret ? Task::State::Done : Task::State::Failed);
+  if(!task->transition(Task::State::Running, s))
+  {
+    s = Task::State::Canceled;
+    task->setState(s);
+  }
+  task->finish(s);
+  task->handleStateChange(s, pool);
+  releaseSuccessors(task);
+  task->notifyFinished();
+}
+
+bool ThreadPool::isContinuationCanceled(const std::shared_ptr<Task> & task, bool done)
+{
+  switch(task->join)
+  {
+  case Task::Join::Any:
+    // released by its first Done predecessor, or by the last one if
+    // none succeeded
+    return !done;
+  case Task::Join::Finally:
+    return false;
+  default:
+    return task->predecessorFailed;
+  }
+}
+
+std::size_t ThreadPool::size() const
+{
+  return numThreads;
+}
+
+std::size_t ThreadPool::getMinSize() const
+{
+  return minThreads;
+}
+
+std::size_t ThreadPool::getMaxSize() const
+{
+  return maxThreads;
+}
+
+void ThreadPool::checkElasticSetup() const
+{
+  if(minThreads == maxThreads)
+  {
+    throw std::logic_error("ThreadPool is not elastic");
+  }
+  if(state != State::Waiting)
+  {
+    throw std::logic_error("ThreadPool already activated");
+  }
+}
+
+void ThreadPool::setKeepAlive(std::chrono::steady_clock::duration _keepAlive)
+{
+  checkElasticSetup();
+  keepAlive = _keepAlive;
+}
+
+void ThreadPool::setGrowThreshold(std::size_t queueDepth,
+                                  std::chrono::steady_clock::duration queueWait)
+{
+  checkElasticSetup();
+  growQueueDepth = queueDepth;
+  growQueueWait = queueWait;
+}
+
+ThreadPool::Scheduler ThreadPool::getScheduler() const
+{
+  return scheduler;
+}
+
+std::size_t ThreadPool::getCapacity() const
+{
+  return taskQueue->capacity();
+}
+
+std::vector<PriorityTaskQueue*> ThreadPool::getPriorityQueues() const
+{
+  std::vector<TaskQueue*> queues(1, taskQueue.get());
+  NumaTaskQueue * numa = dynamic_cast<NumaTaskQueue*>(taskQueue.get());
+  if(numa)
+  {
+    queues.clear();
+    for(std::size_t node = 0; node < numa->numNodes(); node++)
+    {
+      queues.push_back(&numa->getNode(node));
+    }
+  }
+  std::vector<PriorityTaskQueue*> ret;
+  for(auto q : queues)
+  {
+    PriorityTaskQueue * queue = dynamic_cast<PriorityTaskQueue*>(q);
+    if(!queue)
+    {
+      throw std::logic_error("Aging requires the Priority scheduler");
+    }
+    ret.push_back(queue);
+  }
+  return ret;
+}
+
+void ThreadPool::setAgingInterval(std::chrono::steady_clock::duration interval)
+{
+  for(auto queue : getPriorityQueues())
+  {
+    queue->setAgingInterval(interval);
+  }
+  // setAffinity() creates the queues again
+  std::lock_guard<mutex_type> lock(mutex);
+  agingInterval = interval;
+}
+
+std::chrono::steady_clock::duration ThreadPool::getAgingInterval() const
+{
+  return getPriorityQueues().front()->getAgingInterval();
+}
+
+void ThreadPool::setMaxQueueDepth(std::size_t depth, Overflow policy)
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  if(state != State::Waiting || taskCounter != 0)
+  {
+    throw std::logic_error("Queue depth must be set before tasks are added");
+  }
+  maxQueueDepth = depth;
+  overflow = policy;
+}
+
+void ThreadPool::setWaitStrategy(WaitStrategy strategy, std::size_t _spinCount)
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  if(state != State::Waiting || taskCounter != 0)
+  {
+    throw std::logic_error("Wait strategy must be set before tasks are added");
+  }
+  waitStrategy = strategy;
+  spinCount = _spinCount;
+}
+
+ThreadPool::WaitStrategy ThreadPool::getWaitStrategy() const
+{
+  return waitStrategy;
+}
+
+std::size_t ThreadPool::getMaxQueueDepth() const
+{
+  return maxQueueDepth;
+}
+
+ThreadPool::Overflow ThreadPool::getOverflow() const
+{
+  return overflow;
+}
+
+void ThreadPool::setAffinity(Affinity policy,
+                             const CpuTopology::cpu_list_type & cpus)
+{
+  setAffinity(policy, CpuTopology::detect(), cpus);
+}
+
+void ThreadPool::setAffinity(Affinity policy, const CpuTopology & topology,
+                             const CpuTopology::cpu_list_type & cpus)
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  if(state != State::Waiting || taskCounter != 0)
+  {
+    throw std::logic_error("Affinity must be set before tasks are added");
+  }
+  std::vector<CpuTopology::cpu_list_type> placement;
+  switch(policy)
+  {
+  case Affinity::Compact:
+    placement = topology.compact(maxThreads);
+    break;
+  case Affinity::Scatter:
+    placement = topology.scatter(maxThreads);
+    break;
+  case Affinity::CpuList:
+    if(cpus.empty())
+    {
+      throw std::logic_error("Affinity::CpuList requires CPUs");
+    }
+    for(std::size_t id = 0; id < maxThreads; id++)
+    {
+      placement.push_back(CpuTopology::cpu_list_type(1, cpus[id % cpus.size()]));
+    }
+    break;
+  case Affinity::NumaNode:
+    placement = topology.nodeLocal(maxThreads);
+    break;
+  default:
+    break;
+  }
+  std::size_t numNodes = (policy == Affinity::NumaNode ? topology.numNodes() : 1);
+  if(numNodes > 1)
+  {
+    // worker slots alternate between the nodes, see CpuTopology::nodeLocal
+    std::vector<std::unique_ptr<TaskQueue> > nodes;
+    std::vector<std::size_t> workerNode;
+    std::size_t capacity = (queueCapacity + numNodes - 1) / numNodes;
+    for(std::size_t node = 0; node < numNodes; node++)
+    {
+      nodes.push_back(std::unique_ptr<TaskQueue>(createTaskQueue(scheduler,
+                                                                 maxThreads,
+                                                                 capacity,
+                                                                 agingInterval)));
+    }
+    for(std::size_t id = 0; id < maxThreads; id++)
+    {
+      workerNode.push_back(id % numNodes);
+    }
+    taskQueue.reset(new NumaTaskQueue(std::move(nodes), workerNode));
+  }
+  else
+  {
+    taskQueue.reset(createTaskQueue(scheduler, maxThreads, queueCapacity, agingInterval));
+  }
+  affinity = policy;
+  workerCpus.swap(placement);
+}
+
+ThreadPool::Affinity ThreadPool::getAffinity() const
+{
+  return affinity;
+}
+
+CpuTopology::cpu_list_type ThreadPool::getWorkerCpus(std::size_t id) const
+{
+  return (id < workerCpus.size() ? workerCpus[id] : CpuTopology::cpu_list_type());
+}
+
+std::size_t ThreadPool::numTasks(Task::State s) const
+{
+  switch(s)
+  {
+  case Task::State::Waiting: return numWaiting;
+  case Task::State::Ready: return numReady;
+  default:
+    break;
+  }
+  PoolStats stats;
+  for(std::size_t id = 0; id <= maxThreads; id++)
+  {
+    workerStats[id].addCountsTo(stats);
+  }
+  switch(s)
+  {
+  case Task::State::Running: return stats.numRunning;
+  case Task::State::Canceled: return numCanceled + stats.numCanceled;
+  case Task::State::Done: return stats.numDone;
+  case Task::State::Failed: return stats.numFailed;
+  default:
+    return 0u;
+  }
+}
+
+PoolStats ThreadPool::getStats() const
+{
+  PoolStats stats;
+  for(std::size_t id = 0; id <= maxThreads; id++)
+  {
+    workerStats[id].addCountsTo(stats);
+    workerStats[id].addHistogramsTo(stats);
+  }
+  stats.numCanceled += numCanceled;
+  stats.numRejected = numRejected;
+  stats.numDropped = numDropped;
+  stats.numCallerRuns = numCallerRuns;
+  stats.numWaiting = numWaiting;
+  stats.numReady = numReady;
+  stats.numThreads = numThreads;
+  stats.numIdle = numIdle;
+  return stats;
+}
+
+ThreadPool::State ThreadPool::getState() const
+{
+  return state;
+}
+
+std::pair<std::vector<std::shared_ptr<Task> >,
+	  std::vector<std::shared_ptr<Task> > > ThreadPool::getTasks() const
+{
+  // one entry per current worker, in slot order
+  std::vector<std::shared_ptr<Task> > t;
+  t.reserve(tasksInThreads.size());
+  for(std::size_t id = 0; id < tasksInThreads.size(); id++)
+  {
+    if(workerActive[id])
+    {
+      t.push_back(std::atomic_load(&tasksInThreads[id]));
+    }
+  }
+  // canceled tasks stay queued until a worker drops them
+  std::vector<std::shared_ptr<Task> > q = taskQueue->getTasks();
+  q.erase(std::remove_if(q.begin(), q.end(),
+                         [](const std::shared_ptr<Task> & task) {
+                           return task->getState() != Task::State::Ready;
+                         }),
+          q.end());
+  return std::make_pair(q, t);
+}
+
+std::size_t ThreadPool::getQueueDepth() const
+{
+  return numReady;
+}
+
+PoolSnapshot ThreadPool::getSnapshot() const
+{
+  PoolSnapshot snapshot;
+  snapshot.queueDepth = numReady;
+  snapshot.numWaiting = numWaiting;
+  snapshot.numThreads = numThreads;
+  snapshot.workers.reserve(maxThreads);
+  for(std::size_t id = 0; id < maxThreads; id++)
+  {
+    if(workerActive[id])
+    {
+      snapshot.workers.push_back(workerSlots[id].read());
+      snapshot.workers.back().workerId = id;
+    }
+  }
+  return snapshot;
+}
+
+std::vector<std::size_t> ThreadPool::getQueuedTaskIds(std::size_t offset,
+                                                      std::size_t limit) const
+{
+  return taskQueue->getTaskIds(offset, limit);
+}
+
+void ThreadPool::enableEventBus(std::size_t capacity,
+                                EventBus::Overflow overflow)
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  if(state != State::Waiting || taskCounter != 0)
+  {
+    throw std::logic_error("Event bus must be enabled before tasks are added");
+  }
+  eventBus.reset(new EventBus(maxThreads, capacity, overflow));
+}
+
+void ThreadPool::onTaskEvents(EventBus::listener_type listener)
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  if(!eventBus)
+  {
+    throw std::logic_error("Event bus not enabled");
+  }
+  if(state != State::Waiting)
+  {
+    throw std::logic_error("ThreadPool already activated");
+  }
+  eventBus->addListener(listener);
+}
+
+std::size_t ThreadPool::numDroppedEvents() const
+{
+  return (eventBus ? eventBus->numDropped() : 0u);
+}
+
+void ThreadPool::enableTracing(std::size_t capacity)
+{
+  std::lock_guard<mutex_type> lock(mutex);
+  if(state != State::Waiting || taskCounter != 0)
+  {
+    throw std::logic_error("Tracing must be enabled before tasks are added");
+  }
+  tracer.reset(new TaskTracer(maxThreads, capacity));
+}
+
+void ThreadPool::startTracing()
+{
+  if(!tracer)
+  {
+    throw std::logic_error("Tracing not enabled");
+  }
+  tracer->start();
+}
+
+void ThreadPool::stopTracing()
+{
+  if(!tracer)
+  {
+    throw std::logic_error("Tracing not enabled");
+  }
+  tracer->stop();
+}
+
+void ThreadPool::writeTrace(std::ostream & os) const
+{
+  if(!tracer)
+  {
+    throw std::logic_error("Tracing not enabled");
+  }
+  tracer->write(os);
+}
+
+bool ThreadPool::isTracing() const
+{
+  return tracer && tracer->isRecording();
+}
+
+void ThreadPool::lockTraced(std::unique_lock<mutex_type> & lock)
+{
+  if(lock.try_lock())
+  {
+    return;
+  }
+  if(isTracing())
+  {
+    auto begin = std::chrono::steady_clock::now();
+    lock.lock();
+    tracer->record(getCurrentWorker(), TaskTracer::Kind::LockWait,
+                   Task::undefinedTaskId, begin, std::chrono::steady_clock::now());
+  }
+  else
+  {
+    lock.lock();
+  }
+}
+
+std::size_t ThreadPool::getCurrentWorker() const
+{
+  return (currentPool == this ? currentWorkerId : TaskQueue::noWorker);
+}
+
+void ThreadPool::notifyWorkers(std::size_t n)
+{
+  // Workers register as idle before they check the queue and the queue
+  // counts a task before we get here, so one of both sides sees the other.
+  std::size_t idle = numIdle;
+  if(idle > 0 && waitStrategy != WaitStrategy::Block)
+  {
+    unparkWorkers(n);
+  }
+  else if(idle > 0)
+  {
+    {
+      std::unique_lock<mutex_type> lock(mutex, std::defer_lock);
+      lockTraced(lock);
+    }
+    if(n >= idle)
+    {
+      condition.notify_all();
+    }
+    else
+    {
+      for(std::size_t i = 0; i < n; i++)
+      {
+        condition.notify_one();
+      }
+    }
+  }
+}
+
+void ThreadPool::runThread(std::size_t id)
+{
+  currentPool = this;
+  currentWorkerId = id;
+  if(id < workerCpus.size())
+  {
+    // best effort, the process may not be allowed to use every CPU
+    CpuTopology::setThreadAffinity(workerCpus[id]);
+  }
+  while(true)
+  {
+    if(timerCount > 0)
+    {
+      pollTimers();
+    }
+    auto task = taskQueue->pop(id);
+    if(task)
+    {
+      runReady(task, id);
+    }
+    else if(waitStrategy == WaitStrategy::SpinThenPark && spinForTask())
+    {
+      // a task arrived before we parked
+    }
+    else
+    {
+      std::unique_lock<mutex_type> lock(mutex, std::defer_lock);
+      lockTraced(lock);
+      enterIdle(id);
+      // check order matters: a submission that is no longer pending
+      // has already been counted by the queue
+      bool terminated = (state == State::Terminated);
+      bool submitting = (numSubmitting > 0);
+      if(taskQueue->empty())
+      {
+        if(!terminated)
+        {
+          // the deadline is read after registering as idle, so a timer
+          // added meanwhile notifies us
+          auto deadline = getTimerDeadline();
+          bool timed = (deadline != std::chrono::steady_clock::time_point::max());
+          if(timed && (minThreads == maxThreads ||
+                       deadline - std::chrono::steady_clock::now() < keepAlive))
+          {
+            waitIdle(lock, id, deadline);
+          }
+          else if(minThreads == maxThreads)
+          {
+            waitIdle(lock, id, std::chrono::steady_clock::time_point::max());
+          }
+          else if(!waitIdle(lock, id, std::chrono::steady_clock::now() + keepAlive))
+          {
+            // Leave the idle count before the last look at the queue: a
+            // concurrent submission either sees no idle worker and grows
+            // the pool, or we see its task.
+            leaveIdle(id);
+            // the last worker stays to fire pending timers
+            if(state == State::Active && numThreads > minThreads &&
+               taskQueue->empty() && (numThreads > 1 || timerCount == 0))
+            {
+              workerActive[id] = false;
+              numThreads--;
+              std::atomic_store(&tasksInThreads[id], std::shared_ptr<Task>());
+              break;
+            }
+            continue;
+          }
+        }
+        else if(!submitting)
+        {
+          leaveIdle(id);
+          numExited++;
+          exitCondition.notify_all();
+          break;
+        }
+        else
+        {
+          lock.unlock();
+          std::this_thread::yield();
+        }
+      }
+      leaveIdle(id);
+    }
+  }
+  currentPool = nullptr;
+  currentWorkerId = TaskQueue::noWorker;
+}
+
+bool ThreadPool::spinForTask() const
+{
+  for(std::size_t i = 0; i < spinCount; i++)
+  {
+    if(!taskQueue->empty())
+    {
+      return true;
+    }
+    cpuRelax();
+  }
+  return false;
+}
+
+void ThreadPool::enterIdle(std::size_t id)
+{
+  if(waitStrategy == WaitStrategy::Block)
+  {
+    numIdle++;
+    return;
+  }
+  // counted under the list mutex, so a submission that sees the count
+  // finds us in the list
+  std::lock_guard<mutex_type> lock(idleMutex);
+  idleWorkers.push_back(id);
+  numIdle++;
+}
+
+void ThreadPool::leaveIdle(std::size_t id)
+{
+  if(waitStrategy == WaitStrategy::Block)
+  {
+    numIdle--;
+    return;
+  }
+  std::lock_guard<mutex_type> lock(idleMutex);
+  auto itr = std::find(idleWorkers.begin(), idleWorkers.end(), id);
+  if(itr != idleWorkers.end())
+  {
+    idleWorkers.erase(itr);
+    numIdle--;
+  }
+  // otherwise a submission took us off the list and uncounted us, its
+  // notification is consumed by the next wait
+}
+
+bool ThreadPool::waitIdle(std::unique_lock<mutex_type> & lock, std::size_t id,
+                          std::chrono::steady_clock::time_point until)
+{
+  const auto never = std::chrono::steady_clock::time_point::max();
+  if(waitStrategy == WaitStrategy::Block)
+  {
+    if(until == never)
+    {
+      condition.wait(lock);
+      return true;
+    }
+    return (condition.wait_until(lock, until) == std::cv_status::no_timeout);
+  }
+  lock.unlock();
+  bool notified = false;
+  {
+    Parker & parker = parkers[id];
+    std::unique_lock<mutex_type> parkLock(parker.mutex);
+    if(until == never)
+    {
+      parker.condition.wait(parkLock, [&parker]() { return parker.notified; });
+    }
+    else
+    {
+      parker.condition.wait_until(parkLock, until, [&parker]() { return parker.notified; });
+    }
+    notified = parker.notified;
+    parker.notified = false;
+  }
+  if(!notified)
+  {
+    // the caller may retire
+    lockTraced(lock);
+  }
+  return notified;
+}
+
+void ThreadPool::unparkWorkers(std::size_t n)
+{
+  // the worker parked last has the warmest cache
+  for(std::size_t i = 0; i < n; i++)
+  {
+    std::size_t id = 0;
+    {
+      std::lock_guard<mutex_type> lock(idleMutex);
+      if(idleWorkers.empty())
+      {
+        return;
+      }
+      id = idleWorkers.back();
+      idleWorkers.pop_back();
+      numIdle--;
+    }
+    Parker & parker = parkers[id];
+    {
+      std::lock_guard<mutex_type> lock(parker.mutex);
+      parker.notified = true;
+    }
+    parker.condition.notify_one();
+  }
+}
+
+void ThreadPool::runReady(const std::shared_ptr<Task> & task, std::size_t id)
+{
+  if(isDiscarding())
+  {
+    discard(task);
+    return;
+  }
+  if(!task->transition(Task::State::Ready, Task::State::Running))
+  {
+    // canceled while it was queued
+    return;
+  }
+  releaseQueueSlot();
+  auto start = std::chrono::steady_clock::now();
+  workerStats[id].taskStarted(start - task->readyTime);
+  if(isTracing())
+  {
+    tracer->record(id, TaskTracer::Kind::QueueWait, task->taskId,
+                   task->readyTime, start);
+  }
+  if(minThreads != maxThreads)
+  {
+    // the backlog is still there after we took our task
+    growIfBusy(start - task->readyTime);
+  }
+  runTask(task, id, start);
+}
+
+void ThreadPool::runInCaller(const std::shared_ptr<Task> & task)
+{
+  std::size_t id = getCurrentWorker();
+  if(id != TaskQueue::noWorker)
+  {
+    runNested(task, id);
+    return;
+  }
+  if(!task->transition(Task::State::Ready, Task::State::Running))
+  {
+    return;
+  }
+  releaseQueueSlot();
+  auto start = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<mutex_type> lock(callerMutex);
+    workerStats[maxThreads].taskStarted(start - task->readyTime);
+  }
+  handleTaskStateChange(task, Task::State::Running);
+  bool ret = task->run(task);
+  Task::State s = (ret ? Task::State::Done : Task::State::Failed);
+  if(!task->transition(Task::State::Running, s))
+  {
+    s = Task::State::Canceled;
+    task->setState(s);
+  }
+  auto end = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<mutex_type> lock(callerMutex);
+    workerStats[maxThreads].taskFinished(s == Task::State::Done,
+                                         s == Task::State::Canceled,
+                                         end - start);
+  }
+  if(isTracing())
+  {
+    tracer->record(TaskQueue::noWorker, TaskTracer::Kind::Run, task->taskId, start, end);
+  }
+  task->finish(s);
+  handleTaskStateChange(task, s);
+  releaseSuccessors(task);
+  task->notifyFinished();
+}
+
+bool ThreadPool::isQueueFull(std::size_t n) const
+{
+  // a batch larger than the bound fits into an empty queue
+  std::size_t ready = numReady;
+  return maxQueueDepth != 0 && ready != 0 && ready + n > maxQueueDepth;
+}
+
+bool ThreadPool::makeRoom(bool block, std::size_t n)
+{
+  switch(overflow)
+  {
+  case Overflow::Block:
+    if(block)
+    {
+      waitForSpace(n);
+      return true;
+    }
+    break;
+  case Overflow::DropOldest:
+    dropOldest();
+    return true;
+  default:
+    break;
+  }
+  numRejected++;
+  return false;
+}
+
+void ThreadPool::waitForSpace(std::size_t n)
+{
+  if(getCurrentWorker() != TaskQueue::noWorker)
+  {
+    // a blocked worker might be the one that should drain the queue
+    while(isQueueFull(n))
+    {
+      if(!runPendingTask())
+      {
+        std::this_thread::yield();
+      }
+    }
+    return;
+  }
+  std::unique_lock<mutex_type> lock(spaceMutex);
+  // announce before checking, releaseQueueSlot() decrements before it
+  // looks for blocked producers
+  numBlocked++;
+  while(state != State::Waiting && isQueueFull(n))
+  {
+    spaceCondition.wait(lock);
+  }
+  numBlocked--;
+}
+
+bool ThreadPool::dropOldest()
+{
+  while(auto task = taskQueue->popOldest())
+  {
+    // entries of tasks canceled while queued are skipped
+    if(task->transition(Task::State::Ready, Task::State::Canceled))
+    {
+      numDropped++;
+      finishCanceled(task, Task::State::Ready);
+      releaseSuccessors(task);
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::releaseQueueSlot()
+{
+  numReady--;
+  if(numBlocked > 0)
+  {
+    {
+      std::lock_guard<mutex_type> lock(spaceMutex);
+    }
+    spaceCondition.notify_all();
+  }
+}
+
+bool ThreadPool::runPendingTask()
+{
+  std::size_t id = getCurrentWorker();
+  if(id == TaskQueue::noWorker)
+  {
+    return false;
+  }
+  // a task waiting for a timed task must not keep the timers from firing
+  pollTimers();
+  auto task = taskQueue->pop(id);
+  if(!task)
+  {
+    return false;
+  }
+  runNested(task, id);
+  return true;
+}
+
+void ThreadPool::runNested(const std::shared_ptr<Task> & task, std::size_t id)
+{
+  // the worker shows the outer task again once the nested one is done
+  auto waiting = std::atomic_load(&tasksInThreads[id]);
+  WorkerSnapshot slot = workerSlots[id].read();
+  runReady(task, id);
+  std::atomic_store(&tasksInThreads[id], waiting);
+  workerSlots[id].restore(slot);
+}
+
+ThreadPool * ThreadPool::getCurrentPool()
+{
+  return currentPool;
+}
+
+void ThreadPool::runTask(const std::shared_ptr<Task> & task, std::size_t id,
+                         std::chrono::steady_clock::time_point start)
+{
+  task->threadId = id;
+  std::atomic_store(&tasksInThreads[id], task);
+  workerSlots[id].set(task->taskId, task->getPriority(), start);
+  handleTaskStateChange(task, Task::State::Running);
+  bool ret = task->run(task);
+  Task::State s = (ret ? Task::State::Done : Task::State::Failed);
+  if(!task->transition(Task::State::Running, s))
+  {
+    // cancel() requested a stop while the task was running
+    s = Task::State::Canceled;
+    task->setState(s);
+  }
+  auto end = std::chrono::steady_clock::now();
+  workerStats[id].taskFinished(s == Task::State::Done,
+                               s == Task::State::Canceled,
+                               end - start);
+  if(isTracing())
+  {
+    tracer->record(id, TaskTracer::Kind::Run, task->taskId, start, end);
+  }
+  workerSlots[id].clear();
+  task->finish(s);
+  handleTaskStateChange(task, s);
+  releaseSuccessors(task);
+  task->notifyFinished();
+}
+
+void ThreadPool::handleTaskStateChange(const std::shared_ptr<Task> & task,
+                                       Task::State s)
+{
+  // the reference to the pool is only taken if somebody listens
+  if(task->hasObservers(s))
+  {
+    if(isTracing())
+    {
+      auto begin = std::chrono::steady_clock::now();
+      task->handleStateChange(s, shared_from_this());
+      tracer->record(getCurrentWorker(), TaskTracer::Kind::Observers,
+                     task->taskId, begin, std::chrono::steady_clock::now());
+    }
+    else
+    {
+      task->handleStateChange(s, shared_from_this());
+    }
+  }
+  if(eventBus)
+  {
+    // Ready carries the time the task became ready, which is the time
+    // the queue wait of the tracer and the statistics starts
+    std::size_t worker = getCurrentWorker();
+    TaskEvent event = { task->taskId,
+                        (worker == TaskQueue::noWorker ?
+                         Task::undefinedThreadId : worker),
+                        s,
+                        (s == Task::State::Ready ?
+                         task->readyTime :
+                         std::chrono::steady_clock::now()) };
+    eventBus->publish(worker, event);
+  }
+}
+
+ThreadPool::ScheduleAwaitable::ScheduleAwaitable(std::shared_ptr<ThreadPool> _pool)
+  : pool(std::move(_pool)), canceled(false)
+{
+}
+
+ThreadPool::ScheduleAwaitable ThreadPool::schedule()
+{
+  return ScheduleAwaitable(shared_from_this());
+}
+
+const std::shared_ptr<FrameAllocator> & ThreadPool::getFrameAllocator() const
+{
+  return frameAllocator;
 }
 
 void ThreadPool::onStateChange(State s,
 			       std::function<void(std::shared_ptr<ThreadPool>)> func)
 {
-  unsigned int ints = (unsigned int)s;
-  stateChanges[ints].push_back(func);
+  stateChanges[stateIndex((unsigned int)s)].push_back(func);
 }
 
 void ThreadPool::handleStateChange()
 {
-  auto itr = stateChanges.find((unsigned int)state);
-  if(itr != stateChanges.end())
+  unsigned int index = stateIndex((unsigned int)state.load());
+  if(!stateChanges[index].empty())
   {
     auto self = shared_from_this();
-    for(auto func : itr->second)
+    for(auto & func : stateChanges[index])
     {
       func(self);
     }
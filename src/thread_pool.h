@@ -6,11 +6,33 @@
 #include <vector>
 #include <queue>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
 #include "task.h"
+#include "value_task.h"
+#include "task_queue.h"
+#include "cpu_topology.h"
+#include "event_bus.h"
+#include "pool_stats.h"
+#include "task_tracer.h"
+#include "frame_allocator.h"
+#include "timer_wheel.h"
+#include "pool_snapshot.h"
+
+/** thrown by addTask when the queue is full and the policy is Overflow::Reject */
+class QueueFull : public std::runtime_error
+{
+public:
+  QueueFull() : std::runtime_error("ThreadPool queue is full")
+  {
+  }
+};
 
 class ThreadPool : public std::enable_shared_from_this<ThreadPool>
 {
 public:
+  friend class Task;
   enum class State : unsigned int
   {
     Waiting            = 1,  // Waiting -> Active
@@ -18,47 +40,507 @@ public:
     Terminated         = 4
   };
 
+  enum class Scheduler : unsigned int
+  {
+    Fifo               = 1,  // single queue shared by all workers
+    WorkStealing       = 2,  // per-worker deques and injection queue
+    LockFreeRing       = 4,  // lock-free ring shared by all workers, addTask overflows to a list
+    Priority           = 8   // one queue per Task::Priority with aging
+  };
+
+  /** what a submission does when the maximum queue depth is reached */
+  enum class Overflow : unsigned int
+  {
+    Block              = 1,  // wait for a free slot, trySubmit fails
+    Reject             = 2,  // addTask throws QueueFull, trySubmit fails
+    DropOldest         = 4,  // cancel the oldest Ready task
+    CallerRuns         = 8   // run the task in the submitting thread
+  };
+
+  /** how idle workers wait for tasks */
+  enum class WaitStrategy : unsigned int
+  {
+    Block              = 1,  // condition variable shared by all workers
+    Park               = 2,  // per-worker parking slot, one wake-up per task
+    SpinThenPark       = 4   // poll the queue for a while, then park
+  };
+
+  /** what terminate() does with tasks that have not started */
+  enum class Shutdown : unsigned int
+  {
+    Drain              = 1,  // run every queued task
+    DrainUntil         = 2,  // run queued tasks until the timeout, cancel the rest
+    Cancel             = 4   // cancel queued tasks at once
+  };
+
+  enum class Affinity : unsigned int
+  {
+    None               = 1,  // workers float freely
+    Compact            = 2,  // one CPU per worker, fill a node first
+    Scatter            = 4,  // one CPU per worker, alternate the nodes
+    CpuList            = 8,  // one CPU per worker from an explicit list
+    NumaNode           = 16  // workers bound to a node, one queue per node
+  };
+
+  static const unsigned int numStates = 3;
+  static const std::size_t defaultRingCapacity;
+  static const std::chrono::milliseconds defaultAgingInterval;
+  static const std::chrono::milliseconds defaultKeepAlive;
+  static const std::chrono::milliseconds defaultGrowQueueWait;
+  /** how often a helping worker looks for new Ready tasks */
+  static const std::chrono::microseconds helpPollInterval;
+  /** queue polls of WaitStrategy::SpinThenPark before a worker parks */
+  static const std::size_t defaultSpinCount;
+  /** due times of timed tasks are rounded up to it */
+  static const std::chrono::milliseconds timerResolution;
+
   ~ThreadPool();
 
-  static std::shared_ptr<ThreadPool> create(std::size_t n);
+  static std::shared_ptr<ThreadPool> create(std::size_t n,
+                                            Scheduler scheduler = Scheduler::Fifo,
+                                            std::size_t capacity = 0);
+  /**
+   * Elastic pool: starts minThreads workers and adds workers up to
+   * maxThreads when tasks queue up while no worker is idle.
+   * Workers that stay idle for the keep-alive timeout retire until
+   * minThreads are left, but one stays while timers are pending.
+   */
+  static std::shared_ptr<ThreadPool> createElastic(std::size_t minThreads,
+                                                   std::size_t maxThreads,
+                                                   Scheduler scheduler = Scheduler::Fifo,
+                                                   std::size_t capacity = 0);
   static std::string stateToString(State s);
 
   void activate();
-  void terminate();
+  /**
+   * Stops the pool and joins the workers.
+   * With Shutdown::Cancel, or once the timeout of Shutdown::DrainUntil
+   * has passed, the workers cancel queued tasks as they pop them instead
+   * of running them, and running tasks get a cancel request. Successors
+   * of canceled tasks are canceled with them. Successors and
+   * continuations released while the workers are still running are
+   * queued like any task, so Drain runs dependency chains to their
+   * end. Timed tasks that are not due are canceled in every mode, and
+   * so are tasks released after the workers have left.
+   * Returns the tasks of this pool canceled before terminate() returns,
+   * none of which ran: queued, timed and waiting ones and the
+   * continuations of its tasks, to hand them off or persist them.
+   */
+  std::vector<std::shared_ptr<Task> > terminate(Shutdown mode = Shutdown::Drain,
+                                                std::chrono::steady_clock::duration timeout =
+                                                std::chrono::steady_clock::duration::zero());
   void addTask(std::shared_ptr<Task> task);
+  template<typename ITR>
+  void addTasks(ITR first, ITR last);
+  void addTasks(std::vector<std::shared_ptr<Task> > && tasks);
+  /**
+   * Like addTask, but false instead of waiting, throwing or running the
+   * task in the caller when the queue is full. With the LockFreeRing
+   * scheduler also false while the ring is full, where addTask falls
+   * back to an unbounded list, and until that list has drained.
+   */
+  bool trySubmit(std::shared_ptr<Task> task);
+  /**
+   * Adds a task that stays Waiting until time, then it becomes Ready
+   * like a task whose last predecessor has finished. The workers fire
+   * the timers between tasks, so no thread is added but a timer can be
+   * late while every worker is busy. Timed tasks that are not due when
+   * the pool terminates are canceled.
+   */
+  void addTaskAt(std::chrono::steady_clock::time_point time, std::shared_ptr<Task> task);
+  void addTaskAfter(std::chrono::steady_clock::duration delay, std::shared_ptr<Task> task);
+  /**
+   * Adds a task running func every period, the first one a period from
+   * now, until the returned handle is canceled or the pool terminates.
+   * Late runs are not caught up, the next period starts when a late
+   * one is added.
+   */
+  template<typename F>
+  std::shared_ptr<PeriodicTask> addPeriodicTask(std::chrono::steady_clock::duration period,
+                                                F && func);
+  /** timed and periodic tasks that wait for their time */
+  std::size_t numTimers() const;
+  /**
+   * Called on a worker of this pool, runs one Ready task instead of
+   * blocking. The worker takes the tasks it queued itself first when
+   * the scheduler keeps them apart (WorkStealing). False if no task is
+   * Ready or the calling thread is no worker of this pool.
+   */
+  bool runPendingTask();
+  /** pool of the calling worker, null on other threads */
+  static ThreadPool * getCurrentPool();
+  /** wraps func in a ValueTask and adds it */
+  template<typename F>
+  std::shared_ptr<ValueTask<typename InvokeResult<typename std::decay<F>::type&>::type> >
+  submit(F && func);
 
+  /** current number of workers */
   std::size_t size() const;
+  std::size_t getMinSize() const;
+  std::size_t getMaxSize() const;
+  /** elastic pools only, before activation */
+  void setKeepAlive(std::chrono::steady_clock::duration keepAlive);
+  /**
+   * A worker is added when queueDepth tasks are ready, or a task
+   * waited longer than queueWait, while no worker is idle.
+   * Elastic pools only, before activation.
+   */
+  void setGrowThreshold(std::size_t queueDepth,
+                        std::chrono::steady_clock::duration queueWait);
+  Scheduler getScheduler() const;
+  std::size_t getCapacity() const;
+  /**
+   * Bounds the number of Ready tasks, 0 for no bound. Tasks that still
+   * wait for predecessors do not count and are never rejected. With
+   * concurrent producers the bound can be exceeded by their number.
+   * Overflow::Block does not block before activation, and workers that
+   * submit to their own full pool run Ready tasks instead of blocking.
+   * addTasks() waits until, or with Overflow::Reject throws unless, the
+   * whole batch fits; a batch larger than the bound fits into an empty
+   * queue. Set before tasks are added.
+   */
+  void setMaxQueueDepth(std::size_t depth, Overflow policy = Overflow::Block);
+  std::size_t getMaxQueueDepth() const;
+  Overflow getOverflow() const;
+  /** Priority scheduler only, kept when setAffinity() creates the queues */
+  void setAgingInterval(std::chrono::steady_clock::duration interval);
+  std::chrono::steady_clock::duration getAgingInterval() const;
+  /**
+   * Parked workers sleep on a slot of their own and a submission wakes
+   * exactly as many of them as it queued tasks, without touching the
+   * pool mutex. Spinning trades CPU time for a faster start of tasks
+   * that arrive shortly after a worker ran out of work; it only pays
+   * off with a core per worker. Set before tasks are added.
+   */
+  void setWaitStrategy(WaitStrategy strategy, std::size_t spinCount = defaultSpinCount);
+  WaitStrategy getWaitStrategy() const;
+  /**
+   * Worker placement, set before tasks are added.
+   * The CPU list is used by Affinity::CpuList only. With a single NUMA
+   * node Affinity::NumaNode keeps the queue of the scheduler.
+   */
+  void setAffinity(Affinity policy,
+                   const CpuTopology::cpu_list_type & cpus = CpuTopology::cpu_list_type());
+  void setAffinity(Affinity policy, const CpuTopology & topology,
+                   const CpuTopology::cpu_list_type & cpus = CpuTopology::cpu_list_type());
+  Affinity getAffinity() const;
+  /** CPUs worker id is bound to, empty if it floats */
+  CpuTopology::cpu_list_type getWorkerCpus(std::size_t id) const;
   std::size_t numTasks(Task::State s) const;
+  /**
+   * Task counts and latency histograms merged from the workers without
+   * taking the pool mutex. Counters are read one after the other, so the
+   * snapshot is only consistent once the pool is quiet.
+   */
+  PoolStats getStats() const;
   State getState() const;
+  /**
+   * Queued tasks and the last task of each worker. Copies the whole
+   * queue under its locks, monitoring should prefer getSnapshot() and
+   * getQueuedTaskIds().
+   */
   std::pair<std::vector<std::shared_ptr<Task> >,
 	    std::vector<std::shared_ptr<Task> > > getTasks() const;
+  /** number of Ready tasks, a single atomic load */
+  std::size_t getQueueDepth() const;
+  /**
+   * Queue depth and the task each current worker runs, read without
+   * any lock. Every worker entry is consistent in itself, the entries
+   * are taken one after the other.
+   */
+  PoolSnapshot getSnapshot() const;
+  /**
+   * Page of the ids of queued tasks, see TaskQueue::getTaskIds. Tasks
+   * canceled while queued are listed until a worker drops them, the
+   * Ring scheduler lists none.
+   */
+  std::vector<std::size_t> getQueuedTaskIds(std::size_t offset, std::size_t limit) const;
+  /**
+   * Publish every task state change as a TaskEvent to listeners that run
+   * on a dispatcher thread, so workers never wait for them.
+   * Enable and add listeners before activation.
+   */
+  void enableEventBus(std::size_t capacity = EventBus::defaultCapacity,
+                      EventBus::Overflow overflow = EventBus::Overflow::Drop);
+  void onTaskEvents(EventBus::listener_type listener);
+  std::size_t numDroppedEvents() const;
+  /**
+   * Record spans of queue wait, run time, observer callbacks and lock
+   * wait for a Chrome trace. Enable before tasks are added, then record
+   * windows with startTracing() and stopTracing().
+   */
+  void enableTracing(std::size_t capacity = TaskTracer::defaultCapacity);
+  void startTracing();
+  void stopTracing();
+  /** Chrome trace-event JSON of the current or last recording */
+  void writeTrace(std::ostream & os) const;
 
   void onStateChange(State s,
                      std::function<void(std::shared_ptr<ThreadPool>)> func);
 
+  /**
+   * Awaitable of C++20 coroutines (coroutine.h): co_await
+   * pool->schedule() suspends the coroutine and resumes it on a worker.
+   * If the pool cancels the task that resumes it, dropped by
+   * Overflow::DropOldest or discarded by terminate(), the coroutine
+   * resumes on the canceling thread and co_await throws TaskCanceled.
+   */
+  class ScheduleAwaitable
+  {
+  public:
+    ScheduleAwaitable(std::shared_ptr<ThreadPool> pool);
+    bool await_ready() const
+    {
+      return false;
+    }
+    template<typename Handle>
+    void await_suspend(Handle handle)
+    {
+      // whichever of the task and its cancellation comes first resumes
+      auto claimed = std::make_shared<std::atomic<bool> >(false);
+      auto task = Task::create([handle, claimed]() mutable {
+          if(!claimed->exchange(true))
+          {
+            handle.resume();
+          }
+        });
+      // the awaitable lives in the frame until the coroutine resumes
+      bool * c = &canceled;
+      task->onStateChange(Task::State::Canceled,
+                          [handle, claimed, c](std::shared_ptr<Task>,
+                                               std::shared_ptr<ThreadPool>) mutable {
+                            if(!claimed->exchange(true))
+                            {
+                              *c = true;
+                              handle.resume();
+                            }
+                          });
+      pool->addTask(task);
+    }
+    void await_resume() const
+    {
+      if(canceled)
+      {
+        throw TaskCanceled();
+      }
+    }
+
+  private:
+    std::shared_ptr<ThreadPool> pool;
+    bool canceled;
+  };
+
+  ScheduleAwaitable schedule();
+  /** allocates the frames of coroutines that take the pool as first argument */
+  const std::shared_ptr<FrameAllocator> & getFrameAllocator() const;
+
 protected:
   void runThread(std::size_t id);
 
 private:
-  ThreadPool(std::size_t n);
+  ThreadPool(std::size_t minThreads, std::size_t maxThreads,
+             Scheduler scheduler, std::size_t capacity);
+  static TaskQueue * createTaskQueue(Scheduler scheduler,
+                                     std::size_t numWorkers,
+                                     std::size_t capacity,
+                                     std::chrono::steady_clock::duration agingInterval);
   void handleStateChange();
+  void checkElasticSetup() const;
+  /** the queue of the Priority scheduler, one per NUMA node */
+  std::vector<PriorityTaskQueue*> getPriorityQueues() const;
+  void startWorker(std::size_t id);
+  void growIfBusy(std::chrono::steady_clock::duration waited);
+  void grow();
+  bool enqueue(std::shared_ptr<Task> task, bool block);
+  /**
+   * queues tasks released by their predecessors, cancels them once the
+   * workers of a terminated pool have left
+   */
+  void makeReady(const std::vector<std::shared_ptr<Task> > & tasks);
+  /**
+   * true while released tasks can still run: before terminate() and
+   * until its workers have left. The caller holds a SubmissionGuard.
+   */
+  bool acceptsReleased();
+  /**
+   * owns a continuation of a terminated pool that is canceled before it
+   * was queued, so terminate() returns it
+   */
+  void adopt(const std::shared_ptr<Task> & task);
+  /** queues Waiting tasks, the caller holds a SubmissionGuard */
+  void queueReady(const std::vector<std::shared_ptr<Task> > & tasks);
+  static bool cancel(std::shared_ptr<Task> task);
+  void runReady(const std::shared_ptr<Task> & task, std::size_t id);
+  /** runs a Ready task that was not queued on the submitting thread */
+  void runInCaller(const std::shared_ptr<Task> & task);
+  /** true if n more Ready tasks do not fit */
+  bool isQueueFull(std::size_t n) const;
+  /** applies the overflow policy, true if the task may be queued */
+  bool makeRoom(bool block, std::size_t n);
+  void waitForSpace(std::size_t n);
+  bool dropOldest();
+  /** a Ready task left the queue */
+  void releaseQueueSlot();
+  void addTimer(TimerWheel::Entry && entry);
+  void addPeriodic(std::shared_ptr<PeriodicTask> periodic);
+  /** fires the due timers unless another worker does */
+  void pollTimers();
+  void fireTimers(std::vector<TimerWheel::Entry> & expired);
+  /** cancels the tasks of timers that did not fire */
+  void cancelTimers(std::vector<TimerWheel::Entry> & entries);
+  std::chrono::steady_clock::time_point getTimerDeadline() const;
+  /** asks the tasks running on the workers to cancel */
+  void cancelRunning();
+  /** true once terminate() wants popped tasks canceled */
+  bool isDiscarding() const;
+  void discard(const std::shared_ptr<Task> & task);
+  /** collects a canceled task for terminate() to return */
+  void addUnrun(const std::shared_ptr<Task> & task);
+  static void finishCanceled(std::shared_ptr<Task> task, Task::State from);
+  static void releaseSuccessors(std::shared_ptr<Task> task);
+  /**
+   * queues continuations and other tasks released by the pool, cancels
+   * them after terminate()
+   */
+  void addContinuations(const std::vector<std::shared_ptr<Task> > & tasks);
+  /** queues or cancels a continuation whose predecessors have been released */
+  static void releaseContinuation(std::shared_ptr<Task> task,
+                                  std::shared_ptr<ThreadPool> pool,
+                                  bool done);
+  /** runs a Finally continuation on the calling thread */
+  static void runDetached(std::shared_ptr<Task> task);
+  static bool isContinuationCanceled(const std::shared_ptr<Task> & task, bool done);
+  void runTask(const std::shared_ptr<Task> & task, std::size_t id,
+               std::chrono::steady_clock::time_point start);
+  /** runs a Ready task on worker id inside the task the worker runs */
+  void runNested(const std::shared_ptr<Task> & task, std::size_t id);
+  void handleTaskStateChange(const std::shared_ptr<Task> & task, Task::State s);
+  void notifyWorkers(std::size_t n);
+  /** true if a task was queued while spinning */
+  bool spinForTask() const;
+  void enterIdle(std::size_t id);
+  void leaveIdle(std::size_t id);
+  void unparkWorkers(std::size_t n);
+  bool isTracing() const;
+  std::size_t getCurrentWorker() const;
 
   typedef std::mutex mutex_type;
   typedef std::shared_ptr<ThreadPool> shared_self_type;
   typedef std::function<void(shared_self_type)> state_change_func_type;
-  typedef std::list<state_change_func_type> state_change_func_list_type;
+  typedef std::vector<state_change_func_type> state_change_func_list_type;
+
+  /** locks the pool mutex, recording the wait if it is contended */
+  void lockTraced(std::unique_lock<mutex_type> & lock);
+  /**
+   * Waits until notified or until the time, false on timeout. Parked
+   * workers wake up without the pool mutex, the lock is only held
+   * again after a timeout.
+   */
+  bool waitIdle(std::unique_lock<mutex_type> & lock, std::size_t id,
+                std::chrono::steady_clock::time_point until);
 
   mutable mutex_type mutex;
   std::thread::id mainThreadId;
-  std::list<std::thread> threads;
-  std::list<std::shared_ptr<Task> > taskQueue;
+  // one slot per potential worker, retired slots are reused by grow()
+  std::vector<std::thread> threads;
+  std::unique_ptr<std::atomic<bool>[]> workerActive;
+  std::unique_ptr<TaskQueue> taskQueue;
   std::vector<std::shared_ptr<Task> > tasksInThreads;
+  // written by the own worker only, see getSnapshot()
+  std::unique_ptr<WorkerSlot[]> workerSlots;
   std::condition_variable condition;
-  State state;
-  std::size_t threadPoolSize;
-  std::size_t numDone;
-  std::size_t numFailed;
-  std::size_t taskCounter;
-  std::unordered_map<unsigned int,
-		     state_change_func_list_type> stateChanges;
+  std::atomic<State> state;
+  Scheduler scheduler;
+  std::size_t queueCapacity;
+  Affinity affinity;
+  // of the Priority scheduler, kept for the queues setAffinity() creates
+  std::chrono::steady_clock::duration agingInterval;
+  std::vector<CpuTopology::cpu_list_type> workerCpus;
+  std::size_t minThreads;
+  std::size_t maxThreads;
+  std::size_t growQueueDepth;
+  std::chrono::steady_clock::duration growQueueWait;
+  std::chrono::steady_clock::duration keepAlive;
+  std::atomic<std::size_t> numThreads;
+  std::atomic<std::size_t> numIdle;
+  WaitStrategy waitStrategy;
+  std::size_t spinCount;
+  struct Parker
+  {
+    static const std::size_t cacheLine = 64;
+    char pad0[cacheLine];
+    mutex_type mutex;
+    std::condition_variable condition;
+    bool notified;
+  };
+  std::unique_ptr<Parker[]> parkers;
+  // parked workers that have not been woken, the last one parked first
+  mutex_type idleMutex;
+  std::vector<std::size_t> idleWorkers;
+  std::atomic<std::size_t> numSubmitting;
+  std::atomic<std::size_t> numWaiting;
+  std::atomic<std::size_t> numReady;
+  // canceled before they ran, the workers count everything else
+  std::atomic<std::size_t> numCanceled;
+  // one per worker plus one for tasks run by submitting threads,
+  // which is written under callerMutex
+  std::unique_ptr<WorkerStats[]> workerStats;
+  mutex_type callerMutex;
+  std::size_t maxQueueDepth;
+  Overflow overflow;
+  mutex_type spaceMutex;
+  std::condition_variable spaceCondition;
+  std::atomic<std::size_t> numBlocked;
+  std::atomic<std::size_t> numRejected;
+  std::atomic<std::size_t> numDropped;
+  std::atomic<std::size_t> numCallerRuns;
+  std::atomic<std::size_t> taskCounter;
+  // the wheel is created by the first timer
+  mutex_type timerMutex;
+  std::unique_ptr<TimerWheel> timerWheel;
+  std::atomic<std::size_t> timerCount;
+  // earliest time the wheel may expire a timer, written under timerMutex
+  std::atomic<std::chrono::steady_clock::rep> timerDeadline;
+  // popped tasks are canceled from then on, duration::max() if never
+  std::atomic<std::chrono::steady_clock::rep> discardTime;
+  // workers that left after termination, under mutex
+  std::size_t numExited;
+  std::condition_variable exitCondition;
+  mutex_type unrunMutex;
+  std::vector<std::shared_ptr<Task> > unrunTasks;
+  // set once terminate() took unrunTasks, under unrunMutex
+  bool unrunCollected;
+  // indexed by the bit of the state
+  state_change_func_list_type stateChanges[numStates];
+  std::unique_ptr<EventBus> eventBus;
+  std::unique_ptr<TaskTracer> tracer;
+  std::shared_ptr<FrameAllocator> frameAllocator;
 };
+
+template<typename ITR>
+void ThreadPool::addTasks(ITR first, ITR last)
+{
+  addTasks(std::vector<std::shared_ptr<Task> >(first, last));
+}
+
+template<typename F>
+std::shared_ptr<ValueTask<typename InvokeResult<typename std::decay<F>::type&>::type> >
+ThreadPool::submit(F && func)
+{
+  typedef typename InvokeResult<typename std::decay<F>::type&>::type value_type;
+  auto task = ValueTask<value_type>::create(std::forward<F>(func));
+  addTask(task);
+  return task;
+}
+
+template<typename F>
+std::shared_ptr<PeriodicTask>
+ThreadPool::addPeriodicTask(std::chrono::steady_clock::duration period, F && func)
+{
+  typename std::decay<F>::type f(std::forward<F>(func));
+  auto periodic = std::make_shared<PeriodicTask>(period, [f]() {
+      return Task::create(f);
+    });
+  addPeriodic(periodic);
+  return periodic;
+}
@@ -0,0 +1,238 @@
+#include "timer_wheel.h"
+#include <stdexcept>
+#include <utility>
+
+const unsigned int TimerWheel::firstLevelBits;
+const unsigned int TimerWheel::levelBits;
+const unsigned int TimerWheel::numLevels;
+
+namespace
+{
+  inline unsigned int shiftOf(unsigned int level)
+  {
+    return (level == 0 ? 0 :
+            TimerWheel::firstLevelBits + (level - 1) * TimerWheel::levelBits);
+  }
+
+  inline std::uint64_t slotsOf(unsigned int level)
+  {
+    return (std::uint64_t(1) <<
+            (level == 0 ? TimerWheel::firstLevelBits : TimerWheel::levelBits));
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// PeriodicTask
+//
+///////////////////////////////////////////////////////////////////////////////
+PeriodicTask::PeriodicTask(std::chrono::steady_clock::duration _period,
+                           factory_type _factory)
+  : period(_period), factory(std::move(_factory)), canceled(false), runs(0)
+{
+  if(period <= std::chrono::steady_clock::duration::zero())
+  {
+    throw std::logic_error("Period must be positive");
+  }
+}
+
+void PeriodicTask::cancel()
+{
+  canceled = true;
+}
+
+bool PeriodicTask::isCanceled() const
+{
+  return canceled;
+}
+
+std::chrono::steady_clock::duration PeriodicTask::getPeriod() const
+{
+  return period;
+}
+
+std::size_t PeriodicTask::numRuns() const
+{
+  return runs;
+}
+
+std::shared_ptr<Task> PeriodicTask::createTask()
+{
+  runs++;
+  return factory();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// TimerWheel
+//
+///////////////////////////////////////////////////////////////////////////////
+TimerWheel::TimerWheel(clock_type::duration _resolution, clock_type::time_point _start)
+  : resolution(_resolution), start(_start), current(0), count(0), firstLevelCount(0)
+{
+  if(resolution <= clock_type::duration::zero())
+  {
+    throw std::logic_error("Resolution must be positive");
+  }
+  for(unsigned int level = 0; level < numLevels; level++)
+  {
+    levels[level].resize(slotsOf(level));
+  }
+}
+
+std::uint64_t TimerWheel::tickOf(clock_type::time_point t) const
+{
+  if(t <= start)
+  {
+    return 0;
+  }
+  clock_type::duration d = t - start;
+  std::uint64_t tick = std::uint64_t(d / resolution);
+  return (d % resolution == clock_type::duration::zero() ? tick : tick + 1);
+}
+
+TimerWheel::clock_type::time_point TimerWheel::timeOf(std::uint64_t tick) const
+{
+  return start + resolution * tick;
+}
+
+void TimerWheel::add(Entry && entry)
+{
+  std::uint64_t tick = tickOf(entry.time);
+  if(tick < current)
+  {
+    tick = current;
+  }
+  place(Timer{tick, std::move(entry)});
+  count++;
+}
+
+void TimerWheel::place(Timer && timer)
+{
+  // beyond the last level the timer is parked in its farthest slot
+  const std::uint64_t span = std::uint64_t(1) << shiftOf(numLevels);
+  std::uint64_t delta = timer.tick - current;
+  std::uint64_t tick = (delta < span ? timer.tick : current + span - 1);
+  if(delta >= span)
+  {
+    delta = span - 1;
+  }
+  unsigned int level = 0;
+  while(level + 1 < numLevels && delta >= (std::uint64_t(1) << shiftOf(level + 1)))
+  {
+    level++;
+  }
+  std::uint64_t slot = (tick >> shiftOf(level)) & (slotsOf(level) - 1);
+  levels[level][slot].push_back(std::move(timer));
+  if(level == 0)
+  {
+    firstLevelCount++;
+  }
+}
+
+void TimerWheel::cascade(unsigned int level)
+{
+  std::uint64_t slot = (current >> shiftOf(level)) & (slotsOf(level) - 1);
+  std::vector<Timer> timers;
+  timers.swap(levels[level][slot]);
+  for(Timer & timer : timers)
+  {
+    place(std::move(timer));
+  }
+}
+
+void TimerWheel::advance(clock_type::time_point now, std::vector<Entry> & expired)
+{
+  if(now < start)
+  {
+    return;
+  }
+  const std::uint64_t last = std::uint64_t((now - start) / resolution);
+  while(current <= last)
+  {
+    if(count == 0)
+    {
+      current = last + 1;
+      break;
+    }
+    const std::uint64_t firstMask = slotsOf(0) - 1;
+    if((current & firstMask) == 0)
+    {
+      // lower levels first, a timer never cascades into a slot that has
+      // been emptied already
+      for(unsigned int level = 1; level < numLevels; level++)
+      {
+        cascade(level);
+        if(((current >> shiftOf(level)) & (slotsOf(level) - 1)) != 0)
+        {
+          break;
+        }
+      }
+    }
+    if(firstLevelCount == 0)
+    {
+      // nothing due before the next turn of the first level
+      std::uint64_t next = (current | firstMask) + 1;
+      current = (next <= last ? next : last + 1);
+      continue;
+    }
+    std::vector<Timer> & slot = levels[0][current & firstMask];
+    for(Timer & timer : slot)
+    {
+      expired.push_back(std::move(timer.entry));
+    }
+    firstLevelCount -= slot.size();
+    count -= slot.size();
+    slot.clear();
+    current++;
+  }
+}
+
+TimerWheel::clock_type::time_point TimerWheel::nextExpiry() const
+{
+  if(count == 0)
+  {
+    return clock_type::time_point::max();
+  }
+  const std::uint64_t firstMask = slotsOf(0) - 1;
+  // next tick that cascades the upper levels
+  const std::uint64_t turn = (current + firstMask) & ~firstMask;
+  if(firstLevelCount != 0)
+  {
+    for(std::uint64_t tick = current; tick < current + slotsOf(0); tick++)
+    {
+      if(!levels[0][tick & firstMask].empty())
+      {
+        // entries after the turn compete with the cascaded ones
+        if(tick < turn || firstLevelCount == count)
+        {
+          return timeOf(tick);
+        }
+        break;
+      }
+    }
+  }
+  return timeOf(turn);
+}
+
+void TimerWheel::clear(std::vector<Entry> & out)
+{
+  for(unsigned int level = 0; level < numLevels; level++)
+  {
+    for(std::vector<Timer> & slot : levels[level])
+    {
+      for(Timer & timer : slot)
+      {
+        out.push_back(std::move(timer.entry));
+      }
+      slot.clear();
+    }
+  }
+  count = 0;
+  firstLevelCount = 0;
+}
+
+std::size_t TimerWheel::size() const
+{
+  return count;
+}
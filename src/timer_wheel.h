@@ -0,0 +1,99 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class Task;
+
+/**
+ * Handle of a task that the pool creates again every period, see
+ * ThreadPool::addPeriodicTask.
+ */
+class PeriodicTask
+{
+public:
+  typedef std::function<std::shared_ptr<Task>()> factory_type;
+
+  PeriodicTask(std::chrono::steady_clock::duration period, factory_type factory);
+
+  /** no further tasks are created, one that was created already runs */
+  void cancel();
+  bool isCanceled() const;
+  std::chrono::steady_clock::duration getPeriod() const;
+  /** number of tasks created so far */
+  std::size_t numRuns() const;
+  std::shared_ptr<Task> createTask();
+
+private:
+  std::chrono::steady_clock::duration period;
+  factory_type factory;
+  std::atomic<bool> canceled;
+  std::atomic<std::size_t> runs;
+};
+
+/**
+ * Hierarchical timer wheel.
+ * Time is counted in ticks of the resolution. The first level has one
+ * slot per tick for the next 256 ticks, each further level has 64
+ * slots that each span a whole turn of the level below. Insertion is
+ * O(1); when the lower level completes a turn, the next slot of the
+ * level above is cascaded down, so every timer moves at most three
+ * times before it expires. Timers beyond the last level are parked in
+ * its farthest slot and placed again when they are cascaded.
+ * Not synchronized.
+ */
+class TimerWheel
+{
+public:
+  typedef std::chrono::steady_clock clock_type;
+
+  /** either a task of the pool or a periodic task */
+  struct Entry
+  {
+    clock_type::time_point time;
+    std::shared_ptr<Task> task;
+    std::shared_ptr<PeriodicTask> periodic;
+  };
+
+  static const unsigned int firstLevelBits = 8;
+  static const unsigned int levelBits = 6;
+  static const unsigned int numLevels = 4;
+
+  TimerWheel(clock_type::duration resolution, clock_type::time_point start);
+
+  /**
+   * Entries expire on the first tick not before their time, entries
+   * that are due already on the next advance().
+   */
+  void add(Entry && entry);
+  /** moves the entries that expired until now to expired */
+  void advance(clock_type::time_point now, std::vector<Entry> & expired);
+  /** lower bound of the next expiry, time_point::max() if empty */
+  clock_type::time_point nextExpiry() const;
+  /** moves all entries to out */
+  void clear(std::vector<Entry> & out);
+  std::size_t size() const;
+
+private:
+  struct Timer
+  {
+    std::uint64_t tick;
+    Entry entry;
+  };
+
+  std::uint64_t tickOf(clock_type::time_point t) const;
+  clock_type::time_point timeOf(std::uint64_t tick) const;
+  void place(Timer && timer);
+  void cascade(unsigned int level);
+
+  clock_type::duration resolution;
+  clock_type::time_point start;
+  // next tick to be processed
+  std::uint64_t current;
+  std::size_t count;
+  std::size_t firstLevelCount;
+  std::vector<std::vector<Timer> > levels[numLevels];
+};
@@ -0,0 +1,194 @@
+#pragma once
+#include <functional>
+#include <future>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "task.h"
+
+/** stored in the future of a ValueTask that was canceled before it ran */
+class TaskCanceled : public std::runtime_error
+{
+public:
+  TaskCanceled() : std::runtime_error("Task canceled")
+  {
+  }
+};
+
+/** the return value of a ValueTask function until the task finishes */
+template<typename T>
+class ValueTaskResult
+{
+public:
+  ValueTaskResult() : hasValue(false)
+  {
+  }
+  ValueTaskResult(const ValueTaskResult &) = delete;
+  ValueTaskResult & operator=(const ValueTaskResult &) = delete;
+  ~ValueTaskResult()
+  {
+    reset();
+  }
+
+  template<typename F>
+  void store(F & func, const std::shared_ptr<Task> & task)
+  {
+    new (storage) T(TaskInvoker<F>::invoke(func, task));
+    hasValue = true;
+  }
+
+  void setValue(std::promise<T> & promise)
+  {
+    promise.set_value(std::move(*reinterpret_cast<T*>(storage)));
+    reset();
+  }
+
+private:
+  void reset()
+  {
+    if(hasValue)
+    {
+      reinterpret_cast<T*>(storage)->~T();
+      hasValue = false;
+    }
+  }
+
+  // T need not be default constructible
+  alignas(T) unsigned char storage[sizeof(T)];
+  bool hasValue;
+};
+
+template<typename T>
+class ValueTaskResult<T&>
+{
+public:
+  template<typename F>
+  void store(F & func, const std::shared_ptr<Task> & task)
+  {
+    value = &TaskInvoker<F>::invoke(func, task);
+  }
+
+  void setValue(std::promise<T&> & promise)
+  {
+    promise.set_value(*value);
+  }
+
+private:
+  T * value = nullptr;
+};
+
+template<>
+class ValueTaskResult<void>
+{
+public:
+  template<typename F>
+  void store(F & func, const std::shared_ptr<Task> & task)
+  {
+    TaskInvoker<F>::invoke(func, task);
+  }
+
+  void setValue(std::promise<void> & promise)
+  {
+    promise.set_value();
+  }
+};
+
+/**
+ * Task with a typed result.
+ * The return value of the function is moved into the future, an
+ * exception thrown by the function is stored in the future and the task
+ * fails. A ValueTask is a Task, so it takes part in the state-change
+ * observers, dependencies and cancellation.
+ * The future is fulfilled once the task has reached its final state,
+ * before the observers of that state run, so a thread woken by the
+ * future sees the task Done, Failed or Canceled.
+ */
+template<typename T>
+class ValueTask : public Task
+{
+public:
+  typedef T value_type;
+
+  /** func is called with no arguments or with the task itself */
+  template<typename F>
+  static std::shared_ptr<ValueTask<T> > create(F && func);
+
+  /** can be retrieved once, like std::promise::get_future */
+  std::future<T> getFuture();
+
+  ValueTask(ConstructTag, function_type && func);
+
+protected:
+  void finish(State s) override;
+
+private:
+  template<typename F>
+  struct Body
+  {
+    F func;
+    bool operator()(const std::shared_ptr<Task> & task);
+  };
+
+  std::promise<T> result;
+  // written by the worker that runs the function, published in finish()
+  ValueTaskResult<T> value;
+  std::exception_ptr error;
+};
+
+template<typename T>
+template<typename F>
+std::shared_ptr<ValueTask<T> > ValueTask<T>::create(F && func)
+{
+  typedef Body<typename std::decay<F>::type> body_type;
+  return std::allocate_shared<ValueTask<T> >(TaskAllocator<ValueTask<T> >(), ConstructTag(),
+                                             function_type(body_type{ std::forward<F>(func) }));
+}
+
+template<typename T>
+ValueTask<T>::ValueTask(ConstructTag tag, function_type && func)
+  : Task(tag, std::move(func))
+{
+}
+
+template<typename T>
+template<typename F>
+bool ValueTask<T>::Body<F>::operator()(const std::shared_ptr<Task> & task)
+{
+  ValueTask<T> * self = static_cast<ValueTask<T>*>(task.get());
+  try
+  {
+    self->value.store(func, task);
+  }
+  catch(...)
+  {
+    self->error = std::current_exception();
+    return false;
+  }
+  return true;
+}
+
+template<typename T>
+std::future<T> ValueTask<T>::getFuture()
+{
+  return result.get_future();
+}
+
+template<typename T>
+void ValueTask<T>::finish(State s)
+{
+  // a task canceled while its function ran drops the outcome
+  if(s == State::Done)
+  {
+    value.setValue(result);
+  }
+  else if(s == State::Failed && error)
+  {
+    result.set_exception(error);
+  }
+  else
+  {
+    result.set_exception(std::make_exception_ptr(TaskCanceled()));
+  }
+}
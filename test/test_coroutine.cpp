@@ -0,0 +1,141 @@
+#include "coroutine.h"
+#include "catch.hpp"
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  CoTask<std::thread::id> resumeOnWorker(std::shared_ptr<ThreadPool> pool)
+  {
+    co_await pool->schedule();
+    co_return std::this_thread::get_id();
+  }
+
+  CoTask<int> awaitGate(std::shared_ptr<ThreadPool> pool,
+                        std::shared_ptr<Task> gate, int i)
+  {
+    co_await pool->schedule();
+    Task::State s = co_await gate;
+    co_return (s == Task::State::Done ? i : -1);
+  }
+
+  CoTask<long> sumJobs(std::shared_ptr<ThreadPool> pool,
+                       std::shared_ptr<Task> gate, int n)
+  {
+    std::vector<CoTask<int> > jobs;
+    for(int i = 0; i < n; i++)
+    {
+      jobs.push_back(awaitGate(pool, gate, i));
+    }
+    long sum = 0;
+    for(auto & job : jobs)
+    {
+      sum += co_await job;
+    }
+    co_return sum;
+  }
+
+  CoTask<Task::State> awaitTask(std::shared_ptr<Task> task)
+  {
+    co_return co_await task;
+  }
+
+  CoTask<void> throwOnWorker(std::shared_ptr<ThreadPool> pool)
+  {
+    co_await pool->schedule();
+    throw std::runtime_error("failed");
+  }
+}
+
+TEST_CASE("Coroutine_schedule_resumes_on_worker", "[Coroutine]")
+{
+  auto pool = ThreadPool::create(2);
+  pool->activate();
+  auto job = resumeOnWorker(pool);
+  CHECK(job.get() != std::this_thread::get_id());
+  pool->terminate();
+  CHECK(pool->numTasks(Task::State::Done) == 1u);
+}
+
+TEST_CASE("Coroutine_many_jobs_on_few_workers", "[Coroutine]")
+{
+  const int n = 2000;
+  std::atomic<bool> open(false);
+  auto pool = ThreadPool::create(2);
+  auto gate = Task::create([&open](){ open = true; });
+  pool->activate();
+  auto total = sumJobs(pool, gate, n);
+  // every job is suspended on the gate without holding a worker
+  CHECK_FALSE(total.isReady());
+  pool->addTask(gate);
+  CHECK(total.get() == long(n) * (n - 1) / 2);
+  CHECK(open);
+  pool->terminate();
+  // frames went back to the allocator of the pool
+  CHECK(pool->getFrameAllocator()->numCached() > 0u);
+}
+
+TEST_CASE("Coroutine_await_failed_and_canceled_tasks", "[Coroutine]")
+{
+  auto pool = ThreadPool::create(1);
+  pool->activate();
+  auto failing = Task::create([](){ return false; });
+  pool->addTask(failing);
+  failing->wait();
+  CHECK(awaitGate(pool, failing, 1).get() == -1);
+  // a task canceled before it is added has no pool, the canceling
+  // thread resumes the coroutine
+  auto canceled = Task::create([](){});
+  auto job = awaitGate(pool, canceled, 1);
+  canceled->cancel();
+  CHECK(job.get() == -1);
+  pool->terminate();
+}
+
+TEST_CASE("Coroutine_resume_task_dropped", "[Coroutine]")
+{
+  auto pool = ThreadPool::create(1);
+  pool->setMaxQueueDepth(1, ThreadPool::Overflow::DropOldest);
+  pool->activate();
+  std::atomic<bool> release(false);
+  auto blocker = Task::create([&release](){
+      while(!release)
+      {
+        std::this_thread::yield();
+      }
+    });
+  pool->addTask(blocker);
+  while(blocker->getState() != Task::State::Running)
+  {
+    std::this_thread::yield();
+  }
+  // the task that would resume the coroutine is dropped, the coroutine
+  // resumes here with an error instead of never
+  auto job = resumeOnWorker(pool);
+  pool->addTask(Task::create([](){}));
+  CHECK(job.isReady());
+  CHECK_THROWS_AS(job.get(), TaskCanceled);
+  // the continuation of an awaited task is dropped
+  auto gate = Task::create([](){});
+  pool->addTask(gate);
+  auto awaiting = awaitTask(gate);
+  gate->cancel();
+  pool->addTask(Task::create([](){}));
+  CHECK(awaiting.isReady());
+  CHECK(awaiting.get() == Task::State::Canceled);
+  release = true;
+  pool->terminate();
+}
+
+TEST_CASE("Coroutine_exception_is_rethrown", "[Coroutine]")
+{
+  auto pool = ThreadPool::create(1);
+  pool->activate();
+  auto job = throwOnWorker(pool);
+  CHECK_THROWS_AS(job.get(), std::runtime_error);
+  pool->terminate();
+}
+#endif
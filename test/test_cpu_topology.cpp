@@ -0,0 +1,33 @@
+#include "cpu_topology.h"
+#include "catch.hpp"
+
+typedef CpuTopology::cpu_list_type cpu_list_type;
+
+TEST_CASE("CpuTopology_parse_cpu_list", "[CpuTopology]")
+{
+  CHECK(CpuTopology::parseCpuList("0") == cpu_list_type({0}));
+  CHECK(CpuTopology::parseCpuList("0-3,8,10-11\n") ==
+        cpu_list_type({0, 1, 2, 3, 8, 10, 11}));
+  CHECK(CpuTopology::parseCpuList("").empty());
+}
+
+TEST_CASE("CpuTopology_placement", "[CpuTopology]")
+{
+  CpuTopology topology({ {0, 1, 2}, {}, {4, 5} });
+  REQUIRE(topology.numNodes() == 2u);
+  CHECK(topology.getCpus() == cpu_list_type({0, 1, 2, 4, 5}));
+  CHECK(topology.compact(6) ==
+        std::vector<cpu_list_type>({ {0}, {1}, {2}, {4}, {5}, {0} }));
+  CHECK(topology.scatter(6) ==
+        std::vector<cpu_list_type>({ {0}, {4}, {1}, {5}, {2}, {0} }));
+  CHECK(topology.nodeLocal(3) ==
+        std::vector<cpu_list_type>({ {0, 1, 2}, {4, 5}, {0, 1, 2} }));
+}
+
+TEST_CASE("CpuTopology_detect", "[CpuTopology]")
+{
+  CpuTopology topology = CpuTopology::detect();
+  REQUIRE(topology.numNodes() >= 1u);
+  CHECK_FALSE(topology.getCpus().empty());
+  CHECK_THROWS(CpuTopology(std::vector<cpu_list_type>({ {} })));
+}
@@ -0,0 +1,161 @@
+#include "event_bus.h"
+#include "task_queue.h"
+#include "catch.hpp"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+static TaskEvent makeEvent(std::size_t taskId, std::size_t threadId)
+{
+  TaskEvent event = { taskId, threadId, Task::State::Ready,
+                      std::chrono::steady_clock::now() };
+  return event;
+}
+
+TEST_CASE("EventBus_delivers_in_time_order", "[EventBus]")
+{
+  EventBus bus(2, 16, EventBus::Overflow::Drop);
+  std::vector<TaskEvent> received;
+  std::mutex mutex;
+  bus.addListener([&received, &mutex](const std::vector<TaskEvent> & events) {
+      std::lock_guard<std::mutex> lock(mutex);
+      received.insert(received.end(), events.begin(), events.end());
+    });
+  // published before start, delivered once the dispatcher runs
+  CHECK(bus.publish(1, makeEvent(0, 1)));
+  CHECK(bus.publish(0, makeEvent(1, 0)));
+  CHECK(bus.publish(TaskQueue::noWorker, makeEvent(2, Task::undefinedThreadId)));
+  bus.start();
+  CHECK_THROWS(bus.addListener([](const std::vector<TaskEvent> &) {}));
+  bus.stop();
+  REQUIRE(received.size() == 3u);
+  CHECK(received[0].taskId == 0u);
+  CHECK(received[1].taskId == 1u);
+  CHECK(received[2].taskId == 2u);
+  CHECK(bus.numDelivered() == 3u);
+  CHECK(bus.numDropped() == 0u);
+}
+
+TEST_CASE("EventBus_drop_counts_overflow", "[EventBus]")
+{
+  EventBus bus(1, 4, EventBus::Overflow::Drop);
+  CHECK(bus.getOverflow() == EventBus::Overflow::Drop);
+  for(std::size_t i = 0; i < 4; i++)
+  {
+    CHECK(bus.publish(0, makeEvent(i, 0)));
+  }
+  CHECK_FALSE(bus.publish(0, makeEvent(4, 0)));
+  CHECK_FALSE(bus.publish(0, makeEvent(5, 0)));
+  CHECK(bus.numDropped() == 2u);
+  bus.start();
+  bus.stop();
+  CHECK(bus.numDelivered() == 4u);
+}
+
+TEST_CASE("EventBus_block_waits_for_dispatcher", "[EventBus]")
+{
+  const std::size_t n = 10000;
+  EventBus bus(2, 8, EventBus::Overflow::Block);
+  std::atomic<std::size_t> received(0);
+  std::vector<std::size_t> next(3, 0);
+  std::size_t wrong = 0;
+  bus.addListener([&](const std::vector<TaskEvent> & events) {
+      // a slow consumer
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      for(auto & e : events)
+      {
+        // each producer publishes its task ids in order
+        std::size_t producer = e.taskId / n;
+        if(e.taskId % n != next[producer]++)
+        {
+          wrong++;
+        }
+      }
+      received += events.size();
+    });
+  bus.start();
+  std::vector<std::thread> producers;
+  for(std::size_t p = 0; p < 3; p++)
+  {
+    producers.push_back(std::thread([&bus, p, n]() {
+          for(std::size_t i = 0; i < n; i++)
+          {
+            // the third producer uses the shared ring
+            bus.publish(p < 2 ? p : TaskQueue::noWorker, makeEvent(p * n + i, p));
+          }
+        }));
+  }
+  for(auto & t : producers)
+  {
+    t.join();
+  }
+  bus.stop();
+  CHECK(bus.numDropped() == 0u);
+  CHECK(received == 3 * n);
+  CHECK(wrong == 0u);
+}
+
+TEST_CASE("EventBus_task_order_across_rings", "[EventBus]")
+{
+  // worker 0 makes tasks Ready that worker 1 runs right away; the
+  // dispatcher drains the ring of worker 0 first, so it can see Running
+  // in a pass that missed Ready
+  const std::size_t n = 20000;
+  EventBus bus(2, 64, EventBus::Overflow::Block);
+  std::vector<Task::State> last(n, Task::State::Waiting);
+  std::size_t wrong = 0;
+  bus.addListener([&last, &wrong](const std::vector<TaskEvent> & events) {
+      for(auto & e : events)
+      {
+        if(e.state == Task::State::Running && last[e.taskId] != Task::State::Ready)
+        {
+          wrong++;
+        }
+        last[e.taskId] = e.state;
+      }
+    });
+  bus.start();
+  std::atomic<std::size_t> published(0);
+  std::thread worker([&bus, &published, n]() {
+      for(std::size_t i = 0; i < n; i++)
+      {
+        while(published <= i)
+        {
+          std::this_thread::yield();
+        }
+        TaskEvent e = makeEvent(i, 1);
+        e.state = Task::State::Running;
+        bus.publish(1, e);
+      }
+    });
+  for(std::size_t i = 0; i < n; i++)
+  {
+    bus.publish(0, makeEvent(i, 0));
+    published++;
+  }
+  worker.join();
+  bus.stop();
+  CHECK(bus.numDelivered() == 2 * n);
+  CHECK(wrong == 0u);
+}
+
+TEST_CASE("EventBus_block_does_not_wait_on_dispatcher", "[EventBus]")
+{
+  // a listener that submits tasks publishes on the dispatcher thread
+  EventBus bus(1, 4, EventBus::Overflow::Block);
+  std::size_t calls = 0;
+  bus.addListener([&bus, &calls](const std::vector<TaskEvent> &) {
+      if(calls++ < 3)
+      {
+        for(std::size_t i = 0; i < 16; i++)
+        {
+          bus.publish(TaskQueue::noWorker, makeEvent(i, Task::undefinedThreadId));
+        }
+      }
+    });
+  bus.start();
+  bus.publish(0, makeEvent(0, 0));
+  bus.stop();
+  CHECK(bus.numDropped() > 0u);
+  CHECK(bus.numDelivered() + bus.numDropped() == 1u + 3u * 16u);
+}
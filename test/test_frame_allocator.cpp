@@ -0,0 +1,53 @@
+#include "frame_allocator.h"
+#include "catch.hpp"
+#include <cstring>
+#include <vector>
+
+TEST_CASE("FrameAllocator_recycles_blocks", "[FrameAllocator]")
+{
+  auto alloc = std::make_shared<FrameAllocator>();
+  void * p = FrameAllocator::allocate(alloc, 200);
+  std::memset(p, 0xff, 200);
+  CHECK(alloc.use_count() == 2);
+  FrameAllocator::deallocate(p, 200);
+  CHECK(alloc.use_count() == 1);
+  CHECK(alloc->numCached() == 1u);
+  // same size class
+  void * q = FrameAllocator::allocate(alloc, 180);
+  CHECK(q == p);
+  CHECK(alloc->numCached() == 0u);
+  void * r = FrameAllocator::allocate(alloc, 1000);
+  CHECK(r != q);
+  FrameAllocator::deallocate(q, 180);
+  FrameAllocator::deallocate(r, 1000);
+  CHECK(alloc->numCached() == 2u);
+}
+
+TEST_CASE("FrameAllocator_large_and_unowned_blocks", "[FrameAllocator]")
+{
+  auto alloc = std::make_shared<FrameAllocator>();
+  std::size_t large = FrameAllocator::numClasses * FrameAllocator::granularity;
+  void * p = FrameAllocator::allocate(alloc, large);
+  std::memset(p, 0, large);
+  FrameAllocator::deallocate(p, large);
+  CHECK(alloc->numCached() == 0u);
+  void * q = FrameAllocator::allocate(std::shared_ptr<FrameAllocator>(), 64);
+  FrameAllocator::deallocate(q, 64);
+}
+
+TEST_CASE("FrameAllocator_blocks_outlive_owner", "[FrameAllocator]")
+{
+  std::vector<void*> blocks;
+  {
+    auto alloc = std::make_shared<FrameAllocator>();
+    for(std::size_t i = 0; i < 10; i++)
+    {
+      blocks.push_back(FrameAllocator::allocate(alloc, 100));
+    }
+  }
+  // the last block releases the allocator
+  for(auto p : blocks)
+  {
+    FrameAllocator::deallocate(p, 100);
+  }
+}
@@ -0,0 +1,169 @@
+#include "mpmc_ring.h"
+#include "task_queue.h"
+#include "task.h"
+#include "catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+TEST_CASE("MpmcRing_capacity_is_power_of_two", "[MpmcRing]")
+{
+  CHECK(MpmcRing<int>(1).capacity() == 2u);
+  CHECK(MpmcRing<int>(8).capacity() == 8u);
+  CHECK(MpmcRing<int>(9).capacity() == 16u);
+}
+
+TEST_CASE("MpmcRing_full_and_empty", "[MpmcRing]")
+{
+  MpmcRing<int> ring(4);
+  int v = 0;
+  CHECK_FALSE(ring.tryPop(v));
+  for(int i = 0; i < 4; i++)
+  {
+    REQUIRE(ring.tryPush(int(i)));
+  }
+  CHECK(ring.size() == 4u);
+  CHECK_FALSE(ring.tryPush(4));
+  for(int i = 0; i < 4; i++)
+  {
+    REQUIRE(ring.tryPop(v));
+    CHECK(v == i);
+  }
+  CHECK_FALSE(ring.tryPop(v));
+  CHECK(ring.size() == 0u);
+}
+
+TEST_CASE("MpmcRing_failed_push_keeps_value", "[MpmcRing]")
+{
+  MpmcRing<std::shared_ptr<int> > ring(2);
+  REQUIRE(ring.tryPush(std::make_shared<int>(1)));
+  REQUIRE(ring.tryPush(std::make_shared<int>(2)));
+  auto p = std::make_shared<int>(3);
+  CHECK_FALSE(ring.tryPush(std::move(p)));
+  REQUIRE(p);
+  CHECK(*p == 3);
+}
+
+TEST_CASE("MpmcRing_multi_producer_multi_consumer", "[MpmcRing]")
+{
+  const std::size_t numProducers = 4;
+  const std::size_t numConsumers = 4;
+  const std::size_t n = 20000;
+  MpmcRing<std::size_t> ring(64);
+  std::vector<std::atomic<int> > seen(numProducers * n);
+  for(auto & s : seen)
+  {
+    s = 0;
+  }
+  std::atomic<std::size_t> consumed(0);
+  std::vector<std::thread> threads;
+  for(std::size_t p = 0; p < numProducers; p++)
+  {
+    threads.push_back(std::thread([&ring, p, n]() {
+          for(std::size_t i = 0; i < n; i++)
+          {
+            while(!ring.tryPush(p * n + i))
+            {
+              std::this_thread::yield();
+            }
+          }
+        }));
+  }
+  for(std::size_t c = 0; c < numConsumers; c++)
+  {
+    threads.push_back(std::thread([&ring, &seen, &consumed, numProducers, n]() {
+          std::size_t v;
+          while(consumed < numProducers * n)
+          {
+            if(ring.tryPop(v))
+            {
+              seen[v]++;
+              consumed++;
+            }
+            else
+            {
+              std::this_thread::yield();
+            }
+          }
+        }));
+  }
+  for(auto & t : threads)
+  {
+    t.join();
+  }
+  std::size_t wrong = 0;
+  for(auto & s : seen)
+  {
+    if(s != 1)
+    {
+      wrong++;
+    }
+  }
+  CHECK(wrong == 0u);
+}
+
+template<typename PUSH, typename POP>
+static double measureThroughput(std::size_t numThreads, std::size_t n,
+                                PUSH push, POP pop)
+{
+  std::atomic<std::size_t> consumed(0);
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for(std::size_t p = 0; p < numThreads; p++)
+  {
+    threads.push_back(std::thread([&push, n]() {
+          for(std::size_t i = 0; i < n; i++)
+          {
+            push();
+          }
+        }));
+    threads.push_back(std::thread([&pop, &consumed, numThreads, n]() {
+          while(consumed < numThreads * n)
+          {
+            if(pop())
+            {
+              consumed++;
+            }
+          }
+        }));
+  }
+  for(auto & t : threads)
+  {
+    t.join();
+  }
+  std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+  return double(numThreads * n) / dt.count();
+}
+
+TEST_CASE("TaskQueue_throughput_ring_vs_list", "[.benchmark]")
+{
+  const std::size_t n = 200000;
+  auto task = Task::create([](){});
+  for(std::size_t numThreads = 1; numThreads <= 4; numThreads *= 2)
+  {
+    FifoTaskQueue fifo;
+    RingTaskQueue ring(1024);
+    double fifoRate = measureThroughput(numThreads, n,
+                                        [&fifo, &task]() {
+                                          fifo.push(task, TaskQueue::noWorker);
+                                        },
+                                        [&fifo]() {
+                                          return bool(fifo.pop(0));
+                                        });
+    double ringRate = measureThroughput(numThreads, n,
+                                        [&ring, &task]() {
+                                          while(!ring.tryPush(task, TaskQueue::noWorker))
+                                          {
+                                            std::this_thread::yield();
+                                          }
+                                        },
+                                        [&ring]() {
+                                          return bool(ring.pop(0));
+                                        });
+    std::cout << "producers/consumers: " << numThreads
+              << " list: " << fifoRate << " ops/s"
+              << " ring: " << ringRate << " ops/s" << std::endl;
+  }
+}
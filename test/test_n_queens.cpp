@@ -59,3 +59,23 @@ TEST_CASE("NQueens_8", "[NQueens]")
   ChessBoard board(8);
   CHECK(getSolutions(board.solveNQueens(8, 10000)) == pair_type(12u, 92u));
 }
+
+TEST_CASE("NQueens_cancel", "[NQueens]")
+{
+  ChessBoard board(8);
+  std::size_t polls = 0;
+  board.setCancelCheck([&polls](){ return ++polls > 3; });
+  CHECK_FALSE(board.isCanceled());
+  auto sol = board.solveNQueens(8, 10000);
+  CHECK(board.isCanceled());
+  CHECK(polls == 4u);
+  CHECK(sol.getNumSolutions() < 92u);
+}
+
+TEST_CASE("NQueens_cancel_check_not_triggered", "[NQueens]")
+{
+  ChessBoard board(8);
+  board.setCancelCheck([](){ return false; });
+  CHECK(getSolutions(board.solveNQueens(8, 10000)) == pair_type(12u, 92u));
+  CHECK_FALSE(board.isCanceled());
+}
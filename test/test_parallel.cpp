@@ -0,0 +1,262 @@
+#include "parallel.h"
+#include "catch.hpp"
+#include <atomic>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Latch_count_down", "[Parallel]")
+{
+  Latch latch(3);
+  CHECK_FALSE(latch.isReady());
+  std::thread t([&latch]() {
+      latch.countDown(2);
+      latch.countDown();
+    });
+  latch.wait();
+  CHECK(latch.isReady());
+  t.join();
+  Latch empty(0);
+  empty.wait();
+  CHECK(empty.isReady());
+}
+
+TEST_CASE("ParallelLoop_default_grain", "[Parallel]")
+{
+  CHECK(ParallelLoop::defaultGrain(0, 4) == 1u);
+  CHECK(ParallelLoop::defaultGrain(1000, 0) == 125u);
+  CHECK(ParallelLoop::defaultGrain(3200, 4) == 100u);
+}
+
+TEST_CASE("parallelFor_visits_every_index_once", "[Parallel]")
+{
+  auto pool = ThreadPool::create(4, ThreadPool::Scheduler::WorkStealing);
+  pool->activate();
+  for(std::size_t n : { 0, 1, 7, 1000, 10007 })
+  {
+    for(std::size_t grain : { 0, 1, 64 })
+    {
+      std::vector<std::atomic<int> > visited(n);
+      for(auto & v : visited)
+      {
+        v = 0;
+      }
+      parallelFor(pool, std::size_t(0), n, [&visited](std::size_t i) { visited[i]++; },
+                  grain);
+      std::size_t wrong = 0;
+      for(auto & v : visited)
+      {
+        wrong += (v != 1);
+      }
+      CHECK(wrong == 0u);
+    }
+  }
+  // signed index ranges that do not start at zero
+  std::atomic<long> sum(0);
+  parallelFor(pool, -100, 101, [&sum](int i) { sum += i; });
+  CHECK(sum == 0);
+  parallelFor(pool, 5, 3, [&sum](int i) { sum += i; });
+  CHECK(sum == 0);
+  pool->terminate();
+}
+
+TEST_CASE("parallelForEach_and_transform", "[Parallel]")
+{
+  auto pool = ThreadPool::create(3);
+  pool->activate();
+  std::vector<int> values(5000);
+  std::iota(values.begin(), values.end(), 0);
+  parallelForEach(pool, values.begin(), values.end(), [](int & v) { v *= 2; });
+  CHECK(values[4999] == 9998);
+  std::vector<std::string> strings(values.size());
+  auto end = parallelTransform(pool, values.begin(), values.end(), strings.begin(),
+                               [](int v) { return std::to_string(v); }, 10);
+  CHECK(end == strings.end());
+  std::size_t wrong = 0;
+  for(std::size_t i = 0; i < values.size(); i++)
+  {
+    wrong += (strings[i] != std::to_string(2 * i));
+  }
+  CHECK(wrong == 0u);
+  pool->terminate();
+}
+
+TEST_CASE("parallelReduce_keeps_order", "[Parallel]")
+{
+  auto pool = ThreadPool::create(4);
+  pool->activate();
+  std::uint64_t squares = parallelReduce(pool, std::uint64_t(1), std::uint64_t(100001),
+                                         std::uint64_t(0),
+                                         [](std::uint64_t i) { return i * i; },
+                                         [](std::uint64_t a, std::uint64_t b) { return a + b; });
+  CHECK(squares == 333338333350000ull);
+  // concatenation is associative but not commutative
+  std::vector<std::string> words;
+  std::string expected;
+  for(int i = 0; i < 500; i++)
+  {
+    words.push_back(std::to_string(i) + ",");
+    expected += words.back();
+  }
+  std::string joined = parallelReduce(pool, words.begin(), words.end(), std::string(),
+                                      [](std::string a, const std::string & b) {
+                                        return a + b;
+                                      }, 7);
+  CHECK(joined == expected);
+  CHECK(parallelReduce(pool, 0, 0, 42, [](int i) { return i; },
+                       [](int a, int b) { return a + b; }) == 42);
+  pool->terminate();
+}
+
+TEST_CASE("parallelFor_rethrows_first_exception", "[Parallel]")
+{
+  auto pool = ThreadPool::create(2);
+  pool->activate();
+  std::atomic<std::size_t> count(0);
+  CHECK_THROWS_AS(parallelFor(pool, 0, 10000, [&count](int i) {
+        count++;
+        if(i == 5000)
+        {
+          throw std::runtime_error("failed");
+        }
+      }, 100), std::runtime_error);
+  CHECK(count <= 10000u);
+  // the pool is still usable
+  std::atomic<int> sum(0);
+  parallelFor(pool, 0, 100, [&sum](int i) { sum += i; });
+  CHECK(sum == 4950);
+  pool->terminate();
+}
+
+TEST_CASE("parallelFor_needs_active_pool", "[Parallel]")
+{
+  auto pool = ThreadPool::create(2);
+  CHECK_THROWS(parallelFor(pool, 0, 10, [](int) {}));
+  pool->activate();
+  // called from a worker of the same pool
+  std::atomic<int> sum(0);
+  auto task = Task::create([&pool, &sum]() {
+      parallelFor(pool, 0, 1000, [&sum](int i) { sum += i; });
+    });
+  pool->addTask(task);
+  task->wait();
+  CHECK(task->getState() == Task::State::Done);
+  CHECK(sum == 499500);
+  pool->terminate();
+  CHECK_THROWS(parallelFor(pool, 0, 10, [](int) {}));
+}
+
+TEST_CASE("parallelFor_nested_in_every_worker", "[Parallel]")
+{
+  // all workers run loops at once, they help with each other's chunks
+  auto pool = ThreadPool::create(2);
+  pool->activate();
+  std::atomic<long> sum(0);
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(int t = 0; t < 8; t++)
+  {
+    tasks.push_back(Task::create([&pool, &sum]() {
+          parallelFor(pool, 0, 1000, [&sum](int i) { sum += i; }, 10);
+        }));
+  }
+  pool->addTasks(tasks.begin(), tasks.end());
+  for(auto & task : tasks)
+  {
+    task->wait();
+    CHECK(task->getState() == Task::State::Done);
+  }
+  pool->terminate();
+  CHECK(sum == 8 * 499500);
+}
+
+TEST_CASE("parallelFor_bounded_queue", "[Parallel]")
+{
+  for(auto policy : { ThreadPool::Overflow::Block, ThreadPool::Overflow::Reject,
+                      ThreadPool::Overflow::DropOldest, ThreadPool::Overflow::CallerRuns })
+  {
+    auto pool = ThreadPool::create(2);
+    pool->setMaxQueueDepth(1, policy);
+    pool->activate();
+    for(int round = 0; round < 20; round++)
+    {
+      std::vector<std::atomic<int> > visited(1000);
+      for(auto & v : visited)
+      {
+        v = 0;
+      }
+      bool canceled = false;
+      try
+      {
+        parallelFor(pool, std::size_t(0), visited.size(),
+                    [&visited](std::size_t i) { visited[i]++; }, 1);
+      }
+      catch(const TaskCanceled &)
+      {
+        // a chunk lost a race for the last slot
+        canceled = true;
+      }
+      std::size_t wrong = 0;
+      for(auto & v : visited)
+      {
+        wrong += (v > 1 || (v == 0 && !canceled));
+      }
+      CHECK(wrong == 0u);
+      CHECK((!canceled || policy == ThreadPool::Overflow::DropOldest));
+    }
+    pool->terminate();
+  }
+}
+
+TEST_CASE("parallelFor_chunks_discarded_by_terminate", "[Parallel]")
+{
+  auto pool = ThreadPool::create(1);
+  pool->activate();
+  std::atomic<bool> release(false);
+  pool->addTask(Task::create([&release]() {
+        while(!release)
+        {
+          std::this_thread::yield();
+        }
+      }));
+  while(pool->numTasks(Task::State::Ready) != 0)
+  {
+    std::this_thread::yield();
+  }
+  std::atomic<bool> started(false);
+  std::atomic<int> count(0);
+  bool canceled = false;
+  // the worker is busy, so the upper half stays queued until the
+  // terminating worker discards it
+  std::thread loop([&]() {
+      try
+      {
+        parallelFor(pool, 0, 8, [&](int i) {
+            if(i == 0)
+            {
+              started = true;
+              while(pool->getState() != ThreadPool::State::Terminated)
+              {
+                std::this_thread::yield();
+              }
+              release = true;
+            }
+            count++;
+          }, 1);
+      }
+      catch(const TaskCanceled &)
+      {
+        canceled = true;
+      }
+    });
+  while(!started)
+  {
+    std::this_thread::yield();
+  }
+  auto unrun = pool->terminate(ThreadPool::Shutdown::Cancel);
+  loop.join();
+  CHECK(canceled);
+  CHECK(count == 4);
+  CHECK(unrun.size() == 1u);
+}
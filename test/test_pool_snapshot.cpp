@@ -0,0 +1,81 @@
+#include "pool_snapshot.h"
+#include "catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+TEST_CASE("WorkerSlot_set_clear_restore", "[PoolSnapshot]")
+{
+  WorkerSlot slot;
+  WorkerSnapshot s = slot.read();
+  CHECK_FALSE(s.busy);
+  CHECK(s.taskId == Task::undefinedTaskId);
+  CHECK(s.version == 0u);
+  auto start = std::chrono::steady_clock::now();
+  slot.set(7, Task::Priority::High, start);
+  s = slot.read();
+  CHECK(s.busy);
+  CHECK(s.taskId == 7u);
+  CHECK(s.priority == Task::Priority::High);
+  CHECK(s.startTime == start);
+  CHECK(s.version == 1u);
+  // a nested task replaces the descriptor until it is restored
+  WorkerSnapshot outer = s;
+  slot.set(8, Task::Priority::Low, start + std::chrono::milliseconds(1));
+  CHECK(slot.read().taskId == 8u);
+  slot.restore(outer);
+  s = slot.read();
+  CHECK(s.taskId == 7u);
+  CHECK(s.priority == Task::Priority::High);
+  CHECK(s.startTime == start);
+  slot.clear();
+  s = slot.read();
+  CHECK_FALSE(s.busy);
+  CHECK(s.taskId == Task::undefinedTaskId);
+  CHECK(s.version == 4u);
+}
+
+TEST_CASE("WorkerSlot_concurrent_reads_are_consistent", "[PoolSnapshot]")
+{
+  WorkerSlot slot;
+  std::atomic<bool> done(false);
+  const auto base = std::chrono::steady_clock::time_point();
+  // every descriptor the writer publishes has matching fields
+  std::thread writer([&slot, &done, base](){
+      for(std::size_t i = 1; i <= 200000; i++)
+      {
+        slot.set(i, (Task::Priority)(i % Task::numPriorities),
+                 base + std::chrono::nanoseconds(i));
+        if(i % 3 == 0)
+        {
+          slot.clear();
+        }
+      }
+      done = true;
+    });
+  std::size_t numReads = 0;
+  std::size_t numTorn = 0;
+  std::uint64_t lastVersion = 0;
+  bool ordered = true;
+  while(!done || numReads == 0)
+  {
+    WorkerSnapshot s = slot.read();
+    if(s.busy &&
+       (s.priority != (Task::Priority)(s.taskId % Task::numPriorities) ||
+        s.startTime != base + std::chrono::nanoseconds(s.taskId)))
+    {
+      numTorn++;
+    }
+    if(!s.busy && s.taskId != Task::undefinedTaskId)
+    {
+      numTorn++;
+    }
+    ordered = ordered && s.version >= lastVersion;
+    lastVersion = s.version;
+    numReads++;
+  }
+  writer.join();
+  CHECK(numTorn == 0u);
+  CHECK(ordered);
+  CHECK(slot.read().version == 200000u + 200000u / 3);
+}
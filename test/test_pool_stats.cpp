@@ -0,0 +1,86 @@
+#include "pool_stats.h"
+#include "catch.hpp"
+#include <cstdint>
+
+typedef LatencyHistogram::duration ns;
+
+TEST_CASE("LatencyHistogram_buckets", "[PoolStats]")
+{
+  // exact below 2^(subBucketBits + 1)
+  for(std::uint64_t v = 0; v < 32; v++)
+  {
+    CHECK(LatencyHistogram::bucketOf(v) == v);
+    CHECK(LatencyHistogram::upperBound(v) == v);
+  }
+  CHECK(LatencyHistogram::bucketOf(32) == 32u);
+  CHECK(LatencyHistogram::bucketOf(33) == 32u);
+  CHECK(LatencyHistogram::upperBound(32) == 33u);
+  CHECK(LatencyHistogram::bucketOf(~std::uint64_t(0)) ==
+        LatencyHistogram::numBuckets - 1);
+  CHECK(LatencyHistogram::upperBound(LatencyHistogram::numBuckets - 1) ==
+        ~std::uint64_t(0));
+  // every value lies within 1/16 below the upper bound of its bucket
+  for(std::uint64_t v = 1; v < (std::uint64_t(1) << 40); v = v * 3 + 1)
+  {
+    std::uint64_t upper = LatencyHistogram::upperBound(LatencyHistogram::bucketOf(v));
+    CHECK(upper >= v);
+    CHECK(upper - v <= v / 16);
+  }
+}
+
+TEST_CASE("LatencyHistogram_percentiles", "[PoolStats]")
+{
+  LatencyHistogram h;
+  CHECK(h.count() == 0u);
+  CHECK(h.percentile(0.5) == ns::zero());
+  for(int i = 1; i <= 1000; i++)
+  {
+    h.record(std::chrono::microseconds(i));
+  }
+  CHECK(h.count() == 1000u);
+  CHECK(h.max() == std::chrono::microseconds(1000));
+  CHECK(h.mean() == std::chrono::nanoseconds(500500));
+  auto p50 = h.percentile(0.5).count();
+  auto p99 = h.percentile(0.99).count();
+  CHECK(p50 >= 500000);
+  CHECK(p50 <= 500000 + 500000 / 16);
+  CHECK(p99 >= 990000);
+  CHECK(p99 <= 990000 + 990000 / 16);
+  CHECK(h.percentile(0.999) <= h.max());
+  CHECK(h.percentile(1.0) == h.max());
+}
+
+TEST_CASE("LatencyHistogram_merge", "[PoolStats]")
+{
+  LatencyHistogram a;
+  LatencyHistogram b;
+  a.record(ns(10));
+  b.record(ns(-5));
+  b.record(ns(1000));
+  a.merge(b);
+  CHECK(a.count() == 3u);
+  CHECK(a.max() == ns(1000));
+  CHECK(a.percentile(0.1) == ns(0));
+  CHECK(a.percentile(0.5) == ns(10));
+}
+
+TEST_CASE("WorkerStats_counts", "[PoolStats]")
+{
+  WorkerStats worker;
+  worker.taskStarted(std::chrono::microseconds(5));
+  worker.taskStarted(std::chrono::microseconds(7));
+  worker.taskFinished(true, false, std::chrono::milliseconds(1));
+  worker.taskStarted(std::chrono::microseconds(9));
+  worker.taskFinished(false, false, std::chrono::milliseconds(2));
+  PoolStats stats;
+  worker.addCountsTo(stats);
+  worker.addHistogramsTo(stats);
+  CHECK(stats.numDone == 1u);
+  CHECK(stats.numFailed == 1u);
+  CHECK(stats.numCanceled == 0u);
+  CHECK(stats.numRunning == 1u);
+  CHECK(stats.queueWait.count() == 3u);
+  CHECK(stats.queueWait.max() == std::chrono::microseconds(9));
+  CHECK(stats.runTime.count() == 2u);
+  CHECK(stats.runTime.max() == std::chrono::milliseconds(2));
+}
@@ -0,0 +1,138 @@
+#include "small_function.h"
+#include "task.h"
+#include "catch.hpp"
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+
+// allocation hook for the benchmark below. The replacements stay out
+// of line: once inlined, gcc sees malloc() paired with operator delete
+// or operator new paired with free() and warns with -Wmismatched-new-delete
+#if defined(__GNUC__)
+#define TEST_NOINLINE __attribute__((noinline))
+#else
+#define TEST_NOINLINE
+#endif
+
+static std::atomic<std::size_t> numAllocations(0);
+
+TEST_NOINLINE void * operator new(std::size_t size)
+{
+  numAllocations.fetch_add(1, std::memory_order_relaxed);
+  void * p = std::malloc(size ? size : 1);
+  if(!p)
+  {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+// every delete the compiler may pick pairs with the operator new above
+TEST_NOINLINE void operator delete(void * p) noexcept
+{
+  std::free(p);
+}
+
+TEST_NOINLINE void operator delete(void * p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+TEST_CASE("SmallFunction_empty", "[SmallFunction]")
+{
+  SmallFunction<int()> f;
+  CHECK_FALSE(f);
+  CHECK(f.isInline());
+}
+
+TEST_CASE("SmallFunction_small_callable_is_inline", "[SmallFunction]")
+{
+  int a = 1;
+  int b = 2;
+  SmallFunction<int(int)> f([a, b](int c) { return a + b + c; });
+  REQUIRE(f);
+  CHECK(f.isInline());
+  CHECK(f(3) == 6);
+}
+
+TEST_CASE("SmallFunction_large_callable_is_on_heap", "[SmallFunction]")
+{
+  std::array<char, 2 * SmallFunction<int()>::bufferSize> data;
+  data.fill(1);
+  SmallFunction<int()> f([data]() { return int(data.size()); });
+  CHECK_FALSE(f.isInline());
+  CHECK(f() == int(data.size()));
+  SmallFunction<int()> g(std::move(f));
+  CHECK_FALSE(f);
+  CHECK(g() == int(data.size()));
+}
+
+TEST_CASE("SmallFunction_move_only_callable", "[SmallFunction]")
+{
+  std::unique_ptr<int> value(new int(42));
+  struct Callable
+  {
+    std::unique_ptr<int> value;
+    int operator()() { return *value; }
+  };
+  SmallFunction<int()> f(Callable{ std::move(value) });
+  CHECK(f.isInline());
+  SmallFunction<int()> g;
+  g = std::move(f);
+  CHECK_FALSE(f);
+  CHECK(g() == 42);
+}
+
+TEST_CASE("SmallFunction_destroys_callable", "[SmallFunction]")
+{
+  auto counter = std::make_shared<int>(0);
+  {
+    SmallFunction<void()> f([counter]() {});
+    SmallFunction<void()> g(std::move(f));
+    CHECK(counter.use_count() == 2);
+  }
+  CHECK(counter.use_count() == 1);
+}
+
+template<typename F>
+static double allocationsPerTask(F create)
+{
+  const std::size_t n = 1000;
+  std::size_t before = numAllocations;
+  for(std::size_t i = 0; i < n; i++)
+  {
+    create();
+  }
+  return double(numAllocations - before) / double(n);
+}
+
+TEST_CASE("SmallFunction_allocations_per_task", "[.benchmark]")
+{
+  std::array<std::size_t, 4> payload;
+  payload.fill(0);
+  // what Task::create did before: a std::function<void()> wrapped in the
+  // lambda stored in a std::function<bool(std::shared_ptr<Task>)>
+  double wrapped = allocationsPerTask([&payload]() {
+      std::function<void()> func([payload]() {});
+      std::function<bool(std::shared_ptr<Task>)> outer([func](std::shared_ptr<Task>) {
+          func();
+          return true;
+        });
+    });
+  double small = allocationsPerTask([&payload]() {
+      Task::function_type func([payload](const std::shared_ptr<Task> &) {
+          return true;
+        });
+    });
+  double task = allocationsPerTask([&payload]() {
+      Task::create([payload]() {});
+    });
+  std::cout << "allocations per callable: std::function wrapped: " << wrapped
+            << " SmallFunction: " << small << std::endl;
+  std::cout << "allocations per Task::create: " << task
+            << " bytes per Task: " << sizeof(Task) << std::endl;
+}
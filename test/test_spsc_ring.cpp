@@ -0,0 +1,69 @@
+#include "spsc_ring.h"
+#include "catch.hpp"
+#include <thread>
+
+TEST_CASE("SpscRing_capacity_is_power_of_two", "[SpscRing]")
+{
+  CHECK(SpscRing<int>(1).capacity() == 2u);
+  CHECK(SpscRing<int>(8).capacity() == 8u);
+  CHECK(SpscRing<int>(9).capacity() == 16u);
+}
+
+TEST_CASE("SpscRing_full_and_empty", "[SpscRing]")
+{
+  SpscRing<int> ring(4);
+  int v = 0;
+  CHECK_FALSE(ring.tryPop(v));
+  // wrap around a few times
+  for(int lap = 0; lap < 3; lap++)
+  {
+    for(int i = 0; i < 4; i++)
+    {
+      REQUIRE(ring.tryPush(lap * 4 + i));
+    }
+    CHECK(ring.size() == 4u);
+    CHECK_FALSE(ring.tryPush(-1));
+    for(int i = 0; i < 4; i++)
+    {
+      REQUIRE(ring.tryPop(v));
+      CHECK(v == lap * 4 + i);
+    }
+    CHECK_FALSE(ring.tryPop(v));
+    CHECK(ring.size() == 0u);
+  }
+}
+
+TEST_CASE("SpscRing_producer_consumer", "[SpscRing]")
+{
+  const std::size_t n = 100000;
+  SpscRing<std::size_t> ring(64);
+  std::thread producer([&ring, n]() {
+      for(std::size_t i = 0; i < n; i++)
+      {
+        while(!ring.tryPush(i))
+        {
+          std::this_thread::yield();
+        }
+      }
+    });
+  std::size_t expected = 0;
+  std::size_t wrong = 0;
+  std::size_t v;
+  while(expected < n)
+  {
+    if(ring.tryPop(v))
+    {
+      if(v != expected)
+      {
+        wrong++;
+      }
+      expected++;
+    }
+    else
+    {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  CHECK(wrong == 0u);
+}
@@ -146,3 +146,44 @@ TEST_CASE("Task_on_state_change", "[Task]")
   task->handleStateChange(pool);
   REQUIRE(res == std::vector<int>({1, 2, 3}));
 }
+
+TEST_CASE("Task_priority", "[Task]")
+{
+  auto task = TaskFixture::create(Task::State::Waiting);
+  CHECK(task->getPriority() == Task::Priority::Normal);
+  task->setPriority(Task::Priority::Interactive);
+  CHECK(task->getPriority() == Task::Priority::Interactive);
+  task->setState(Task::State::Ready);
+  CHECK_THROWS_AS(task->setPriority(Task::Priority::Low), std::logic_error);
+  CHECK(task->getPriority() == Task::Priority::Interactive);
+}
+
+TEST_CASE("Task_depends_on_preconditions", "[Task]")
+{
+  auto task = TaskFixture::create(Task::State::Waiting);
+  auto ready = TaskFixture::create(Task::State::Ready);
+  auto other = TaskFixture::create(Task::State::Waiting);
+  CHECK_THROWS_AS(task->dependsOn(task), std::logic_error);
+  CHECK_THROWS_AS(ready->dependsOn(other), std::logic_error);
+  CHECK_NOTHROW(task->dependsOn(other));
+  CHECK_NOTHROW(task->dependsOn(ready));
+}
+
+TEST_CASE("Task_cancel", "[Task]")
+{
+  auto waiting = TaskFixture::create(Task::State::Waiting);
+  CHECK_FALSE(waiting->isCancelRequested());
+  CHECK(waiting->cancel());
+  CHECK(waiting->getState() == Task::State::Canceled);
+  waiting->wait();
+  CHECK_FALSE(waiting->cancel());
+
+  auto running = TaskFixture::create(Task::State::Running);
+  CHECK(running->cancel());
+  CHECK(running->getState() == Task::State::CancelRequested);
+  CHECK(running->isCancelRequested());
+  CHECK_FALSE(running->cancel());
+
+  CHECK_FALSE(TaskFixture::create(Task::State::Done)->cancel());
+  CHECK_FALSE(TaskFixture::create(Task::State::Failed)->cancel());
+}
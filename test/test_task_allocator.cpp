@@ -0,0 +1,53 @@
+#include "task_allocator.h"
+#include "task.h"
+#include "catch.hpp"
+#include <thread>
+#include <vector>
+
+TEST_CASE("TaskAllocator_recycles_blocks", "[TaskAllocator]")
+{
+  TaskAllocator<double> alloc;
+  double * p = alloc.allocate(1);
+  alloc.deallocate(p, 1);
+  double * q = alloc.allocate(1);
+  CHECK(p == q);
+  alloc.deallocate(q, 1);
+}
+
+TEST_CASE("TaskAllocator_recycles_tasks", "[TaskAllocator]")
+{
+  const Task * first = Task::create([](){}).get();
+  auto task = Task::create([](){});
+  CHECK(task.get() == first);
+}
+
+TEST_CASE("TaskAllocator_blocks_move_between_threads", "[TaskAllocator]")
+{
+  typedef TaskAllocator<long double> alloc_type;
+  std::size_t n = 4 * alloc_type::maxThreadCached;
+  std::vector<long double*> blocks;
+  alloc_type alloc;
+  for(std::size_t i = 0; i < n; i++)
+  {
+    blocks.push_back(alloc.allocate(1));
+  }
+  std::size_t before = alloc_type::numShared();
+  // a thread that only frees hands its surplus to the shared list
+  std::thread t([&blocks, &alloc]() {
+      for(auto p : blocks)
+      {
+        alloc.deallocate(p, 1);
+      }
+    });
+  t.join();
+  CHECK(alloc_type::numShared() == before + n);
+  for(std::size_t i = 0; i < n; i++)
+  {
+    blocks[i] = alloc.allocate(1);
+  }
+  CHECK(alloc_type::numShared() == before);
+  for(auto p : blocks)
+  {
+    alloc.deallocate(p, 1);
+  }
+}
@@ -0,0 +1,203 @@
+#include "task_queue.h"
+#include "task.h"
+#include "catch.hpp"
+#include <vector>
+#include <thread>
+
+static std::vector<std::shared_ptr<Task> > makeTasks(std::size_t n)
+{
+  std::vector<std::shared_ptr<Task> > ret;
+  for(std::size_t i = 0; i < n; i++)
+  {
+    ret.push_back(Task::create([](){}));
+  }
+  return ret;
+}
+
+TEST_CASE("FifoTaskQueue_order", "[TaskQueue]")
+{
+  FifoTaskQueue queue;
+  auto tasks = makeTasks(3);
+  CHECK(queue.empty());
+  CHECK_FALSE(queue.pop(0));
+  for(auto & t : tasks)
+  {
+    queue.push(t, 0);
+  }
+  CHECK(queue.size() == 3u);
+  CHECK(queue.getTasks() == tasks);
+  CHECK(queue.pop(1) == tasks[0]);
+  CHECK(queue.pop(0) == tasks[1]);
+  CHECK(queue.pop(TaskQueue::noWorker) == tasks[2]);
+  CHECK(queue.empty());
+}
+
+TEST_CASE("WorkStealingTaskQueue_own_deque_is_lifo", "[TaskQueue]")
+{
+  WorkStealingTaskQueue queue(2);
+  auto tasks = makeTasks(3);
+  for(auto & t : tasks)
+  {
+    queue.push(t, 0);
+  }
+  CHECK(queue.size() == 3u);
+  CHECK(queue.pop(0) == tasks[2]);
+  CHECK(queue.pop(0) == tasks[1]);
+  CHECK(queue.pop(0) == tasks[0]);
+  CHECK(queue.empty());
+}
+
+TEST_CASE("WorkStealingTaskQueue_steal_is_fifo", "[TaskQueue]")
+{
+  WorkStealingTaskQueue queue(2);
+  auto tasks = makeTasks(3);
+  for(auto & t : tasks)
+  {
+    queue.push(t, 0);
+  }
+  CHECK(queue.pop(1) == tasks[0]);
+  CHECK(queue.pop(1) == tasks[1]);
+  CHECK(queue.pop(0) == tasks[2]);
+  CHECK(queue.empty());
+}
+
+TEST_CASE("WorkStealingTaskQueue_own_deque_before_injected", "[TaskQueue]")
+{
+  WorkStealingTaskQueue queue(2);
+  auto tasks = makeTasks(4);
+  queue.push(tasks[0], TaskQueue::noWorker);
+  queue.push(tasks[1], TaskQueue::noWorker);
+  queue.push(tasks[2], 1);
+  queue.push(tasks[3], 0);
+  CHECK(queue.size() == 4u);
+  CHECK(queue.getTasks().size() == 4u);
+  CHECK(queue.pop(0) == tasks[3]);
+  CHECK(queue.pop(0) == tasks[0]);
+  CHECK(queue.pop(0) == tasks[1]);
+  CHECK(queue.pop(0) == tasks[2]);
+  CHECK_FALSE(queue.pop(0));
+  CHECK(queue.empty());
+}
+
+static std::shared_ptr<Task> makeTask(Task::Priority p)
+{
+  auto task = Task::create([](){});
+  task->setPriority(p);
+  return task;
+}
+
+TEST_CASE("PriorityTaskQueue_order", "[TaskQueue]")
+{
+  PriorityTaskQueue queue(PriorityTaskQueue::clock_type::duration::zero());
+  auto low = makeTask(Task::Priority::Low);
+  auto normal1 = makeTask(Task::Priority::Normal);
+  auto normal2 = makeTask(Task::Priority::Normal);
+  auto interactive = makeTask(Task::Priority::Interactive);
+  queue.push(low, 0);
+  queue.push(normal1, 0);
+  queue.pushBulk({ normal2, interactive }, 0);
+  CHECK(queue.size() == 4u);
+  CHECK(queue.getTasks() ==
+        std::vector<std::shared_ptr<Task> >({interactive, normal1, normal2, low}));
+  CHECK(queue.pop(0) == interactive);
+  CHECK(queue.pop(0) == normal1);
+  CHECK(queue.pop(0) == normal2);
+  CHECK(queue.pop(0) == low);
+  CHECK_FALSE(queue.pop(0));
+  CHECK(queue.empty());
+}
+
+TEST_CASE("PriorityTaskQueue_pop_oldest", "[TaskQueue]")
+{
+  PriorityTaskQueue queue(PriorityTaskQueue::clock_type::duration::zero());
+  auto high = makeTask(Task::Priority::High);
+  auto low = makeTask(Task::Priority::Low);
+  queue.push(high, 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  queue.push(low, 0);
+  CHECK(queue.popOldest() == high);
+  CHECK(queue.popOldest() == low);
+  CHECK_FALSE(queue.popOldest());
+  CHECK(queue.empty());
+}
+
+TEST_CASE("PriorityTaskQueue_aging", "[TaskQueue]")
+{
+  PriorityTaskQueue queue(std::chrono::milliseconds(10));
+  CHECK(queue.getAgingInterval() == std::chrono::milliseconds(10));
+  auto low = makeTask(Task::Priority::Low);
+  auto high = makeTask(Task::Priority::High);
+  queue.push(low, 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  queue.push(high, 0);
+  CHECK(queue.pop(0) == low);
+  CHECK(queue.pop(0) == high);
+}
+
+TEST_CASE("NumaTaskQueue_node_local_first", "[TaskQueue]")
+{
+  std::vector<std::unique_ptr<TaskQueue> > nodes;
+  nodes.push_back(std::unique_ptr<TaskQueue>(new FifoTaskQueue()));
+  nodes.push_back(std::unique_ptr<TaskQueue>(new FifoTaskQueue()));
+  // workers 0 and 2 on node 0, worker 1 on node 1
+  NumaTaskQueue queue(std::move(nodes), {0, 1, 0});
+  auto tasks = makeTasks(4);
+  queue.push(tasks[0], 0);
+  queue.push(tasks[1], 1);
+  queue.pushBulk({ tasks[2], tasks[3] }, 2);
+  CHECK(queue.size() == 4u);
+  CHECK(queue.getNode(0).size() == 3u);
+  CHECK(queue.getNode(1).size() == 1u);
+  CHECK(queue.pop(1) == tasks[1]);
+  CHECK(queue.pop(1) == tasks[0]);
+  CHECK(queue.pop(0) == tasks[2]);
+  CHECK(queue.pop(2) == tasks[3]);
+  CHECK_FALSE(queue.pop(0));
+  CHECK(queue.empty());
+}
+
+TEST_CASE("NumaTaskQueue_pop_oldest_across_nodes", "[TaskQueue]")
+{
+  std::vector<std::unique_ptr<TaskQueue> > nodes;
+  nodes.push_back(std::unique_ptr<TaskQueue>(new PriorityTaskQueue(std::chrono::seconds(0))));
+  nodes.push_back(std::unique_ptr<TaskQueue>(new PriorityTaskQueue(std::chrono::seconds(0))));
+  NumaTaskQueue queue(std::move(nodes), {0, 1});
+  auto tasks = makeTasks(3);
+  CHECK(queue.oldestTime() == std::chrono::steady_clock::time_point::max());
+  // node 1 gets the first task, node 0 the later ones
+  queue.push(tasks[0], 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  queue.push(tasks[1], 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  queue.push(tasks[2], 1);
+  CHECK(queue.popOldest() == tasks[0]);
+  CHECK(queue.popOldest() == tasks[1]);
+  CHECK(queue.popOldest() == tasks[2]);
+  CHECK_FALSE(queue.popOldest());
+  CHECK(queue.empty());
+}
+
+TEST_CASE("RingTaskQueue_push_overflows", "[TaskQueue]")
+{
+  RingTaskQueue queue(2);
+  auto tasks = makeTasks(5);
+  CHECK(queue.tryPush(tasks[0], 0));
+  CHECK(queue.tryPush(tasks[1], 0));
+  CHECK_FALSE(queue.tryPush(tasks[2], 0));
+  // push does not wait for a full ring
+  queue.push(tasks[2], 0);
+  queue.push(tasks[3], 0);
+  CHECK(queue.size() == 4u);
+  CHECK(queue.capacity() == 2u);
+  CHECK(queue.pop(0) == tasks[0]);
+  // the ring has room, but push queues behind the overflowed tasks and
+  // tryPush fails
+  CHECK_FALSE(queue.tryPush(tasks[4], 0));
+  queue.push(tasks[4], 0);
+  CHECK(queue.pop(0) == tasks[1]);
+  CHECK(queue.pop(0) == tasks[2]);
+  CHECK(queue.pop(0) == tasks[3]);
+  CHECK(queue.pop(0) == tasks[4]);
+  CHECK_FALSE(queue.pop(0));
+  CHECK(queue.empty());
+}
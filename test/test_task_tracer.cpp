@@ -0,0 +1,116 @@
+#include "task_tracer.h"
+#include "task.h"
+#include "catch.hpp"
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef TaskTracer::clock_type clock_type;
+
+static std::size_t countOf(const std::string & str, const std::string & what)
+{
+  std::size_t n = 0;
+  for(std::size_t pos = str.find(what); pos != std::string::npos;
+      pos = str.find(what, pos + what.size()))
+  {
+    n++;
+  }
+  return n;
+}
+
+TEST_CASE("TaskTracer_records_only_while_started", "[TaskTracer]")
+{
+  TaskTracer tracer(2, 16);
+  CHECK_FALSE(tracer.isRecording());
+  auto t0 = clock_type::now();
+  auto t1 = t0 + std::chrono::microseconds(5);
+  tracer.record(0, TaskTracer::Kind::Run, 1, t0, t1);
+  tracer.start();
+  CHECK(tracer.isRecording());
+  CHECK(tracer.numSpans() == 0u);
+  tracer.record(0, TaskTracer::Kind::Run, 1, t0, t1);
+  tracer.record(1, TaskTracer::Kind::QueueWait, 2, t0, t1);
+  tracer.record(7, TaskTracer::Kind::LockWait, Task::undefinedTaskId, t0, t1);
+  tracer.stop();
+  CHECK(tracer.numSpans() == 3u);
+  std::stringstream ss;
+  tracer.write(ss);
+  std::string json = ss.str();
+  CHECK(json.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[") == 0u);
+  CHECK(countOf(json, "\"thread_name\"") == 3u);
+  CHECK(countOf(json, "\"name\":\"external\"") == 1u);
+  CHECK(countOf(json, "\"name\":\"run\",\"cat\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":0") == 1u);
+  CHECK(countOf(json, "\"dur\":5.000,\"args\":{\"taskId\":1}") == 1u);
+  CHECK(countOf(json, "\"name\":\"queue wait\"") == 2u);
+  CHECK(countOf(json, "\"name\":\"lock wait\",\"cat\":\"pool\",\"ph\":\"X\",\"pid\":1,\"tid\":2") == 1u);
+}
+
+TEST_CASE("TaskTracer_keeps_latest_spans", "[TaskTracer]")
+{
+  TaskTracer tracer(1, 4);
+  tracer.start();
+  auto t0 = clock_type::now();
+  for(std::size_t i = 0; i < 10; i++)
+  {
+    tracer.record(0, TaskTracer::Kind::Run, i, t0, t0);
+  }
+  CHECK(tracer.numSpans() == 4u);
+  std::stringstream ss;
+  tracer.write(ss);
+  std::string json = ss.str();
+  CHECK(countOf(json, "\"taskId\":5}") == 0u);
+  for(std::size_t i = 6; i < 10; i++)
+  {
+    CHECK(countOf(json, "\"taskId\":" + std::to_string(i) + "}") == 1u);
+  }
+  // a new recording starts empty
+  tracer.start();
+  CHECK(tracer.numSpans() == 0u);
+}
+
+TEST_CASE("TaskTracer_write_while_recording", "[TaskTracer]")
+{
+  TaskTracer tracer(2, 64);
+  tracer.start();
+  std::vector<std::thread> threads;
+  for(std::size_t w = 0; w < 3; w++)
+  {
+    threads.push_back(std::thread([&tracer, w]() {
+          for(std::size_t i = 0; i < 20000; i++)
+          {
+            auto t = clock_type::now();
+            tracer.record(w, TaskTracer::Kind::Run, i, t, t);
+          }
+        }));
+  }
+  std::size_t writes = 0;
+  for(; writes < 20; writes++)
+  {
+    std::stringstream ss;
+    tracer.write(ss);
+  }
+  for(auto & t : threads)
+  {
+    t.join();
+  }
+  CHECK(writes == 20u);
+  CHECK(tracer.numSpans() == 3 * 64u);
+}
+
+TEST_CASE("TaskTracer_record_cost", "[.benchmark]")
+{
+  const std::size_t n = 1000000;
+  TaskTracer tracer(1, TaskTracer::defaultCapacity);
+  tracer.start();
+  auto t = clock_type::now();
+  auto start = clock_type::now();
+  for(std::size_t i = 0; i < n; i++)
+  {
+    tracer.record(0, TaskTracer::Kind::Run, i, t, t);
+  }
+  std::chrono::duration<double, std::nano> dt = clock_type::now() - start;
+  std::cout << "record: " << dt.count() / double(n) << " ns/span" << std::endl;
+}
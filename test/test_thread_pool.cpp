@@ -1,9 +1,16 @@
 #include "thread_pool.h"
 #include "task.h"
+#include "n_queens.h"
 #include "catch.hpp"
 #include <unordered_map>
 #include <mutex>
 #include <exception>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <thread>
 
 TEST_CASE("ThreadPool_empty", "[ThreadPool]")
 {
@@ -253,3 +260,1978 @@ TEST_CASE( "ThreadPool_state_changes_handled", "[ThreadPool]" )
 
   CHECK(pool.use_count() == 1u);
 }
+
+TEST_CASE( "ThreadPool_work_stealing_run_tasks", "[ThreadPool]" )
+{
+  // Catch assertions are not thread-safe, the workers only count
+  std::atomic<std::size_t> counter(0);
+  std::atomic<std::size_t> notRunning(0);
+  std::size_t n = 417;
+  auto pool = ThreadPool::create(4, ThreadPool::Scheduler::WorkStealing);
+  CHECK(pool->getScheduler() == ThreadPool::Scheduler::WorkStealing);
+  pool->activate();
+  for(std::size_t i = 0; i < n; i++)
+  {
+    pool->addTask(Task::create([&counter, &notRunning](std::shared_ptr<Task> task) {
+          if(task->getState() != Task::State::Running)
+          {
+            notRunning++;
+          }
+          counter++;
+        }));
+  }
+  pool->terminate();
+  CHECK(counter == n);
+  CHECK(notRunning == 0u);
+  CHECK(pool->numTasks(Task::State::Ready) == 0u);
+  CHECK(pool->numTasks(Task::State::Done) == n);
+  CHECK(pool->numTasks(Task::State::Failed) == 0u);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_work_stealing_nested_tasks", "[ThreadPool]" )
+{
+  std::atomic<std::size_t> counter(0);
+  std::size_t n = 64;
+  std::size_t m = 16;
+  auto pool = ThreadPool::create(4, ThreadPool::Scheduler::WorkStealing);
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(std::size_t i = 0; i < n; i++)
+  {
+    auto task = Task::create([&counter](std::shared_ptr<Task>) {
+        counter++;
+      });
+    task->onStateChange(Task::State::Running,
+                        [&counter, m](std::shared_ptr<Task>,
+                                      std::shared_ptr<ThreadPool> pool) {
+                          for(std::size_t j = 0; j < m; j++)
+                          {
+                            pool->addTask(Task::create([&counter](){
+                                  counter++;
+                                }));
+                          }
+                        });
+    tasks.push_back(task);
+  }
+  pool->activate();
+  for(auto & task : tasks)
+  {
+    pool->addTask(task);
+  }
+  for(auto & task : tasks)
+  {
+    task->wait();
+  }
+  pool->terminate();
+  CHECK(counter == n * (m + 1));
+  CHECK(pool->numTasks(Task::State::Done) == n * (m + 1));
+  CHECK(pool->numTasks(Task::State::Ready) == 0u);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_work_stealing_wait_for_task", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(2, ThreadPool::Scheduler::WorkStealing);
+  auto task1 = Task::create([](){});
+  auto task2 = Task::create([](){ throw std::exception(); });
+  pool->addTask(task1);
+  pool->addTask(task2);
+  CHECK(pool->numTasks(Task::State::Ready) == 2u);
+  CHECK(pool->getTasks().first.size() == 2u);
+  pool->activate();
+  task2->wait();
+  task1->wait();
+  pool->terminate();
+  CHECK(task1->getState() == Task::State::Done);
+  CHECK(task2->getState() == Task::State::Failed);
+  CHECK(pool->getTasks().second.size() == 2u);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_lock_free_ring_run_tasks", "[ThreadPool]" )
+{
+  std::atomic<std::size_t> counter(0);
+  std::size_t n = 417;
+  auto pool = ThreadPool::create(4, ThreadPool::Scheduler::LockFreeRing, 64);
+  CHECK(pool->getCapacity() == 64u);
+  pool->activate();
+  for(std::size_t i = 0; i < n; i++)
+  {
+    auto task = Task::create([&counter](){ counter++; });
+    while(!pool->trySubmit(task))
+    {
+      CHECK(task->getState() == Task::State::Waiting);
+      CHECK(task->getTaskId() == Task::undefinedTaskId);
+      std::this_thread::yield();
+    }
+  }
+  for(std::size_t i = 0; i < n; i++)
+  {
+    pool->addTask(Task::create([&counter](){ counter++; }));
+  }
+  pool->terminate();
+  CHECK(counter == 2 * n);
+  CHECK(pool->numTasks(Task::State::Ready) == 0u);
+  CHECK(pool->numTasks(Task::State::Done) == 2 * n);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_try_submit_full_ring", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1, ThreadPool::Scheduler::LockFreeRing, 2);
+  auto task1 = Task::create([](){});
+  auto task2 = Task::create([](){});
+  auto task3 = Task::create([](){});
+  CHECK(pool->trySubmit(task1));
+  CHECK(pool->trySubmit(task2));
+  CHECK_FALSE(pool->trySubmit(task3));
+  CHECK(task3->getState() == Task::State::Waiting);
+  CHECK(pool->numTasks(Task::State::Ready) == 2u);
+  pool->activate();
+  task2->wait();
+  CHECK(pool->trySubmit(task3));
+  task3->wait();
+  pool->terminate();
+  CHECK(pool->numTasks(Task::State::Done) == 3u);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_add_task_full_ring", "[ThreadPool]" )
+{
+  // addTask before activation overflows the ring instead of waiting
+  auto pool = ThreadPool::create(2, ThreadPool::Scheduler::LockFreeRing, 4);
+  std::atomic<std::size_t> counter(0);
+  for(std::size_t i = 0; i < 8; i++)
+  {
+    pool->addTask(Task::create([&counter](){ counter++; }));
+  }
+  CHECK(pool->numTasks(Task::State::Ready) == 8u);
+  CHECK_FALSE(pool->trySubmit(Task::create([](){})));
+  pool->activate();
+  // the only worker fills its own ring
+  auto single = ThreadPool::create(1, ThreadPool::Scheduler::LockFreeRing, 2);
+  single->activate();
+  auto parent = Task::create([&counter]() {
+      for(std::size_t i = 0; i < 8; i++)
+      {
+        ThreadPool::getCurrentPool()->addTask(Task::create([&counter](){ counter++; }));
+      }
+    });
+  single->addTask(parent);
+  parent->wait();
+  single->terminate();
+  pool->terminate();
+  CHECK(counter == 16u);
+  CHECK(pool->numTasks(Task::State::Done) == 8u);
+  CHECK(single->numTasks(Task::State::Done) == 9u);
+}
+
+TEST_CASE( "ThreadPool_default_capacity", "[ThreadPool]" )
+{
+  CHECK(ThreadPool::create(1)->getCapacity() == 0u);
+  CHECK(ThreadPool::create(1, ThreadPool::Scheduler::LockFreeRing)->getCapacity() ==
+        ThreadPool::defaultRingCapacity);
+}
+
+static double submitThroughput(ThreadPool::Scheduler scheduler,
+                               std::size_t numProducers,
+                               std::size_t n)
+{
+  auto pool = ThreadPool::create(4, scheduler);
+  pool->activate();
+  std::vector<std::thread> producers;
+  auto start = std::chrono::steady_clock::now();
+  for(std::size_t p = 0; p < numProducers; p++)
+  {
+    producers.push_back(std::thread([pool, n]() {
+          for(std::size_t i = 0; i < n; i++)
+          {
+            auto task = Task::create([](){});
+            while(!pool->trySubmit(task))
+            {
+              std::this_thread::yield();
+            }
+          }
+        }));
+  }
+  for(auto & t : producers)
+  {
+    t.join();
+  }
+  pool->terminate();
+  std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+  return double(numProducers * n) / dt.count();
+}
+
+TEST_CASE( "ThreadPool_submit_throughput", "[.benchmark]" )
+{
+  const std::size_t n = 50000;
+  for(std::size_t p = 1; p <= 4; p *= 2)
+  {
+    std::cout << "producers: " << p
+              << " list: "
+              << submitThroughput(ThreadPool::Scheduler::Fifo, p, n)
+              << " tasks/s ring: "
+              << submitThroughput(ThreadPool::Scheduler::LockFreeRing, p, n)
+              << " tasks/s" << std::endl;
+  }
+}
+
+static double emptyTaskThroughput(std::size_t numThreads, std::size_t n,
+                                  bool observe)
+{
+  std::atomic<std::size_t> transitions(0);
+  auto pool = ThreadPool::create(numThreads);
+  std::vector<std::shared_ptr<Task> > tasks;
+  tasks.reserve(n);
+  for(std::size_t i = 0; i < n; i++)
+  {
+    tasks.push_back(Task::create([](){}));
+    if(observe)
+    {
+      tasks.back()->onStateChange([&transitions](Task::State,
+                                                 std::shared_ptr<Task>,
+                                                 std::shared_ptr<ThreadPool>) {
+                                    transitions++;
+                                  });
+    }
+  }
+  pool->activate();
+  auto start = std::chrono::steady_clock::now();
+  pool->addTasks(tasks.begin(), tasks.end());
+  for(auto & t : tasks)
+  {
+    t->wait();
+  }
+  std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+  pool->terminate();
+  return double(n) / dt.count();
+}
+
+TEST_CASE( "ThreadPool_empty_task_throughput", "[.benchmark]" )
+{
+  const std::size_t n = 200000;
+  for(std::size_t numThreads = 1; numThreads <= 4; numThreads *= 2)
+  {
+    std::cout << "threads: " << numThreads
+              << " without observers: "
+              << emptyTaskThroughput(numThreads, n, false)
+              << " tasks/s with observers: "
+              << emptyTaskThroughput(numThreads, n, true)
+              << " tasks/s" << std::endl;
+  }
+}
+
+TEST_CASE( "ThreadPool_add_tasks_batch", "[ThreadPool]" )
+{
+  std::atomic<std::size_t> counter(0);
+  std::atomic<std::size_t> numReady(0);
+  std::size_t n = 417;
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(std::size_t i = 0; i < n; i++)
+  {
+    auto task = Task::create([&counter](){ counter++; });
+    task->onStateChange(Task::State::Ready,
+                        [&numReady](std::shared_ptr<Task>,
+                                    std::shared_ptr<ThreadPool>) {
+                          numReady++;
+                        });
+    tasks.push_back(task);
+  }
+  auto pool = ThreadPool::create(4);
+  pool->addTasks(tasks.begin(), tasks.end());
+  CHECK(pool->numTasks(Task::State::Ready) == n);
+  CHECK(numReady == n);
+  for(std::size_t i = 0; i < n; i++)
+  {
+    CHECK(tasks[i]->getState() == Task::State::Ready);
+    CHECK(tasks[i]->getTaskId() == i);
+  }
+  pool->activate();
+  pool->terminate();
+  CHECK(counter == n);
+  CHECK(pool->numTasks(Task::State::Done) == n);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_add_tasks_vector", "[ThreadPool]" )
+{
+  std::atomic<std::size_t> counter(0);
+  std::size_t n = 100;
+  for(auto scheduler : { ThreadPool::Scheduler::Fifo,
+                         ThreadPool::Scheduler::WorkStealing,
+                         ThreadPool::Scheduler::LockFreeRing })
+  {
+    auto pool = ThreadPool::create(4, scheduler);
+    pool->activate();
+    std::vector<std::shared_ptr<Task> > tasks;
+    for(std::size_t i = 0; i < n; i++)
+    {
+      tasks.push_back(Task::create([&counter](){ counter++; }));
+    }
+    pool->addTasks(std::move(tasks));
+    pool->addTasks(std::vector<std::shared_ptr<Task> >());
+    pool->terminate();
+    CHECK(pool->numTasks(Task::State::Done) == n);
+    CHECK(pool.use_count() == 1u);
+  }
+  CHECK(counter == 3 * n);
+}
+
+TEST_CASE( "ThreadPool_add_tasks_is_all_or_nothing", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(0);
+  auto task1 = Task::create([](){});
+  auto task2 = Task::create([](){});
+  std::vector<std::shared_ptr<Task> > tasks({task1, task2, task1});
+  CHECK_THROWS_AS(pool->addTasks(tasks.begin(), tasks.end()), std::logic_error);
+  CHECK(task1->getState() == Task::State::Waiting);
+  CHECK(task2->getState() == Task::State::Waiting);
+  CHECK(pool->numTasks(Task::State::Ready) == 0u);
+  pool->addTask(task1);
+  CHECK_THROWS_AS(pool->addTasks(tasks.begin(), tasks.begin() + 2),
+                  std::logic_error);
+  CHECK(task2->getState() == Task::State::Waiting);
+  CHECK(pool->numTasks(Task::State::Ready) == 1u);
+  pool->activate();
+  pool->terminate();
+  CHECK_THROWS_AS(pool->addTasks(tasks.begin() + 1, tasks.begin() + 2),
+                  std::logic_error);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_add_tasks_validates_before_overflow", "[ThreadPool]" )
+{
+  for(auto policy : { ThreadPool::Overflow::Block, ThreadPool::Overflow::Reject,
+                      ThreadPool::Overflow::DropOldest, ThreadPool::Overflow::CallerRuns })
+  {
+    auto pool = ThreadPool::create(1);
+    pool->setMaxQueueDepth(1, policy);
+    auto queued = Task::create([](){});
+    pool->addTask(queued);
+    auto fresh = Task::create([](){});
+    // the invalid batch throws before it drops, blocks, rejects or runs
+    // anything
+    CHECK_THROWS_AS(pool->addTasks({ fresh, queued }), std::logic_error);
+    CHECK(queued->getState() == Task::State::Ready);
+    CHECK(fresh->getState() == Task::State::Waiting);
+    CHECK(fresh->getTaskId() == Task::undefinedTaskId);
+    auto stats = pool->getStats();
+    CHECK(stats.numDropped == 0u);
+    CHECK(stats.numRejected == 0u);
+    CHECK(stats.numCallerRuns == 0u);
+    pool->activate();
+    queued->wait();
+    pool->addTasks({ fresh });
+    pool->terminate();
+    CHECK(fresh->getState() == Task::State::Done);
+  }
+}
+
+TEST_CASE( "ThreadPool_priority_scheduler", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1, ThreadPool::Scheduler::Priority);
+  pool->setAgingInterval(std::chrono::steady_clock::duration::zero());
+  std::vector<int> order;
+  std::mutex orderMutex;
+  auto makeTask = [&order, &orderMutex](int i, Task::Priority p) {
+    auto task = Task::create([i, &order, &orderMutex](){
+        std::lock_guard<std::mutex> lock(orderMutex);
+        order.push_back(i);
+      });
+    task->setPriority(p);
+    return task;
+  };
+  pool->addTask(makeTask(1, Task::Priority::Low));
+  pool->addTask(makeTask(2, Task::Priority::Normal));
+  pool->addTask(makeTask(3, Task::Priority::Interactive));
+  pool->addTask(makeTask(4, Task::Priority::Normal));
+  CHECK(pool->numTasks(Task::State::Ready) == 4u);
+  auto queued = pool->getTasks().first;
+  REQUIRE(queued.size() == 4u);
+  CHECK(queued[0]->getPriority() == Task::Priority::Interactive);
+  CHECK(queued[3]->getPriority() == Task::Priority::Low);
+  pool->activate();
+  pool->terminate();
+  CHECK(order == std::vector<int>({3, 2, 4, 1}));
+  CHECK(pool->numTasks(Task::State::Done) == 4u);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_aging_requires_priority_scheduler", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1);
+  CHECK_THROWS_AS(pool->setAgingInterval(std::chrono::seconds(1)),
+                  std::logic_error);
+}
+
+TEST_CASE( "ThreadPool_max_queue_depth_reject", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1);
+  pool->setMaxQueueDepth(2, ThreadPool::Overflow::Reject);
+  CHECK(pool->getMaxQueueDepth() == 2u);
+  CHECK(pool->getOverflow() == ThreadPool::Overflow::Reject);
+  pool->addTask(Task::create([](){}));
+  pool->addTask(Task::create([](){}));
+  auto rejected = Task::create([](){});
+  CHECK_THROWS_AS(pool->addTask(rejected), QueueFull);
+  CHECK_FALSE(pool->trySubmit(rejected));
+  CHECK_THROWS_AS(pool->addTasks({ Task::create([](){}) }), QueueFull);
+  // waiting tasks do not take a slot
+  auto dependent = Task::create([](){});
+  dependent->dependsOn(rejected);
+  pool->addTask(dependent);
+  CHECK(rejected->getState() == Task::State::Waiting);
+  CHECK(pool->getStats().numRejected == 3u);
+  CHECK_THROWS_AS(pool->setMaxQueueDepth(0), std::logic_error);
+  pool->activate();
+  pool->terminate();
+  CHECK(pool->numTasks(Task::State::Done) == 2u);
+  CHECK(pool->numTasks(Task::State::Waiting) == 1u);
+}
+
+TEST_CASE( "ThreadPool_max_queue_depth_drop_oldest", "[ThreadPool]" )
+{
+  for(auto scheduler : { ThreadPool::Scheduler::Fifo,
+                         ThreadPool::Scheduler::WorkStealing,
+                         ThreadPool::Scheduler::Priority })
+  {
+    auto pool = ThreadPool::create(1, scheduler);
+    pool->setMaxQueueDepth(2, ThreadPool::Overflow::DropOldest);
+    std::vector<std::shared_ptr<Task> > tasks;
+    for(int i = 0; i < 4; i++)
+    {
+      tasks.push_back(Task::create([](){}));
+      tasks.back()->setPriority(i == 0 ? Task::Priority::High : Task::Priority::Low);
+      pool->addTask(tasks.back());
+    }
+    CHECK(tasks[0]->getState() == Task::State::Canceled);
+    CHECK(tasks[1]->getState() == Task::State::Canceled);
+    CHECK(pool->numTasks(Task::State::Ready) == 2u);
+    pool->addTasks({ Task::create([](){}), Task::create([](){}) });
+    pool->activate();
+    pool->terminate();
+    CHECK(tasks[2]->getState() == Task::State::Canceled);
+    CHECK(tasks[3]->getState() == Task::State::Canceled);
+    auto stats = pool->getStats();
+    CHECK(stats.numDropped == 4u);
+    CHECK(stats.numCanceled == 4u);
+    CHECK(stats.numDone == 2u);
+  }
+}
+
+TEST_CASE( "ThreadPool_max_queue_depth_caller_runs", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1);
+  pool->setMaxQueueDepth(1, ThreadPool::Overflow::CallerRuns);
+  std::thread::id queuedThread;
+  std::thread::id callerThread;
+  auto queued = Task::create([&queuedThread](){ queuedThread = std::this_thread::get_id(); });
+  auto caller = Task::create([&callerThread](){ callerThread = std::this_thread::get_id(); });
+  std::vector<Task::State> states;
+  caller->onStateChange([&states](Task::State s,
+                                  std::shared_ptr<Task>,
+                                  std::shared_ptr<ThreadPool>) {
+                          states.push_back(s);
+                        });
+  pool->addTask(queued);
+  pool->addTask(caller);
+  CHECK(caller->getState() == Task::State::Done);
+  CHECK(callerThread == std::this_thread::get_id());
+  CHECK(states == std::vector<Task::State>({ Task::State::Ready,
+                                             Task::State::Running,
+                                             Task::State::Done }));
+  pool->addTasks({ Task::create([](){ return false; }) });
+  pool->activate();
+  pool->terminate();
+  CHECK(queuedThread != std::this_thread::get_id());
+  auto stats = pool->getStats();
+  CHECK(stats.numCallerRuns == 2u);
+  CHECK(stats.numDone == 2u);
+  CHECK(stats.numFailed == 1u);
+  CHECK(stats.runTime.count() == 3u);
+}
+
+TEST_CASE( "ThreadPool_max_queue_depth_block", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1);
+  pool->setMaxQueueDepth(1, ThreadPool::Overflow::Block);
+  std::atomic<bool> open(false);
+  auto gate = Task::create([&open](){
+      while(!open)
+      {
+        std::this_thread::yield();
+      }
+    });
+  pool->activate();
+  pool->addTask(gate);
+  while(gate->getState() != Task::State::Running)
+  {
+    std::this_thread::yield();
+  }
+  pool->addTask(Task::create([](){}));
+  CHECK_FALSE(pool->trySubmit(Task::create([](){})));
+  std::atomic<bool> added(false);
+  std::thread producer([&pool, &added]() {
+      pool->addTask(Task::create([](){}));
+      added = true;
+    });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  CHECK_FALSE(added);
+  open = true;
+  producer.join();
+  CHECK(added);
+  pool->terminate();
+  CHECK(pool->numTasks(Task::State::Done) == 3u);
+  CHECK(pool->getStats().numRejected == 1u);
+}
+
+TEST_CASE( "ThreadPool_max_queue_depth_block_batch", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1);
+  pool->setMaxQueueDepth(3, ThreadPool::Overflow::Block);
+  std::atomic<bool> open(false);
+  auto gate = Task::create([&open](){
+      while(!open)
+      {
+        std::this_thread::yield();
+      }
+    });
+  pool->activate();
+  pool->addTask(gate);
+  while(gate->getState() != Task::State::Running)
+  {
+    std::this_thread::yield();
+  }
+  pool->addTasks({ Task::create([](){}), Task::create([](){}) });
+  // one slot is free, the batch waits until both of its tasks fit
+  std::atomic<bool> added(false);
+  std::thread producer([&pool, &added]() {
+      pool->addTasks({ Task::create([](){}), Task::create([](){}) });
+      added = true;
+    });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  CHECK_FALSE(added);
+  CHECK(pool->numTasks(Task::State::Ready) == 2u);
+  open = true;
+  producer.join();
+  CHECK(added);
+  // larger than the bound, it waits for an empty queue
+  std::vector<std::shared_ptr<Task> > batch;
+  for(int i = 0; i < 5; i++)
+  {
+    batch.push_back(Task::create([](){}));
+  }
+  pool->addTasks(batch.begin(), batch.end());
+  pool->terminate();
+  CHECK(pool->numTasks(Task::State::Done) == 10u);
+  CHECK(pool->getStats().numRejected == 0u);
+}
+
+TEST_CASE( "ThreadPool_task_dependencies_diamond", "[ThreadPool]" )
+{
+  std::vector<int> order;
+  std::mutex orderMutex;
+  auto makeTask = [&order, &orderMutex](int i) {
+    return Task::create([i, &order, &orderMutex](){
+        std::lock_guard<std::mutex> lock(orderMutex);
+        order.push_back(i);
+      });
+  };
+  auto a = makeTask(1);
+  auto b = makeTask(2);
+  auto c = makeTask(3);
+  auto d = makeTask(4);
+  b->dependsOn(a);
+  c->dependsOn(a);
+  d->dependsOn(b);
+  d->dependsOn(c);
+  auto pool = ThreadPool::create(4);
+  pool->addTask(d);
+  pool->addTask(c);
+  pool->addTask(b);
+  CHECK(pool->numTasks(Task::State::Waiting) == 3u);
+  CHECK(pool->numTasks(Task::State::Ready) == 0u);
+  CHECK(d->getState() == Task::State::Waiting);
+  pool->activate();
+  pool->addTask(a);
+  d->wait();
+  pool->terminate();
+  REQUIRE(order.size() == 4u);
+  CHECK(order.front() == 1);
+  CHECK(order.back() == 4);
+  CHECK(pool->numTasks(Task::State::Waiting) == 0u);
+  CHECK(pool->numTasks(Task::State::Done) == 4u);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_task_dependencies_failure_propagates", "[ThreadPool]" )
+{
+  bool ran = false;
+  auto a = Task::create([](){ throw std::exception(); });
+  auto b = Task::create([&ran](){ ran = true; });
+  auto c = Task::create([&ran](){ ran = true; });
+  auto independent = Task::create([](){});
+  b->dependsOn(a);
+  c->dependsOn(b);
+  std::vector<Task::State> states;
+  c->onStateChange([&states](Task::State s,
+                             std::shared_ptr<Task>,
+                             std::shared_ptr<ThreadPool>) {
+                     states.push_back(s);
+                   });
+  auto pool = ThreadPool::create(2);
+  pool->activate();
+  pool->addTask(c);
+  pool->addTask(b);
+  pool->addTask(a);
+  pool->addTask(independent);
+  c->wait();
+  b->wait();
+  pool->terminate();
+  CHECK_FALSE(ran);
+  CHECK(a->getState() == Task::State::Failed);
+  CHECK(b->getState() == Task::State::Canceled);
+  CHECK(c->getState() == Task::State::Canceled);
+  CHECK(states == std::vector<Task::State>({Task::State::Canceled}));
+  CHECK(pool->numTasks(Task::State::Failed) == 1u);
+  CHECK(pool->numTasks(Task::State::Canceled) == 2u);
+  CHECK(pool->numTasks(Task::State::Done) == 1u);
+  CHECK(pool->numTasks(Task::State::Waiting) == 0u);
+
+  // depending on a task that has already failed cancels on submission
+  auto late = Task::create([&ran](){ ran = true; });
+  late->dependsOn(a);
+  auto pool2 = ThreadPool::create(1);
+  pool2->addTask(late);
+  CHECK(late->getState() == Task::State::Canceled);
+  late->wait();
+  CHECK_FALSE(ran);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_task_depends_on_finished_task", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1);
+  pool->activate();
+  auto a = Task::create([](){});
+  pool->addTask(a);
+  a->wait();
+  auto b = Task::create([](){});
+  b->dependsOn(a);
+  pool->addTask(b);
+  b->wait();
+  pool->terminate();
+  CHECK(b->getState() == Task::State::Done);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_task_depends_on_task_of_terminated_pool", "[ThreadPool]" )
+{
+  std::atomic<bool> release(false);
+  bool ran = false;
+  auto y = Task::create([&release](){
+      while(!release)
+      {
+        std::this_thread::yield();
+      }
+    });
+  auto x = Task::create([&ran](){ ran = true; });
+  x->dependsOn(y);
+  auto p = ThreadPool::create(1);
+  auto q = ThreadPool::create(1);
+  p->activate();
+  q->activate();
+  p->addTask(x);
+  q->addTask(y);
+  p->terminate(ThreadPool::Shutdown::Cancel);
+  release = true;
+  // p has no workers left, x must not stay Ready in its queue
+  x->wait();
+  q->terminate();
+  CHECK_FALSE(ran);
+  CHECK(y->getState() == Task::State::Done);
+  CHECK(x->getState() == Task::State::Canceled);
+  CHECK(p->numTasks(Task::State::Ready) == 0u);
+  CHECK(p->numTasks(Task::State::Waiting) == 0u);
+  CHECK(p->numTasks(Task::State::Canceled) == 1u);
+
+  // released while a worker of the terminating pool still runs, it is
+  // drained like any queued task
+  release = false;
+  y = Task::create([&release](){
+      while(!release)
+      {
+        std::this_thread::yield();
+      }
+    });
+  x = Task::create([&ran](){ ran = true; });
+  x->dependsOn(y);
+  p = ThreadPool::create(1);
+  q = ThreadPool::create(1);
+  p->activate();
+  q->activate();
+  p->addTask(Task::create([&p, &x, &release](){
+        while(p->getState() != ThreadPool::State::Terminated)
+        {
+          std::this_thread::yield();
+        }
+        release = true;
+        while(x->getState() == Task::State::Waiting)
+        {
+          std::this_thread::yield();
+        }
+      }));
+  p->addTask(x);
+  q->addTask(y);
+  auto unrun = p->terminate();
+  q->terminate();
+  CHECK(ran);
+  CHECK(x->getState() == Task::State::Done);
+  CHECK(unrun.empty());
+}
+
+TEST_CASE( "ThreadPool_terminate_drains_dependencies", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1);
+  std::vector<int> order;
+  auto a = Task::create([&order](){ order.push_back(1); });
+  auto b = Task::create([&order](){ order.push_back(2); });
+  auto c = Task::create([&order](){ order.push_back(3); });
+  b->dependsOn(a);
+  c->dependsOn(b);
+  auto d = c->then([&order](){ order.push_back(4); });
+  auto e = d->finally([&order](){ order.push_back(5); });
+  pool->addTask(c);
+  pool->addTask(b);
+  pool->addTask(a);
+  pool->activate();
+  // b, c and the continuations are released by the worker while it drains
+  auto unrun = pool->terminate();
+  CHECK(a->getState() == Task::State::Done);
+  CHECK(b->getState() == Task::State::Done);
+  CHECK(c->getState() == Task::State::Done);
+  CHECK(d->getState() == Task::State::Done);
+  CHECK(e->getState() == Task::State::Done);
+  CHECK(order == std::vector<int>({ 1, 2, 3, 4, 5 }));
+  CHECK(unrun.empty());
+  CHECK(pool->numTasks(Task::State::Waiting) == 0u);
+}
+
+TEST_CASE( "ThreadPool_terminate_returns_released_tasks", "[ThreadPool]" )
+{
+  for(auto mode : { ThreadPool::Shutdown::Drain, ThreadPool::Shutdown::Cancel })
+  {
+    auto pool = ThreadPool::create(1);
+    pool->activate();
+    // finishes during terminate(), Canceled with Shutdown::Cancel
+    auto a = Task::create([&pool, mode](const std::shared_ptr<Task> & t){
+        while(mode == ThreadPool::Shutdown::Drain ?
+              pool->getState() != ThreadPool::State::Terminated :
+              !t->isCancelRequested())
+        {
+          std::this_thread::yield();
+        }
+      });
+    auto b = Task::create([](){});
+    b->dependsOn(a);
+    auto c = a->then([](){});
+    pool->addTask(a);
+    pool->addTask(b);
+    while(a->getState() != Task::State::Running)
+    {
+      std::this_thread::yield();
+    }
+    auto unrun = pool->terminate(mode);
+    if(mode == ThreadPool::Shutdown::Drain)
+    {
+      CHECK(b->getState() == Task::State::Done);
+      CHECK(c->getState() == Task::State::Done);
+      CHECK(unrun.empty());
+    }
+    else
+    {
+      CHECK(a->getState() == Task::State::Canceled);
+      CHECK(b->getState() == Task::State::Canceled);
+      CHECK(c->getState() == Task::State::Canceled);
+      REQUIRE(unrun.size() == 2u);
+      CHECK(std::count(unrun.begin(), unrun.end(), b) == 1);
+      CHECK(std::count(unrun.begin(), unrun.end(), c) == 1);
+    }
+  }
+}
+
+TEST_CASE( "ThreadPool_task_dependencies_large_graph", "[ThreadPool]" )
+{
+  // layers of tasks, every task depends on two tasks of the previous layer
+  const std::size_t width = 100;
+  const std::size_t depth = 100;
+  std::atomic<std::size_t> counter(0);
+  for(auto scheduler : { ThreadPool::Scheduler::Fifo,
+                         ThreadPool::Scheduler::WorkStealing })
+  {
+    counter = 0;
+    std::vector<std::shared_ptr<Task> > graph;
+    for(std::size_t l = 0; l < depth; l++)
+    {
+      for(std::size_t i = 0; i < width; i++)
+      {
+        auto task = Task::create([&counter](){ counter++; });
+        if(l > 0)
+        {
+          task->dependsOn(graph[(l - 1) * width + i]);
+          task->dependsOn(graph[(l - 1) * width + (i + 1) % width]);
+        }
+        graph.push_back(task);
+      }
+    }
+    auto pool = ThreadPool::create(4, scheduler);
+    pool->activate();
+    pool->addTasks(graph.rbegin(), graph.rend());
+    for(auto & t : graph)
+    {
+      t->wait();
+    }
+    pool->terminate();
+    CHECK(counter == width * depth);
+    CHECK(pool->numTasks(Task::State::Done) == width * depth);
+    CHECK(pool->numTasks(Task::State::Waiting) == 0u);
+    CHECK(pool.use_count() == 1u);
+  }
+}
+
+TEST_CASE( "ThreadPool_continuations_then", "[ThreadPool]" )
+{
+  std::vector<int> order;
+  auto a = Task::create([&order](){ order.push_back(1); });
+  auto b = a->then([&order](){ order.push_back(2); });
+  auto c = b->then([&order](){ order.push_back(3); });
+  auto pool = ThreadPool::create(1);
+  CHECK_THROWS_AS(pool->addTask(b), std::logic_error);
+  CHECK_THROWS_AS(pool->addTasks({ a, c }), std::logic_error);
+  CHECK(a->getTaskId() == Task::undefinedTaskId);
+  pool->activate();
+  pool->addTask(a);
+  c->wait();
+  CHECK(order == std::vector<int>({1, 2, 3}));
+  CHECK(c->getState() == Task::State::Done);
+  CHECK(c->getTaskId() != Task::undefinedTaskId);
+
+  // a continuation of a finished task is queued right away
+  auto d = c->then([&order](){ order.push_back(4); });
+  d->wait();
+  CHECK(order.back() == 4);
+  pool->terminate();
+  CHECK(pool->numTasks(Task::State::Done) == 4u);
+  CHECK(pool->numTasks(Task::State::Waiting) == 0u);
+
+  // after terminate() continuations are canceled
+  auto e = a->then([](){});
+  CHECK(e->getState() == Task::State::Canceled);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_continuations_failure_cancels", "[ThreadPool]" )
+{
+  bool ran = false;
+  auto a = Task::create([](){ return false; });
+  auto b = a->then([&ran](){ ran = true; });
+  auto c = b->then([&ran](){ ran = true; });
+  auto pool = ThreadPool::create(2);
+  pool->activate();
+  pool->addTask(a);
+  c->wait();
+  pool->terminate();
+  CHECK_FALSE(ran);
+  CHECK(a->getState() == Task::State::Failed);
+  CHECK(b->getState() == Task::State::Canceled);
+  CHECK(c->getState() == Task::State::Canceled);
+  CHECK(pool->numTasks(Task::State::Canceled) == 0u);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_continuations_when_all_when_any", "[ThreadPool]" )
+{
+  std::atomic<std::size_t> counter(0);
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(std::size_t i = 0; i < 100; i++)
+  {
+    tasks.push_back(Task::create([&counter](){ counter++; }));
+  }
+  std::size_t seen = 0;
+  auto all = Task::whenAll(tasks)->then([&counter, &seen](){ seen = counter; });
+  auto any = Task::whenAny(tasks);
+  auto failing = Task::create([](){ return false; });
+  auto anyOfFailing = Task::whenAny({ failing });
+  auto anyWithFailing = Task::whenAny({ failing, tasks[0] });
+  auto allWithFailing = Task::whenAll({ failing, tasks[0] });
+  CHECK_THROWS_AS(Task::whenAll({}), std::logic_error);
+  CHECK_THROWS_AS(Task::whenAny({}), std::logic_error);
+  auto pool = ThreadPool::create(4, ThreadPool::Scheduler::WorkStealing);
+  pool->activate();
+  pool->addTask(failing);
+  pool->addTasks(tasks.begin(), tasks.end());
+  all->wait();
+  any->wait();
+  anyOfFailing->wait();
+  anyWithFailing->wait();
+  allWithFailing->wait();
+  pool->terminate();
+  CHECK(seen == 100u);
+  CHECK(all->getState() == Task::State::Done);
+  CHECK(any->getState() == Task::State::Done);
+  CHECK(anyOfFailing->getState() == Task::State::Canceled);
+  CHECK(anyWithFailing->getState() == Task::State::Done);
+  CHECK(allWithFailing->getState() == Task::State::Canceled);
+  CHECK(pool->numTasks(Task::State::Done) == 104u);
+  CHECK(pool->numTasks(Task::State::Waiting) == 0u);
+  CHECK(pool->numTasks(Task::State::Ready) == 0u);
+  CHECK(pool.use_count() == 1u);
+}
+
+// sum of 1..n by recursive halving, every level waits for its halves
+static std::size_t forkJoinSum(const std::shared_ptr<ThreadPool> & pool,
+                               std::size_t first, std::size_t last)
+{
+  if(last - first <= 4)
+  {
+    std::size_t sum = 0;
+    for(std::size_t i = first; i < last; i++)
+    {
+      sum += i;
+    }
+    return sum;
+  }
+  std::size_t mid = first + (last - first) / 2;
+  std::size_t upper = 0;
+  auto task = Task::create([&pool, &upper, mid, last]() {
+      upper = forkJoinSum(pool, mid, last);
+    });
+  pool->addTask(task);
+  std::size_t lower = forkJoinSum(pool, first, mid);
+  task->wait();
+  return lower + upper;
+}
+
+TEST_CASE( "ThreadPool_add_task_after", "[ThreadPool]" )
+{
+  // the only worker fires the timers and also waits for a timed task
+  auto pool = ThreadPool::create(1);
+  // timers added before activation fire once the workers run
+  auto early = Task::create([](){});
+  pool->addTaskAfter(std::chrono::milliseconds(1), early);
+  pool->activate();
+  early->wait();
+  CHECK(early->getState() == Task::State::Done);
+
+  std::vector<Task::State> states;
+  auto task = Task::create([](){});
+  task->onStateChange([&states](Task::State s,
+                                std::shared_ptr<Task>,
+                                std::shared_ptr<ThreadPool>) {
+                        states.push_back(s);
+                      });
+  auto start = std::chrono::steady_clock::now();
+  pool->addTaskAfter(std::chrono::milliseconds(20), task);
+  CHECK(task->getState() == Task::State::Waiting);
+  CHECK(pool->numTimers() == 1u);
+  CHECK_THROWS_AS(pool->addTaskAfter(std::chrono::milliseconds(1), task), std::logic_error);
+  task->wait();
+  CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+  CHECK(states == std::vector<Task::State>({ Task::State::Ready,
+                                             Task::State::Running,
+                                             Task::State::Done }));
+  CHECK(pool->numTimers() == 0u);
+
+  // due already
+  auto past = Task::create([](){});
+  pool->addTaskAt(start - std::chrono::seconds(1), past);
+  past->wait();
+  CHECK(past->getState() == Task::State::Done);
+
+  // a task that waits on the worker for a timed one
+  auto inner = Task::create([](){});
+  auto outer = Task::create([&pool, inner]() {
+      pool->addTaskAfter(std::chrono::milliseconds(5), inner);
+      inner->wait();
+    });
+  pool->addTask(outer);
+  outer->wait();
+  CHECK(inner->getState() == Task::State::Done);
+
+  auto late = Task::create([](){});
+  auto successor = Task::create([](){});
+  successor->dependsOn(late);
+  pool->addTask(successor);
+  pool->addTaskAfter(std::chrono::hours(1), late);
+  pool->terminate();
+  CHECK(late->getState() == Task::State::Canceled);
+  CHECK(successor->getState() == Task::State::Canceled);
+  CHECK(pool->numTimers() == 0u);
+  CHECK_THROWS_AS(pool->addTaskAfter(std::chrono::milliseconds(1), Task::create([](){})),
+                  std::logic_error);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_many_timed_tasks", "[ThreadPool]" )
+{
+  const std::size_t n = 10000;
+  auto pool = ThreadPool::create(2);
+  pool->activate();
+  std::atomic<std::size_t> numEarly(0);
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(std::size_t i = 0; i < n; i++)
+  {
+    auto due = (std::chrono::steady_clock::now() +
+                std::chrono::microseconds((i * 7919) % 50000));
+    tasks.push_back(Task::create([due, &numEarly]() {
+          if(std::chrono::steady_clock::now() < due)
+          {
+            numEarly++;
+          }
+        }));
+    pool->addTaskAt(due, tasks.back());
+  }
+  for(auto & task : tasks)
+  {
+    task->wait();
+  }
+  pool->terminate();
+  CHECK(numEarly == 0u);
+  CHECK(pool->numTasks(Task::State::Done) == n);
+}
+
+TEST_CASE( "ThreadPool_periodic_task", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1);
+  CHECK_THROWS_AS(pool->addPeriodicTask(std::chrono::milliseconds(0), [](){}),
+                  std::logic_error);
+  pool->activate();
+  std::atomic<int> count(0);
+  auto periodic = pool->addPeriodicTask(std::chrono::milliseconds(2),
+                                        [&count]() { count++; });
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while(count < 3 && std::chrono::steady_clock::now() < deadline)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  CHECK(count >= 3);
+  periodic->cancel();
+  CHECK(periodic->isCanceled());
+  // the canceled timer is dropped when it expires
+  while(pool->numTimers() > 0 && std::chrono::steady_clock::now() < deadline)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  CHECK(pool->numTimers() == 0u);
+
+  auto running = pool->addPeriodicTask(std::chrono::hours(1), [](){});
+  CHECK(pool->numTimers() == 1u);
+  pool->terminate();
+  CHECK(running->isCanceled());
+  CHECK(running->numRuns() == 0u);
+  CHECK(periodic->numRuns() == pool->numTasks(Task::State::Done));
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_helping_wait", "[ThreadPool]" )
+{
+  const std::size_t n = 4096;
+  for(auto scheduler : { ThreadPool::Scheduler::Fifo,
+                         ThreadPool::Scheduler::WorkStealing,
+                         ThreadPool::Scheduler::Priority })
+  {
+    // far more nested waits than workers
+    auto pool = ThreadPool::create(2, scheduler);
+    pool->activate();
+    std::size_t sum = 0;
+    auto root = Task::create([&pool, &sum, n]() { sum = forkJoinSum(pool, 0, n); });
+    pool->addTask(root);
+    root->wait();
+    CHECK(sum == n * (n - 1) / 2);
+    CHECK_FALSE(ThreadPool::getCurrentPool());
+    CHECK_FALSE(pool->runPendingTask());
+    pool->terminate();
+    CHECK(pool->numTasks(Task::State::Done) == 1024u);
+    CHECK(pool.use_count() == 1u);
+  }
+}
+
+TEST_CASE( "ThreadPool_cancel_ready_task", "[ThreadPool]" )
+{
+  for(auto scheduler : { ThreadPool::Scheduler::Fifo,
+                         ThreadPool::Scheduler::WorkStealing,
+                         ThreadPool::Scheduler::LockFreeRing,
+                         ThreadPool::Scheduler::Priority })
+  {
+    bool ran = false;
+    auto pool = ThreadPool::create(1, scheduler);
+    auto task1 = Task::create([](){});
+    auto task2 = Task::create([&ran](){ ran = true; });
+    auto task3 = Task::create([](){});
+    std::vector<Task::State> states;
+    task2->onStateChange([&states](Task::State s,
+                                   std::shared_ptr<Task>,
+                                   std::shared_ptr<ThreadPool>) {
+                           states.push_back(s);
+                         });
+    pool->addTask(task1);
+    pool->addTask(task2);
+    pool->addTask(task3);
+    CHECK(pool->numTasks(Task::State::Ready) == 3u);
+    CHECK(task2->cancel());
+    CHECK(task2->getState() == Task::State::Canceled);
+    CHECK(pool->numTasks(Task::State::Ready) == 2u);
+    CHECK(pool->numTasks(Task::State::Canceled) == 1u);
+    if(scheduler != ThreadPool::Scheduler::LockFreeRing)
+    {
+      CHECK(pool->getTasks().first ==
+            std::vector<std::shared_ptr<Task> >({task1, task3}));
+    }
+    task2->wait();
+    pool->activate();
+    pool->terminate();
+    CHECK_FALSE(ran);
+    CHECK(states == std::vector<Task::State>({Task::State::Ready,
+                                              Task::State::Canceled}));
+    CHECK(pool->numTasks(Task::State::Done) == 2u);
+    CHECK(pool->numTasks(Task::State::Ready) == 0u);
+    CHECK(pool.use_count() == 1u);
+  }
+}
+
+TEST_CASE( "ThreadPool_cancel_running_task", "[ThreadPool]" )
+{
+  std::atomic<bool> started(false);
+  auto pool = ThreadPool::create(1);
+  auto task = Task::create([&started](std::shared_ptr<Task> t){
+      started = true;
+      while(!t->isCancelRequested())
+      {
+        std::this_thread::yield();
+      }
+    });
+  auto dependent = Task::create([](){});
+  dependent->dependsOn(task);
+  std::vector<Task::State> states;
+  std::mutex statesMutex;
+  task->onStateChange([&states, &statesMutex](Task::State s,
+                                              std::shared_ptr<Task>,
+                                              std::shared_ptr<ThreadPool>) {
+                        std::lock_guard<std::mutex> lock(statesMutex);
+                        states.push_back(s);
+                      });
+  pool->activate();
+  pool->addTask(task);
+  pool->addTask(dependent);
+  while(!started)
+  {
+    std::this_thread::yield();
+  }
+  CHECK(task->cancel());
+  task->wait();
+  dependent->wait();
+  pool->terminate();
+  CHECK(task->getState() == Task::State::Canceled);
+  CHECK(dependent->getState() == Task::State::Canceled);
+  CHECK(states == std::vector<Task::State>({Task::State::Ready,
+                                            Task::State::Running,
+                                            Task::State::CancelRequested,
+                                            Task::State::Canceled}));
+  CHECK(pool->numTasks(Task::State::Canceled) == 2u);
+  CHECK(pool->numTasks(Task::State::Done) == 0u);
+  CHECK(pool->numTasks(Task::State::Waiting) == 0u);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_cancel_waiting_task", "[ThreadPool]" )
+{
+  bool ran = false;
+  auto pool = ThreadPool::create(1);
+  auto first = Task::create([](){});
+  auto second = Task::create([&ran](){ ran = true; });
+  second->dependsOn(first);
+  pool->addTask(second);
+  CHECK(pool->numTasks(Task::State::Waiting) == 1u);
+  CHECK(second->cancel());
+  CHECK(pool->numTasks(Task::State::Waiting) == 0u);
+  CHECK(pool->numTasks(Task::State::Canceled) == 1u);
+  pool->activate();
+  pool->addTask(first);
+  first->wait();
+  pool->terminate();
+  CHECK_FALSE(ran);
+  CHECK(second->getState() == Task::State::Canceled);
+  CHECK(pool->numTasks(Task::State::Done) == 1u);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_cancel_concurrently", "[ThreadPool]" )
+{
+  std::size_t n = 2000;
+  auto pool = ThreadPool::create(4, ThreadPool::Scheduler::WorkStealing);
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(std::size_t i = 0; i < n; i++)
+  {
+    tasks.push_back(Task::create([](){}));
+  }
+  pool->activate();
+  pool->addTasks(tasks.begin(), tasks.end());
+  std::size_t numCanceled = 0;
+  for(std::size_t i = 0; i < n; i += 2)
+  {
+    if(tasks[i]->cancel())
+    {
+      numCanceled++;
+    }
+  }
+  for(auto & t : tasks)
+  {
+    t->wait();
+  }
+  pool->terminate();
+  std::size_t done = 0;
+  std::size_t canceled = 0;
+  for(auto & t : tasks)
+  {
+    if(t->getState() == Task::State::Done)
+    {
+      done++;
+    }
+    else if(t->getState() == Task::State::Canceled)
+    {
+      canceled++;
+    }
+  }
+  CHECK(done + canceled == n);
+  CHECK(pool->numTasks(Task::State::Done) == done);
+  CHECK(pool->numTasks(Task::State::Canceled) == canceled);
+  CHECK(canceled == numCanceled);
+  CHECK(pool->numTasks(Task::State::Ready) == 0u);
+  CHECK(pool.use_count() == 1u);
+}
+
+template<typename PRED>
+static bool waitUntil(PRED pred)
+{
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while(!pred())
+  {
+    if(std::chrono::steady_clock::now() > deadline)
+    {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+TEST_CASE( "ThreadPool_elastic_grows_and_shrinks", "[ThreadPool]" )
+{
+  std::size_t n = 4;
+  auto pool = ThreadPool::createElastic(1, n);
+  pool->setKeepAlive(std::chrono::milliseconds(20));
+  CHECK(pool->getMinSize() == 1u);
+  CHECK(pool->getMaxSize() == n);
+  CHECK(pool->size() == 1u);
+  pool->activate();
+  // every task blocks until all of them run at the same time
+  std::atomic<std::size_t> running(0);
+  std::atomic<std::size_t> together(0);
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(std::size_t i = 0; i < n; i++)
+  {
+    tasks.push_back(Task::create([&running, &together, n](){
+          running++;
+          auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+          while(running < n && std::chrono::steady_clock::now() < deadline)
+          {
+            std::this_thread::yield();
+          }
+          if(running >= n)
+          {
+            together++;
+          }
+        }));
+  }
+  pool->addTasks(tasks.begin(), tasks.end());
+  for(auto & t : tasks)
+  {
+    t->wait();
+  }
+  CHECK(together == n);
+  CHECK(pool->size() == n);
+  CHECK(pool->getTasks().second.size() == n);
+  CHECK(waitUntil([&pool](){ return pool->size() == 1u; }));
+  CHECK(pool->getTasks().second.size() == 1u);
+
+  // retired slots are reused
+  auto task = Task::create([](){});
+  pool->addTask(task);
+  task->wait();
+  CHECK(task->getState() == Task::State::Done);
+  pool->terminate();
+  CHECK(pool->numTasks(Task::State::Done) == n + 1);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_wait_strategies", "[ThreadPool]" )
+{
+  for(auto strategy : { ThreadPool::WaitStrategy::Block,
+                        ThreadPool::WaitStrategy::Park,
+                        ThreadPool::WaitStrategy::SpinThenPark })
+  {
+    for(auto scheduler : { ThreadPool::Scheduler::Fifo,
+                           ThreadPool::Scheduler::WorkStealing })
+    {
+      auto pool = ThreadPool::create(4, scheduler);
+      pool->setWaitStrategy(strategy, 100);
+      CHECK(pool->getWaitStrategy() == strategy);
+      pool->activate();
+      // bursts that find the workers asleep, tasks queued by workers
+      std::atomic<std::size_t> count(0);
+      std::vector<std::shared_ptr<Task> > tasks;
+      for(std::size_t burst = 0; burst < 20; burst++)
+      {
+        for(std::size_t i = 0; i < 50; i++)
+        {
+          tasks.push_back(Task::create([&pool, &count]() {
+                count++;
+                pool->addTask(Task::create([&count]() { count++; }));
+              }));
+        }
+        pool->addTasks(tasks.end() - 50, tasks.end());
+        tasks.back()->wait();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      auto timed = Task::create([](){});
+      pool->addTaskAfter(std::chrono::milliseconds(2), timed);
+      timed->wait();
+      CHECK(waitUntil([&count](){ return count == 2000u; }));
+      CHECK(waitUntil([&pool](){ return pool->getStats().numIdle == 4u; }));
+      pool->terminate();
+      CHECK(pool->numTasks(Task::State::Done) == 2001u);
+      CHECK_THROWS_AS(pool->setWaitStrategy(ThreadPool::WaitStrategy::Block),
+                      std::logic_error);
+    }
+    // parked workers retire after the keep-alive
+    auto pool = ThreadPool::createElastic(1, 3);
+    pool->setKeepAlive(std::chrono::milliseconds(10));
+    pool->setGrowThreshold(1, std::chrono::milliseconds(0));
+    pool->setWaitStrategy(strategy, 100);
+    pool->activate();
+    std::atomic<bool> release(false);
+    std::vector<std::shared_ptr<Task> > tasks;
+    for(int i = 0; i < 3; i++)
+    {
+      tasks.push_back(Task::create([&release]() {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while(!release && std::chrono::steady_clock::now() < deadline)
+            {
+              std::this_thread::yield();
+            }
+          }));
+      pool->addTask(tasks.back());
+    }
+    CHECK(waitUntil([&pool](){ return pool->size() == 3u; }));
+    release = true;
+    for(auto & t : tasks)
+    {
+      t->wait();
+    }
+    CHECK(waitUntil([&pool](){ return pool->size() == 1u; }));
+    pool->terminate();
+    CHECK(pool.use_count() == 1u);
+  }
+}
+
+TEST_CASE( "ThreadPool_terminate_cancel", "[ThreadPool]" )
+{
+  for(auto scheduler : { ThreadPool::Scheduler::Fifo,
+                         ThreadPool::Scheduler::WorkStealing,
+                         ThreadPool::Scheduler::Priority })
+  {
+    auto pool = ThreadPool::create(1, scheduler);
+    std::atomic<bool> started(false);
+    auto running = Task::create([&started](const std::shared_ptr<Task> & t) {
+        started = true;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while(!t->isCancelRequested() && std::chrono::steady_clock::now() < deadline)
+        {
+          std::this_thread::yield();
+        }
+      });
+    pool->addTask(running);
+    std::atomic<std::size_t> numRun(0);
+    std::vector<std::shared_ptr<Task> > queued;
+    for(int i = 0; i < 100; i++)
+    {
+      queued.push_back(Task::create([&numRun]() { numRun++; }));
+    }
+    pool->addTasks(queued.begin(), queued.end());
+    auto successor = Task::create([&numRun]() { numRun++; });
+    successor->dependsOn(queued.back());
+    pool->addTask(successor);
+    auto continuation = queued.front()->then([&numRun]() { numRun++; });
+    auto timed = Task::create([&numRun]() { numRun++; });
+    pool->addTaskAfter(std::chrono::hours(1), timed);
+    pool->activate();
+    CHECK(waitUntil([&started](){ return started.load(); }));
+    auto unrun = pool->terminate(ThreadPool::Shutdown::Cancel);
+    CHECK(numRun == 0u);
+    CHECK(running->getState() == Task::State::Canceled);
+    CHECK(successor->getState() == Task::State::Canceled);
+    REQUIRE(unrun.size() == 103u);
+    CHECK(std::count(unrun.begin(), unrun.end(), timed) == 1);
+    CHECK(std::count(unrun.begin(), unrun.end(), successor) == 1);
+    CHECK(std::count(unrun.begin(), unrun.end(), continuation) == 1);
+    for(auto & task : queued)
+    {
+      CHECK(task->getState() == Task::State::Canceled);
+      CHECK(std::count(unrun.begin(), unrun.end(), task) == 1);
+    }
+    CHECK(pool->numTasks(Task::State::Canceled) == 104u);
+    CHECK(pool.use_count() == 1u);
+  }
+}
+
+TEST_CASE( "ThreadPool_terminate_drain_until", "[ThreadPool]" )
+{
+  // everything runs before the timeout
+  auto pool = ThreadPool::create(2);
+  pool->activate();
+  std::atomic<std::size_t> numRun(0);
+  for(int i = 0; i < 100; i++)
+  {
+    pool->addTask(Task::create([&numRun]() { numRun++; }));
+  }
+  CHECK(pool->terminate(ThreadPool::Shutdown::DrainUntil, std::chrono::seconds(10)).empty());
+  CHECK(numRun == 100u);
+
+  // slow tasks are cut off at the timeout
+  pool = ThreadPool::create(1);
+  pool->activate();
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(int i = 0; i < 100; i++)
+  {
+    tasks.push_back(Task::create([]() {
+          std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }));
+  }
+  pool->addTasks(tasks.begin(), tasks.end());
+  auto start = std::chrono::steady_clock::now();
+  auto unrun = pool->terminate(ThreadPool::Shutdown::DrainUntil,
+                               std::chrono::milliseconds(20));
+  CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+  CHECK_FALSE(unrun.empty());
+  std::size_t numDone = pool->numTasks(Task::State::Done);
+  CHECK(numDone + pool->numTasks(Task::State::Canceled) == 100u);
+  // the task running at the timeout is canceled too, but it ran
+  std::size_t numCanceled = pool->numTasks(Task::State::Canceled);
+  CHECK((unrun.size() == numCanceled || unrun.size() + 1 == numCanceled));
+  for(auto & task : unrun)
+  {
+    CHECK(task->getState() == Task::State::Canceled);
+  }
+  CHECK_THROWS_AS(pool->terminate(), std::logic_error);
+}
+
+TEST_CASE( "ThreadPool_elastic_without_min_threads", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::createElastic(0, 2, ThreadPool::Scheduler::WorkStealing);
+  pool->setKeepAlive(std::chrono::milliseconds(10));
+  pool->setGrowThreshold(100, std::chrono::milliseconds(1));
+  pool->activate();
+  CHECK(pool->size() == 0u);
+  CHECK(pool->getTasks().second.empty());
+  for(int i = 0; i < 3; i++)
+  {
+    auto task = Task::create([](){});
+    pool->addTask(task);
+    task->wait();
+    CHECK(task->getState() == Task::State::Done);
+    CHECK(waitUntil([&pool](){ return pool->size() == 0u; }));
+  }
+  pool->terminate();
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_elastic_without_min_threads_tasks_before_activation", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::createElastic(0, 2);
+  pool->setKeepAlive(std::chrono::milliseconds(10));
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(int i = 0; i < 4; i++)
+  {
+    tasks.push_back(Task::create([](){}));
+  }
+  pool->addTasks(tasks.begin(), tasks.end());
+  CHECK(pool->size() == 0u);
+  pool->activate();
+  for(auto & task : tasks)
+  {
+    task->wait();
+    CHECK(task->getState() == Task::State::Done);
+  }
+  CHECK(waitUntil([&pool](){ return pool->size() == 0u; }));
+  pool->terminate();
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_elastic_without_min_threads_timers", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::createElastic(0, 2);
+  pool->setKeepAlive(std::chrono::milliseconds(10));
+  // added before activation
+  auto early = Task::create([](){});
+  pool->addTaskAfter(std::chrono::milliseconds(1), early);
+  pool->activate();
+  early->wait();
+  CHECK(early->getState() == Task::State::Done);
+  CHECK(waitUntil([&pool](){ return pool->size() == 0u; }));
+  // added after the pool shrank to zero, due after the keep-alive
+  auto late = Task::create([](){});
+  pool->addTaskAfter(std::chrono::milliseconds(50), late);
+  CHECK(pool->size() == 1u);
+  late->wait();
+  CHECK(late->getState() == Task::State::Done);
+  CHECK(waitUntil([&pool](){ return pool->size() == 0u; }));
+  pool->terminate();
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_elastic_setup_throws", "[ThreadPool]" )
+{
+  CHECK_THROWS(ThreadPool::createElastic(2, 1));
+  CHECK_THROWS(ThreadPool::createElastic(0, 0));
+  CHECK_THROWS(ThreadPool::create(2)->setKeepAlive(std::chrono::seconds(1)));
+  auto pool = ThreadPool::createElastic(1, 2);
+  pool->activate();
+  CHECK_THROWS(pool->setGrowThreshold(1, std::chrono::seconds(1)));
+  pool->terminate();
+}
+
+TEST_CASE( "ThreadPool_affinity_policies", "[ThreadPool]" )
+{
+  CpuTopology topology = CpuTopology::detect();
+  std::vector<ThreadPool::Affinity> policies({ ThreadPool::Affinity::None,
+                                               ThreadPool::Affinity::Compact,
+                                               ThreadPool::Affinity::Scatter,
+                                               ThreadPool::Affinity::CpuList,
+                                               ThreadPool::Affinity::NumaNode });
+  for(auto policy : policies)
+  {
+    std::atomic<std::size_t> counter(0);
+    auto pool = ThreadPool::create(2, ThreadPool::Scheduler::WorkStealing);
+    pool->setAffinity(policy, topology, topology.getNodeCpus(0));
+    CHECK(pool->getAffinity() == policy);
+    CHECK(pool->getWorkerCpus(0).empty() == (policy == ThreadPool::Affinity::None));
+    pool->activate();
+    std::vector<std::shared_ptr<Task> > tasks;
+    for(std::size_t i = 0; i < 20; i++)
+    {
+      tasks.push_back(Task::create([&counter](){ counter++; }));
+    }
+    pool->addTasks(tasks.begin(), tasks.end());
+    for(auto & t : tasks)
+    {
+      t->wait();
+    }
+    pool->terminate();
+    CHECK(counter == 20u);
+    CHECK(pool.use_count() == 1u);
+  }
+}
+
+TEST_CASE( "ThreadPool_numa_node_queues", "[ThreadPool]" )
+{
+  // two nodes sharing a CPU, so pinning succeeds on any machine
+  CpuTopology topology({ {0}, {0} });
+  std::atomic<std::size_t> counter(0);
+  auto pool = ThreadPool::create(3, ThreadPool::Scheduler::Priority);
+  CHECK(pool->getAgingInterval() == ThreadPool::defaultAgingInterval);
+  // the node queues keep an interval set before them
+  pool->setAgingInterval(std::chrono::milliseconds(20));
+  pool->setAffinity(ThreadPool::Affinity::NumaNode, topology);
+  CHECK(pool->getAgingInterval() == std::chrono::milliseconds(20));
+  pool->setAgingInterval(std::chrono::milliseconds(10));
+  CHECK(pool->getAgingInterval() == std::chrono::milliseconds(10));
+  CHECK_THROWS_AS(ThreadPool::create(1)->getAgingInterval(), std::logic_error);
+  CHECK(pool->getWorkerCpus(1) == CpuTopology::cpu_list_type({0}));
+  pool->activate();
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(std::size_t i = 0; i < 100; i++)
+  {
+    tasks.push_back(Task::create([&counter](){ counter++; }));
+    pool->addTask(tasks.back());
+  }
+  for(auto & t : tasks)
+  {
+    t->wait();
+  }
+  pool->terminate();
+  CHECK(counter == 100u);
+  CHECK(pool->numTasks(Task::State::Done) == 100u);
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE( "ThreadPool_affinity_after_add_task_throws", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1);
+  CHECK_THROWS(pool->setAffinity(ThreadPool::Affinity::CpuList,
+                                 CpuTopology::cpu_list_type()));
+  pool->addTask(Task::create([](){}));
+  CHECK_THROWS(pool->setAffinity(ThreadPool::Affinity::Compact));
+  pool->activate();
+  pool->terminate();
+}
+
+TEST_CASE( "ThreadPool_event_bus", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(2, ThreadPool::Scheduler::WorkStealing);
+  pool->enableEventBus(16, EventBus::Overflow::Block);
+  std::mutex mutex;
+  std::unordered_map<std::size_t, std::vector<Task::State> > states;
+  pool->onTaskEvents([&mutex, &states](const std::vector<TaskEvent> & events) {
+      std::lock_guard<std::mutex> lock(mutex);
+      for(auto & e : events)
+      {
+        states[e.taskId].push_back(e.state);
+      }
+    });
+  pool->activate();
+  std::atomic<bool> release(false);
+  std::vector<std::shared_ptr<Task> > tasks;
+  tasks.push_back(Task::create([&release](){
+        while(!release)
+        {
+          std::this_thread::yield();
+        }
+      }));
+  for(std::size_t i = 1; i < 50; i++)
+  {
+    tasks.push_back(Task::create([i](){ return i != 7; }));
+  }
+  auto waiting = Task::create([](){});
+  waiting->dependsOn(tasks[0]);
+  pool->addTasks(tasks.begin(), tasks.end());
+  pool->addTask(waiting);
+  waiting->cancel();
+  release = true;
+  for(auto & t : tasks)
+  {
+    t->wait();
+  }
+  pool->terminate();
+  CHECK(pool->numDroppedEvents() == 0u);
+  std::lock_guard<std::mutex> lock(mutex);
+  for(auto & t : tasks)
+  {
+    Task::State final = (t == tasks[7] ? Task::State::Failed : Task::State::Done);
+    CHECK(states[t->getTaskId()] ==
+          std::vector<Task::State>({ Task::State::Ready,
+                                     Task::State::Running,
+                                     final }));
+  }
+  CHECK(states[waiting->getTaskId()] ==
+        std::vector<Task::State>({ Task::State::Canceled }));
+}
+
+TEST_CASE( "ThreadPool_event_bus_listener_submits", "[ThreadPool]" )
+{
+  // the listener publishes Ready on the dispatcher, which must not wait
+  // for itself when the shared ring is full
+  auto pool = ThreadPool::create(2);
+  pool->enableEventBus(4, EventBus::Overflow::Block);
+  std::atomic<std::size_t> numAdded(0);
+  std::weak_ptr<ThreadPool> weak(pool);
+  pool->onTaskEvents([&numAdded, weak](const std::vector<TaskEvent> & events) {
+      auto p = weak.lock();
+      for(std::size_t i = 0; i < events.size() && p && numAdded < 200; i++)
+      {
+        numAdded++;
+        p->addTask(Task::create([](){}));
+      }
+    });
+  pool->activate();
+  pool->addTask(Task::create([](){}));
+  CHECK(waitUntil([&numAdded](){ return numAdded >= 200u; }));
+  CHECK(waitUntil([&pool](){ return pool->numTasks(Task::State::Done) == 201u; }));
+  pool->terminate();
+}
+
+TEST_CASE( "ThreadPool_event_bus_setup_throws", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(1);
+  CHECK(pool->numDroppedEvents() == 0u);
+  CHECK_THROWS(pool->onTaskEvents([](const std::vector<TaskEvent> &) {}));
+  pool->addTask(Task::create([](){}));
+  CHECK_THROWS(pool->enableEventBus());
+  auto pool2 = ThreadPool::create(1);
+  pool2->enableEventBus();
+  pool2->activate();
+  CHECK_THROWS(pool2->onTaskEvents([](const std::vector<TaskEvent> &) {}));
+  pool2->terminate();
+  pool->activate();
+  pool->terminate();
+}
+
+TEST_CASE( "ThreadPool_stats", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(2);
+  std::atomic<bool> release(false);
+  auto blocking = Task::create([&release](){
+      while(!release)
+      {
+        std::this_thread::yield();
+      }
+    });
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(std::size_t i = 0; i < 20; i++)
+  {
+    tasks.push_back(Task::create([i](){
+          std::this_thread::sleep_for(std::chrono::milliseconds(2));
+          return i % 4 != 0;
+        }));
+  }
+  auto canceled = Task::create([](){});
+  canceled->dependsOn(blocking);
+  pool->addTask(blocking);
+  pool->addTasks(tasks.begin(), tasks.end());
+  pool->addTask(canceled);
+  canceled->cancel();
+  pool->activate();
+  for(auto & t : tasks)
+  {
+    t->wait();
+  }
+  PoolStats stats = pool->getStats();
+  CHECK(stats.numThreads == 2u);
+  CHECK(stats.numRunning == 1u);
+  CHECK(pool->numTasks(Task::State::Running) == 1u);
+  CHECK(stats.numDone == 15u);
+  CHECK(stats.numFailed == 5u);
+  CHECK(stats.numCanceled == 1u);
+  CHECK(stats.runTime.count() == 20u);
+  CHECK(stats.runTime.percentile(0.5) >= std::chrono::milliseconds(2));
+  // all tasks were queued before the workers started
+  CHECK(stats.queueWait.count() == 21u);
+  release = true;
+  blocking->wait();
+  pool->terminate();
+  stats = pool->getStats();
+  CHECK(stats.numRunning == 0u);
+  CHECK(stats.numDone == 16u);
+  CHECK(pool->numTasks(Task::State::Done) == 16u);
+  CHECK(pool->numTasks(Task::State::Canceled) == 1u);
+  CHECK(stats.runTime.percentile(0.999) <= stats.runTime.max());
+}
+
+TEST_CASE( "ThreadPool_queued_task_ids", "[ThreadPool]" )
+{
+  for(auto scheduler : { ThreadPool::Scheduler::Fifo,
+                         ThreadPool::Scheduler::WorkStealing,
+                         ThreadPool::Scheduler::Priority })
+  {
+    auto pool = ThreadPool::create(2, scheduler);
+    std::vector<std::shared_ptr<Task> > tasks;
+    for(std::size_t i = 0; i < 25; i++)
+    {
+      tasks.push_back(Task::create([](){}));
+    }
+    // the priority queue lists the highest level first
+    tasks[10]->setPriority(Task::Priority::High);
+    pool->addTasks(tasks.begin(), tasks.end());
+    CHECK(pool->getQueueDepth() == 25u);
+    std::vector<std::size_t> expected;
+    for(auto & task : pool->getTasks().first)
+    {
+      expected.push_back(task->getTaskId());
+    }
+    REQUIRE(expected.size() == 25u);
+    CHECK((scheduler == ThreadPool::Scheduler::Priority) == (expected[0] == 10u));
+    std::vector<std::size_t> ids;
+    for(std::size_t offset = 0; offset < 30; offset += 7)
+    {
+      auto page = pool->getQueuedTaskIds(offset, 7);
+      CHECK(page.size() == std::min<std::size_t>(7, 25 - std::min<std::size_t>(offset, 25)));
+      ids.insert(ids.end(), page.begin(), page.end());
+    }
+    CHECK(ids == expected);
+    CHECK(pool->getQueuedTaskIds(0, 0).empty());
+    pool->activate();
+    pool->terminate();
+    CHECK(pool->getQueueDepth() == 0u);
+    CHECK(pool->getQueuedTaskIds(0, 10).empty());
+  }
+}
+
+TEST_CASE( "ThreadPool_snapshot", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(2);
+  std::atomic<bool> release(false);
+  std::atomic<std::size_t> numStarted(0);
+  std::vector<std::shared_ptr<Task> > blocking;
+  for(std::size_t i = 0; i < 2; i++)
+  {
+    blocking.push_back(Task::create([&release, &numStarted](){
+          numStarted++;
+          while(!release)
+          {
+            std::this_thread::yield();
+          }
+        }));
+    blocking.back()->setPriority(Task::Priority::High);
+  }
+  std::vector<std::shared_ptr<Task> > queued;
+  for(std::size_t i = 0; i < 5; i++)
+  {
+    queued.push_back(Task::create([](){}));
+  }
+  PoolSnapshot snapshot = pool->getSnapshot();
+  CHECK(snapshot.workers.size() == 2u);
+  CHECK(snapshot.queueDepth == 0u);
+  pool->addTasks(blocking.begin(), blocking.end());
+  pool->activate();
+  while(numStarted < 2)
+  {
+    std::this_thread::yield();
+  }
+  pool->addTasks(queued.begin(), queued.end());
+  snapshot = pool->getSnapshot();
+  CHECK(snapshot.queueDepth == 5u);
+  CHECK(snapshot.numThreads == 2u);
+  REQUIRE(snapshot.workers.size() == 2u);
+  std::vector<std::size_t> running;
+  for(auto & worker : snapshot.workers)
+  {
+    CHECK(worker.busy);
+    CHECK(worker.priority == Task::Priority::High);
+    CHECK(worker.version > 0u);
+    for(auto & task : blocking)
+    {
+      if(task->getTaskId() == worker.taskId)
+      {
+        CHECK(task->getThreadId() == worker.workerId);
+      }
+    }
+    running.push_back(worker.taskId);
+  }
+  std::sort(running.begin(), running.end());
+  CHECK(running == std::vector<std::size_t>({ blocking[0]->getTaskId(),
+                                              blocking[1]->getTaskId() }));
+  CHECK(pool->getQueuedTaskIds(3, 10) ==
+        std::vector<std::size_t>({ queued[3]->getTaskId(), queued[4]->getTaskId() }));
+  release = true;
+  pool->terminate();
+  snapshot = pool->getSnapshot();
+  CHECK(snapshot.queueDepth == 0u);
+  for(auto & worker : snapshot.workers)
+  {
+    CHECK_FALSE(worker.busy);
+  }
+}
+
+TEST_CASE( "ThreadPool_tracing", "[ThreadPool]" )
+{
+  auto pool = ThreadPool::create(2);
+  std::stringstream empty;
+  CHECK_THROWS(pool->startTracing());
+  CHECK_THROWS(pool->writeTrace(empty));
+  pool->enableTracing(256);
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(std::size_t i = 0; i < 10; i++)
+  {
+    auto task = Task::create([](){});
+    task->onStateChange(Task::State::Done,
+                        [](std::shared_ptr<Task>, std::shared_ptr<ThreadPool>) {});
+    tasks.push_back(task);
+  }
+  pool->startTracing();
+  pool->addTasks(tasks.begin(), tasks.end());
+  pool->activate();
+  for(auto & t : tasks)
+  {
+    t->wait();
+  }
+  pool->stopTracing();
+  pool->addTask(Task::create([](){}));
+  pool->terminate();
+  std::stringstream ss;
+  pool->writeTrace(ss);
+  std::string json = ss.str();
+  std::size_t runs = 0;
+  std::size_t observers = 0;
+  for(std::size_t pos = 0; (pos = json.find("\"name\":\"", pos)) != std::string::npos; pos++)
+  {
+    runs += (json.compare(pos, 12, "\"name\":\"run\"") == 0);
+    observers += (json.compare(pos, 18, "\"name\":\"observers\"") == 0);
+  }
+  CHECK(runs == 10u);
+  CHECK(observers == 10u);
+  CHECK(json.find("\"name\":\"queue wait\"") != std::string::npos);
+  CHECK(json.find("\"name\":\"worker 1\"") != std::string::npos);
+  auto pool2 = ThreadPool::create(1);
+  pool2->addTask(Task::create([](){}));
+  CHECK_THROWS(pool2->enableTracing());
+  pool2->activate();
+  pool2->terminate();
+}
+
+// formats a status message like the server does for every state change
+static std::string formatEvent(std::size_t taskId, std::size_t threadId,
+                               Task::State s)
+{
+  std::stringstream ss;
+  ss << "{ \"state\": \"" << Task::stateToString(s) << "\""
+     << ",\"taskId\":" << taskId
+     << ",\"threadId\":" << threadId << "}";
+  return ss.str();
+}
+
+static double notificationThroughput(bool useEventBus, std::size_t n)
+{
+  auto pool = ThreadPool::create(4);
+  std::atomic<std::size_t> bytes(0);
+  if(useEventBus)
+  {
+    pool->enableEventBus(EventBus::defaultCapacity, EventBus::Overflow::Block);
+    pool->onTaskEvents([&bytes](const std::vector<TaskEvent> & events) {
+        for(auto & e : events)
+        {
+          bytes += formatEvent(e.taskId, e.threadId, e.state).size();
+        }
+      });
+  }
+  pool->activate();
+  std::vector<std::shared_ptr<Task> > tasks;
+  for(std::size_t i = 0; i < n; i++)
+  {
+    auto task = Task::create([](){});
+    if(!useEventBus)
+    {
+      task->onStateChange([&bytes](Task::State s, std::shared_ptr<Task> t,
+                                   std::shared_ptr<ThreadPool>) {
+          bytes += formatEvent(t->getTaskId(), t->getThreadId(), s).size();
+        });
+    }
+    tasks.push_back(task);
+  }
+  auto start = std::chrono::steady_clock::now();
+  pool->addTasks(tasks.begin(), tasks.end());
+  for(auto & t : tasks)
+  {
+    t->wait();
+  }
+  std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+  pool->terminate();
+  return double(n) / dt.count();
+}
+
+TEST_CASE( "ThreadPool_observer_vs_event_bus_throughput", "[.benchmark]" )
+{
+  const std::size_t n = 200000;
+  std::cout << "observers: " << notificationThroughput(false, n) << " tasks/s"
+            << " event bus: " << notificationThroughput(true, n) << " tasks/s"
+            << std::endl;
+}
@@ -0,0 +1,110 @@
+#include "timer_wheel.h"
+#include "catch.hpp"
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+  typedef TimerWheel::clock_type clock_type;
+
+  TimerWheel::Entry entryAt(clock_type::time_point t)
+  {
+    return TimerWheel::Entry{t, nullptr, nullptr};
+  }
+}
+
+TEST_CASE("TimerWheel_expires_on_time_across_levels", "[TimerWheel]")
+{
+  const std::chrono::milliseconds ms(1);
+  auto start = clock_type::now();
+  TimerWheel wheel(ms, start);
+  // first level, each cascade level and beyond the last level
+  std::vector<long> offsets = { 1, 3, 255, 256, 257, 300, 16383, 16384,
+                                20000, 1048576, 1050000, (1l << 26) + 5 };
+  for(long off : offsets)
+  {
+    wheel.add(entryAt(start + off * ms));
+  }
+  // rounded up to the next tick
+  wheel.add(entryAt(start + 10 * ms + std::chrono::microseconds(1)));
+  CHECK(wheel.size() == offsets.size() + 1);
+  CHECK(wheel.nextExpiry() <= start + ms);
+
+  std::vector<TimerWheel::Entry> expired;
+  wheel.advance(start + ms - std::chrono::microseconds(1), expired);
+  CHECK(expired.empty());
+  for(long off : offsets)
+  {
+    expired.clear();
+    wheel.advance(start + off * ms - std::chrono::microseconds(1), expired);
+    for(auto & e : expired)
+    {
+      CHECK(e.time < start + off * ms);
+    }
+    CHECK(wheel.nextExpiry() <= start + off * ms);
+    expired.clear();
+    wheel.advance(start + off * ms, expired);
+    REQUIRE(expired.size() == 1u);
+    CHECK(expired[0].time == start + off * ms);
+  }
+  CHECK(wheel.size() == 0u);
+  CHECK(wheel.nextExpiry() == clock_type::time_point::max());
+}
+
+TEST_CASE("TimerWheel_random_timers", "[TimerWheel]")
+{
+  const std::chrono::milliseconds ms(1);
+  auto start = clock_type::now();
+  TimerWheel wheel(ms, start);
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<long> dist(0, 5000000);
+  const std::size_t n = 100000;
+  for(std::size_t i = 0; i < n; i++)
+  {
+    wheel.add(entryAt(start + std::chrono::microseconds(dist(gen))));
+  }
+  CHECK(wheel.size() == n);
+  std::size_t numExpired = 0;
+  std::vector<TimerWheel::Entry> expired;
+  auto now = start;
+  while(wheel.size() > 0)
+  {
+    auto next = wheel.nextExpiry();
+    now += std::chrono::microseconds(1700);
+    expired.clear();
+    wheel.advance(now, expired);
+    for(auto & e : expired)
+    {
+      REQUIRE(e.time <= now);
+      // at most one tick late, plus the step of this loop
+      REQUIRE(e.time > now - std::chrono::microseconds(1700) - ms);
+      REQUIRE(next <= now);
+    }
+    numExpired += expired.size();
+  }
+  CHECK(numExpired == n);
+}
+
+TEST_CASE("TimerWheel_past_entries_and_clear", "[TimerWheel]")
+{
+  const std::chrono::milliseconds ms(1);
+  auto start = clock_type::now();
+  TimerWheel wheel(ms, start);
+  std::vector<TimerWheel::Entry> expired;
+  wheel.advance(start + 1000 * ms, expired);
+  CHECK(expired.empty());
+  // due already, expires on the next advance
+  wheel.add(entryAt(start + 10 * ms));
+  wheel.add(entryAt(start - 10 * ms));
+  wheel.advance(start + 1001 * ms, expired);
+  CHECK(expired.size() == 2u);
+  expired.clear();
+  wheel.add(entryAt(start + 2000 * ms));
+  wheel.add(entryAt(clock_type::time_point::max()));
+  CHECK(wheel.size() == 2u);
+  wheel.clear(expired);
+  CHECK(expired.size() == 2u);
+  CHECK(wheel.size() == 0u);
+  CHECK_THROWS_AS(TimerWheel(clock_type::duration::zero(), start), std::logic_error);
+}
@@ -0,0 +1,147 @@
+#include "value_task.h"
+#include "thread_pool.h"
+#include "catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+TEST_CASE("ValueTask_submit_returns_value", "[ValueTask]")
+{
+  auto pool = ThreadPool::create(2);
+  pool->activate();
+  auto task = pool->submit([](){ return std::string("result"); });
+  auto future = task->getFuture();
+  CHECK(future.get() == "result");
+  task->wait();
+  CHECK(task->getState() == Task::State::Done);
+  pool->terminate();
+  CHECK(pool.use_count() == 1u);
+}
+
+TEST_CASE("ValueTask_result_is_moved", "[ValueTask]")
+{
+  auto pool = ThreadPool::create(1);
+  pool->activate();
+  auto task = pool->submit([](){ return std::unique_ptr<int>(new int(42)); });
+  std::unique_ptr<int> value = task->getFuture().get();
+  REQUIRE(value);
+  CHECK(*value == 42);
+  pool->terminate();
+}
+
+TEST_CASE("ValueTask_void", "[ValueTask]")
+{
+  bool ran = false;
+  auto pool = ThreadPool::create(1);
+  pool->activate();
+  auto task = pool->submit([&ran](){ ran = true; });
+  task->getFuture().get();
+  CHECK(ran);
+  pool->terminate();
+}
+
+TEST_CASE("ValueTask_exception_propagates", "[ValueTask]")
+{
+  auto pool = ThreadPool::create(1);
+  pool->activate();
+  auto task = pool->submit([]() -> int { throw std::runtime_error("failed"); });
+  auto future = task->getFuture();
+  CHECK_THROWS_AS(future.get(), std::runtime_error);
+  task->wait();
+  CHECK(task->getState() == Task::State::Failed);
+  pool->terminate();
+}
+
+TEST_CASE("ValueTask_canceled_before_run", "[ValueTask]")
+{
+  auto pool = ThreadPool::create(1);
+  auto task = ValueTask<int>::create([](){ return 1; });
+  pool->addTask(task);
+  CHECK(task->cancel());
+  CHECK_THROWS_AS(task->getFuture().get(), TaskCanceled);
+  pool->activate();
+  pool->terminate();
+}
+
+TEST_CASE("ValueTask_final_state_when_future_ready", "[ValueTask]")
+{
+  auto pool = ThreadPool::create(2);
+  pool->activate();
+  for(int i = 0; i < 200; i++)
+  {
+    auto done = pool->submit([i](){ return i; });
+    auto failed = pool->submit([]() -> int { throw std::runtime_error("failed"); });
+    CHECK(done->getFuture().get() == i);
+    CHECK(done->getState() == Task::State::Done);
+    CHECK_THROWS_AS(failed->getFuture().get(), std::runtime_error);
+    CHECK(failed->getState() == Task::State::Failed);
+  }
+  pool->terminate();
+}
+
+TEST_CASE("ValueTask_canceled_while_running", "[ValueTask]")
+{
+  auto pool = ThreadPool::create(1);
+  pool->activate();
+  std::atomic<bool> started(false);
+  auto task = ValueTask<int>::create([&started](std::shared_ptr<Task> t){
+      started = true;
+      while(!t->isCancelRequested())
+      {
+        std::this_thread::yield();
+      }
+      return 1;
+    });
+  auto future = task->getFuture();
+  pool->addTask(task);
+  while(!started)
+  {
+    std::this_thread::yield();
+  }
+  CHECK(task->cancel());
+  CHECK_THROWS_AS(future.get(), TaskCanceled);
+  CHECK(task->getState() == Task::State::Canceled);
+  pool->terminate();
+}
+
+TEST_CASE("ValueTask_result_ready_in_done_observer", "[ValueTask]")
+{
+  bool ready = false;
+  int value = 0;
+  auto pool = ThreadPool::create(1);
+  auto task = ValueTask<int>::create([](std::shared_ptr<Task> t){
+      return int(t->getTaskId()) + 1;
+    });
+  std::shared_future<int> future = task->getFuture().share();
+  task->onStateChange(Task::State::Done,
+                      [&ready, &value, future](std::shared_ptr<Task>,
+                                               std::shared_ptr<ThreadPool>) {
+                        ready = (future.wait_for(std::chrono::seconds(0)) ==
+                                 std::future_status::ready);
+                        value = future.get();
+                      });
+  pool->activate();
+  pool->addTask(task);
+  task->wait();
+  pool->terminate();
+  CHECK(ready);
+  CHECK(value == int(task->getTaskId()) + 1);
+}
+
+TEST_CASE("ValueTask_depends_on", "[ValueTask]")
+{
+  auto pool = ThreadPool::create(2);
+  auto first = ValueTask<int>::create([](){ return 1; });
+  auto second = ValueTask<int>::create([](){ return 2; });
+  second->dependsOn(first);
+  auto future = second->getFuture();
+  pool->addTask(second);
+  pool->addTask(first);
+  pool->activate();
+  CHECK(future.get() == 2);
+  CHECK(first->getState() == Task::State::Done);
+  pool->terminate();
+}